@@ -91,6 +91,12 @@ namespace dw
 		}
 	}
 
+	WebMapService::Layer* WebMapService::FindLayer(const string& layerName) const
+	{
+		auto availableLayer = availableLayers.find(layerName);
+		return (availableLayer != availableLayers.end()) ? availableLayer->second : NULL;
+	}
+
 	static void HandleGetCapabilities(IHTTPRequest& request)
 	{
 		request.Reply(HTTP_OK, wmsCapabilites);
@@ -129,6 +129,9 @@ namespace dw
 		void Stop();
 
 		void HandleRequest(IHTTPRequest& request);
+
+		// returns the active layer of the given name or NULL, e.g. to render maps within the process instead of sending requests
+		Layer* FindLayer(const string& layerName) const;
 	private:
 
 		void HandleGetMapRequest(IHTTPRequest& request, const string& layers, ContentType contentType, struct GetMapRequest& gmr);
@@ -3,14 +3,17 @@
 #include <iostream>
 #include <iomanip>
 #include <chrono>
+#include <algorithm>
 
 #include <string.h>
+#include <climits>
 
 #include "utils/ImageProcessor.h"
 #include "WebMapTileService.h"
 
 using namespace std;
 using namespace std::chrono;
+using namespace libconfig;
 
 static const char* wmsCapabilites =
 #include "GetCapabilities.xml"
@@ -23,16 +26,16 @@ namespace dw
 	{
 	}
 
-	int WebMapTileService::Start()
+	int WebMapTileService::Start(ChainedSetting& config, WebMapService* localWMS)
 	{
 		// TODO: provide option to list all available layers and propose detailed config info for each layer (e.g. --help <layerName>)
 
 		cout << "WebMapTileService: Reading Config" << endl;
 
-		// TODO: read config
-
 		cout << "WebMapTileService: Creating Layers" << endl;
-		LayerFactory::CreateLayers(availableLayers /*, config*/);
+
+		auto layersConfig = config["layers"];
+		LayerFactory::CreateLayers(availableLayers, layersConfig, localWMS);
 
 		if (availableLayers.size() == 0)
 		{
@@ -50,23 +53,50 @@ namespace dw
 
 	void WebMapTileService::Stop()
 	{
+		// a layer finishes its background work before it is deleted
+		for (auto& layer : availableLayers)
+		{
+			delete layer.second;
+		}
+		availableLayers.clear();
 	}
 
-	void WebMapTileService::LayerFactory::CreateLayers(std::map<string, Layer*>& layers /*, config*/)
+	void WebMapTileService::LayerFactory::CreateLayers(std::map<string, Layer*>& layers, ChainedSetting& config, WebMapService* localWMS)
 	{
-		for (const auto& layerDesc : LayerFactory::GetStaticLayers())
+		const int numLayers = config.getLength();
+		for (int l = 0; l < numLayers; l++)
 		{
-			Layer* newLayer = layerDesc.createLayer();
+			auto layerConfig = config[l];
 
-			cout << "WebMapTileService: Loading layer: " << layerDesc.name << '\r';
-			if (newLayer->Init( /* layerconfig */ ))
+			string layerType = layerConfig["Type"].isMandatory();
+			if (layerConfig.isAnyMandatorySettingMissing()) continue;
+
+			string layerName = layerConfig["Identifier"].defaultValue(layerType);
+
+			auto layerDesc = find_if(GetStaticLayers().begin(), GetStaticLayers().end(), [&](const LayerDesc& desc) { return desc.name == layerType; });
+			if (layerDesc == GetStaticLayers().end())
 			{
-				layers[layerDesc.name] = newLayer;
+				cout << "WebMapTileService: Discarded layer: " << layerName << " (unknown type: " << layerType << ")" << endl;
+				continue;
+			}
+
+			if (layers.find(layerName) != layers.end())
+			{
+				cout << "WebMapTileService: Discarded layer: " << layerName << " (identifier is not unique)" << endl;
+				continue;
+			}
+
+			Layer* newLayer = layerDesc->createLayer();
+
+			cout << "WebMapTileService: Loading layer: " << layerName << '\r';
+			if (newLayer->Init(layerConfig, localWMS))
+			{
+				layers[layerName] = newLayer;
 				wcout << "WebMapTileService: Activated layer: " << newLayer->GetTitle() << endl;
 			}
 			else
 			{
-				cout << "WebMapTileService: Discarded layer: " << layerDesc.name << endl;
+				cout << "WebMapTileService: Discarded layer: " << layerName << endl;
 				delete newLayer;
 			}
 		}
@@ -117,6 +147,10 @@ namespace dw
 				return HandleServiceException(request, "StyleNotDefined");
 			case dw::WebMapTileService::Layer::HGTRR_InvalidFormat:
 				return HandleServiceException(request, "InvalidFormat");
+			case dw::WebMapTileService::Layer::HGTRR_TileOutOfRange:
+				return HandleServiceException(request, "TileOutOfRange");
+			case dw::WebMapTileService::Layer::HGTRR_NotYetBuilt:
+				return HandleServiceException(request, "TileNotYetBuilt");
 			case dw::WebMapTileService::Layer::HGTRR_InternalError:
 			default:
 				return HandleServiceException(request, "Internal Error");
@@ -133,6 +167,85 @@ namespace dw
 		std::cout << "GetMapRequest was processed within " << std::setprecision(5) << time_span.count() << " ms" << endl;
 	}
 
+	void WebMapTileService::HandleGetTileMetadataRequest(IHTTPRequest& request, const string& layers, const struct GetTileRequest& gtr)
+	{
+		auto availableLayer = availableLayers.find(layers);
+		if (availableLayer == availableLayers.end())
+		{
+			return HandleServiceException(request, "LayerNotDefined");
+		}
+
+		string metadata;
+		switch (availableLayer->second->HandleGetTileMetadataRequest(gtr, metadata))
+		{
+		case Layer::HGTRR_OK:
+			return request.Reply(HTTP_OK, metadata);
+		case Layer::HGTRR_TileOutOfRange:
+			return HandleServiceException(request, "TileOutOfRange");
+		case Layer::HGTRR_NotSupported:
+			return HandleServiceException(request, "OperationNotSupported");
+		case Layer::HGTRR_NotYetBuilt:
+			return HandleServiceException(request, "TileNotYetBuilt");
+		default:
+			return HandleServiceException(request, "Internal Error");
+		}
+	}
+
+	void WebMapTileService::HandleInvalidateTilesRequest(IHTTPRequest& request, const string& layers, const struct InvalidateTilesRequest& itr)
+	{
+		auto availableLayer = availableLayers.find(layers);
+		if (availableLayer == availableLayers.end())
+		{
+			return HandleServiceException(request, "LayerNotDefined");
+		}
+
+		string result;
+		switch (availableLayer->second->HandleInvalidateTilesRequest(itr, result))
+		{
+		case Layer::HGTRR_OK:
+			return request.Reply(HTTP_OK, result);
+		case Layer::HGTRR_TileOutOfRange:
+			return HandleServiceException(request, "TileOutOfRange");
+		case Layer::HGTRR_NotSupported:
+			return HandleServiceException(request, "OperationNotSupported");
+		case Layer::HGTRR_AccessDenied:
+			return HandleServiceException(request, "AccessDenied");
+		default:
+			return HandleServiceException(request, "Internal Error");
+		}
+	}
+
+	// minX,minY,maxX,maxY
+	static bool ParseBBox(const string& bboxValue, BBox& bboxOut)
+	{
+		double values[4];
+		size_t offset = 0;
+		for (int v = 0; v < 4; v++)
+		{
+			if (v > 0 && (offset == bboxValue.length() || bboxValue[offset++] != ','))
+			{
+				return false;
+			}
+
+			size_t valueLength = 0;
+			try
+			{
+				values[v] = stod(bboxValue.substr(offset), &valueLength);
+			}
+			catch (...)
+			{
+				return false;
+			}
+			offset += valueLength;
+		}
+
+		bboxOut.minX = values[0];
+		bboxOut.minY = values[1];
+		bboxOut.maxX = values[2];
+		bboxOut.maxY = values[3];
+		return offset == bboxValue.length() && bboxOut.minX <= bboxOut.maxX && bboxOut.minY <= bboxOut.maxY;
+	}
+
 	void WebMapTileService::HandleRequest(IHTTPRequest& request)
 	{
 		string requestType = request.GetArgumentValue("request");
@@ -141,6 +254,50 @@ namespace dw
 		{
 			return HandleGetCapabilities(request);
 		}
+		if (requestType == "GetTileMetadata")
+		{
+			// a cheap request for tile properties like the elevation range, neither style nor format are involved
+			const auto layers = request.GetArgumentValue("layers");
+			const auto tileRow = request.GetArgumentValue("tilerow");
+			const auto tileCol = request.GetArgumentValue("tilecol");
+			const auto tileMatrix = request.GetArgumentValue("tilematrix");
+			if (!layers.size() || !tileRow.size() || !tileCol.size() || !tileMatrix.size())
+			{
+				return HandleServiceException(request, "MissingParameterValue");
+			}
+
+			GetTileRequest gtr;
+			gtr.tileMatrix = stoi(tileMatrix);
+			gtr.tileRow = stoi(tileRow);
+			gtr.tileCol = stoi(tileCol);
+			gtr.dataType = DT_Unknown;
+
+			return HandleGetTileMetadataRequest(request, layers, gtr);
+		}
+		if (requestType == "InvalidateTiles")
+		{
+			// an administrative request after the source data of a region has changed, all levels are invalidated by default
+			const auto layers = request.GetArgumentValue("layers");
+			const auto bbox = request.GetArgumentValue("bbox");
+			const auto minTileMatrix = request.GetArgumentValue("mintilematrix");
+			const auto maxTileMatrix = request.GetArgumentValue("maxtilematrix");
+			const auto token = request.GetArgumentValue("token");
+			if (!layers.size() || !bbox.size())
+			{
+				return HandleServiceException(request, "MissingParameterValue");
+			}
+
+			InvalidateTilesRequest itr;
+			if (!ParseBBox(bbox, itr.bbox))
+			{
+				return HandleServiceException(request, "InvalidBBOX");
+			}
+			itr.minTileMatrix = minTileMatrix.size() ? stoi(minTileMatrix) : 0;
+			itr.maxTileMatrix = maxTileMatrix.size() ? stoi(maxTileMatrix) : INT_MAX;
+			itr.token = token;
+
+			return HandleInvalidateTilesRequest(request, layers, itr);
+		}
 		if (requestType != "GetTile")
 		{
 			return HandleServiceException(request, "unsupported request type");
@@ -170,6 +327,7 @@ namespace dw
 			return HandleServiceException(request, "InvalidFormat");
 		}
 
+		gtr.tileMatrix = stoi(tileMatrix);
 		gtr.tileRow = stoi(tileRow);
 		gtr.tileCol = stoi(tileCol);
 
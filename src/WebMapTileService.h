@@ -7,19 +7,35 @@
 #include <vector>
 #include <map>
 
+#pragma warning(push)
+#pragma warning(disable : 4275)
+#include <libconfig_chained.h>
+#pragma warning(pop)
+
 namespace dw
 {
+	class WebMapService;
+
 	class WebMapTileService
 	{
 	public:
 		struct GetTileRequest
 		{
+			int tileMatrix; // level of detail, 0 is the coarsest
 			int tileCol;
 			int tileRow;
 
 			DataType dataType;
 		};
 
+		struct InvalidateTilesRequest
+		{
+			BBox bbox; // EPSG:4326
+			int minTileMatrix;
+			int maxTileMatrix;
+			string token; // authorizes the request, compared to the token configured for the layer
+		};
+
 		class Layer
 		{
 		public:
@@ -30,11 +46,16 @@ namespace dw
 				HGTRR_InvalidStyle,
 				HGTRR_InvalidFormat,
 				HGTRR_InternalError, // e.g. file corrupt/missing
+				HGTRR_TileOutOfRange,
+				HGTRR_NotSupported,
+				HGTRR_NotYetBuilt, // the tile is built later, e.g. by a background build
+				HGTRR_AccessDenied,
 			};
 
 			virtual ~Layer() {};
 
-			virtual bool Init(/* layerconfig */) { return true; };  // return true on successful init
+			// return true on successful init, localWMS provides the WMS layers of this process (NULL if the WMS is not running)
+			virtual bool Init(libconfig::ChainedSetting& config, WebMapService* localWMS) { return true; };
  			virtual const char* GetIdentifier() const = 0;			// computer readable name (unique identification)
 			virtual const char_t* GetTitle() const = 0;				// human readable name
 			virtual const char_t* GetAbstract()  const { return NULL; };
@@ -43,6 +64,14 @@ namespace dw
 			virtual const std::vector<DataType>& GetSuppordetFormats() const = 0;
 
 			virtual HandleGetTileRequestResult HandleGetTileRequest(const WebMapTileService::GetTileRequest& gtr, class Image& img) = 0;
+
+			// Describes the tile as a JSON object (e.g. its elevation range) without rendering it, gtr.dataType is not set.
+			virtual HandleGetTileRequestResult HandleGetTileMetadataRequest(const WebMapTileService::GetTileRequest& gtr, string& metadataOut) { return HGTRR_NotSupported; }
+
+			// Builds the cached tiles of the given levels which intersect the bbox again, e.g. after the source data of the region
+			// has changed. The outdated tiles are served until they have been replaced, resultOut is a JSON object. A layer rejects
+			// the request unless its token matches the one configured for the layer.
+			virtual HandleGetTileRequestResult HandleInvalidateTilesRequest(const WebMapTileService::InvalidateTilesRequest& itr, string& resultOut) { return HGTRR_NotSupported; }
 		};
 
 		typedef Layer* (*CreateLayer)();
@@ -59,7 +88,8 @@ namespace dw
 				GetStaticLayers().push_back(lDesc);
 			}
 
-			static void CreateLayers(std::map<string, Layer*>& layers /*, config*/);
+			// config lists the layer instances, several instances may be of the same type (e.g. caches of different WMS layers)
+			static void CreateLayers(std::map<string, Layer*>& layers, libconfig::ChainedSetting& config, WebMapService* localWMS);
 
 		private:
 
@@ -83,12 +113,14 @@ namespace dw
 
 		WebMapTileService();
 
-		int Start();
+		int Start(libconfig::ChainedSetting& config, WebMapService* localWMS);
 		void Stop();
 
 		void HandleRequest(IHTTPRequest& request);
 	private:
 		void HandleGetTileRequest(IHTTPRequest& request, const string& layers, ContentType contentType, struct GetTileRequest& gtr);
+		void HandleGetTileMetadataRequest(IHTTPRequest& request, const string& layers, const struct GetTileRequest& gtr);
+		void HandleInvalidateTilesRequest(IHTTPRequest& request, const string& layers, const struct InvalidateTilesRequest& itr);
 
 		std::map<string, Layer*> availableLayers;
 	};
@@ -159,12 +159,16 @@ namespace dw
 			}
 		}
 
-		wmts = new WebMapTileService();
-		const auto wmtsStartResult = wmts->Start();
-		if (wmtsStartResult)
+		auto wmtsConfig = config["wmts"];
+		if (wmtsConfig.exists())
 		{
-			delete wmts;
-			wmts = NULL;
+			wmts = new WebMapTileService();
+			const auto wmtsStartResult = wmts->Start(wmtsConfig, wms); // the WMS is started first, tile caches may render its layers directly
+			if (wmtsStartResult)
+			{
+				delete wmts;
+				wmts = NULL;
+			}
 		}
 
 		cout << "Starting HTTP Server listening to port " << port << endl;
@@ -193,19 +197,27 @@ namespace dw
 
 	void WebServer::Stop()
 	{
-		if (wms)
-		{
-			wms->Stop();
-			delete wms;
-			wms = NULL;
-		}
-
 		if (listener)
 		{
 			listener->close().wait();
 			delete listener;
 			listener = NULL;
 		}
+
+		// the tile caches may render layers of the WMS until they are stopped
+		if (wmts)
+		{
+			wmts->Stop();
+			delete wmts;
+			wmts = NULL;
+		}
+
+		if (wms)
+		{
+			wms->Stop();
+			delete wms;
+			wms = NULL;
+		}
 	}
 
 	WebServer::~WebServer()
@@ -2,8 +2,18 @@
 #include "dwcore.h"
 
 #include <cpplinq.hpp>
+#include <algorithm>
 #include <map>
 
+#if DW_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+#endif
+
 using namespace std;
 using namespace cpplinq;
 
@@ -52,6 +62,156 @@ namespace dw
 	}
 
 
+	static bool DetectAVX2()
+	{
+#if DW_X86
+		u32 eax, ebx, ecx, edx;
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		const u32 maxLeaf = (u32)info[0];
+		__cpuid(info, 1);
+		ecx = (u32)info[2];
+#else
+		if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx)) return false;
+		const u32 maxLeaf = eax;
+		__get_cpuid(1, &eax, &ebx, &ecx, &edx);
+#endif
+		const u32 OSXSAVE = 1 << 27;
+		const u32 AVX = 1 << 28;
+		if (maxLeaf < 7 || (ecx & (OSXSAVE | AVX)) != (OSXSAVE | AVX))
+		{
+			return false;
+		}
+
+		// the operating system has to save the ymm registers on context switches
+#ifdef _MSC_VER
+		const u64 xcr0 = _xgetbv(0);
+#else
+		__asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		const u64 xcr0 = ((u64)edx << 32) | eax;
+#endif
+		if ((xcr0 & 6) != 6)
+		{
+			return false;
+		}
+
+#ifdef _MSC_VER
+		__cpuidex(info, 7, 0);
+		ebx = (u32)info[1];
+#else
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+#endif
+		const u32 AVX2 = 1 << 5;
+		return (ebx & AVX2) != 0;
+#else
+		return false;
+#endif
+	}
+
+	bool IsAVX2Supported()
+	{
+		static const bool isSupported = DetectAVX2();
+		return isSupported;
+	}
+
+	// filling more than the last level cache with regular stores only evicts everything else
+	static const size NonTemporalFillThreshold = 8 << 20;
+
+	// number of bytes in front of the first aligned vector, which are a multiple of the value size as dest is aligned to it
+	static inline size GetUnalignedHeadSize(const u8* dest, size numBytes, size alignment)
+	{
+		return min(numBytes, (alignment - ((uintptr_t)dest & (alignment - 1))) & (alignment - 1));
+	}
+
+#if DW_X86
+	DW_TARGET_AVX2 static void FillMemoryWithPatternAVX2(u8* dest, size numBytes, const u8* pattern)
+	{
+		const size headSize = GetUnalignedHeadSize(dest, numBytes, 32);
+		for (size i = 0; i < headSize; i++)
+		{
+			dest[i] = pattern[i];
+		}
+		dest += headSize;
+		numBytes -= headSize;
+
+		// the pattern repeats the value, thus it starts over at every aligned vector
+		const __m256i value = _mm256_loadu_si256((const __m256i*)pattern);
+		size i = 0;
+		if (numBytes >= NonTemporalFillThreshold)
+		{
+			for (; i + 128 <= numBytes; i += 128)
+			{
+				_mm256_stream_si256((__m256i*)&dest[i], value);
+				_mm256_stream_si256((__m256i*)&dest[i + 32], value);
+				_mm256_stream_si256((__m256i*)&dest[i + 64], value);
+				_mm256_stream_si256((__m256i*)&dest[i + 96], value);
+			}
+			_mm_sfence();
+		}
+		for (; i + 32 <= numBytes; i += 32)
+		{
+			_mm256_store_si256((__m256i*)&dest[i], value);
+		}
+		for (; i < numBytes; i++)
+		{
+			dest[i] = pattern[i & 31];
+		}
+	}
+
+	static void FillMemoryWithPatternSSE2(u8* dest, size numBytes, const u8* pattern)
+	{
+		const size headSize = GetUnalignedHeadSize(dest, numBytes, 16);
+		for (size i = 0; i < headSize; i++)
+		{
+			dest[i] = pattern[i];
+		}
+		dest += headSize;
+		numBytes -= headSize;
+
+		const __m128i value = _mm_loadu_si128((const __m128i*)pattern);
+		size i = 0;
+		if (numBytes >= NonTemporalFillThreshold)
+		{
+			for (; i + 64 <= numBytes; i += 64)
+			{
+				_mm_stream_si128((__m128i*)&dest[i], value);
+				_mm_stream_si128((__m128i*)&dest[i + 16], value);
+				_mm_stream_si128((__m128i*)&dest[i + 32], value);
+				_mm_stream_si128((__m128i*)&dest[i + 48], value);
+			}
+			_mm_sfence();
+		}
+		for (; i + 16 <= numBytes; i += 16)
+		{
+			_mm_store_si128((__m128i*)&dest[i], value);
+		}
+		for (; i < numBytes; i++)
+		{
+			dest[i] = pattern[i & 15];
+		}
+	}
+#endif
+
+	void FillMemoryWithPattern(void* dest, size numBytes, const u8* pattern)
+	{
+#if DW_X86
+		if (IsAVX2Supported())
+		{
+			return FillMemoryWithPatternAVX2((u8*)dest, numBytes, pattern);
+		}
+		return FillMemoryWithPatternSSE2((u8*)dest, numBytes, pattern);
+#else
+		u8* bytes = (u8*)dest;
+		size i = 0;
+		for (; i + 32 <= numBytes; i += 32)
+		{
+			memcpy(&bytes[i], pattern, 32);
+		}
+		memcpy(&bytes[i], pattern, numBytes - i);
+#endif
+	}
+
 	void SetTypedMemory(void* dest, const Variant& value, size count)
 	{
 		assert(value.IsSet());
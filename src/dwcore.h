@@ -1,5 +1,6 @@
 #pragma once
 #include <stdint.h>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <cstdlib>
@@ -167,16 +168,35 @@ namespace dw
 	ContentType GetContentType(const string& contentTypeId);
 	DataType FindCompatibleDataType(ContentType contentType, const std::vector<DataType>& availableDataTypes);
 
+	// Kernels using AVX2 are compiled for AVX2 individually and must only be called if IsAVX2Supported().
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define DW_X86 1
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define DW_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define DW_TARGET_AVX2
+#endif
+
+	bool IsAVX2Supported(); // by the cpu and the operating system, detected once
+
+	// Fills numBytes at dest with a 32 byte pattern, which repeats a value of 1, 2, 4 or 8 bytes. dest has to be aligned to the size of the value.
+	// Uses AVX2 or SSE2 stores, fills larger than the caches bypass them with non-temporal stores.
+	void FillMemoryWithPattern(void* dest, size numBytes, const u8* pattern);
+
 	template<typename T>
 	void SetTypedMemory(T* dest, T value, size count)
-    {
-    	const T* end = dest + count;
-    	while(dest < end)
-    	{
-    		*dest = value;
-    		dest++;
-    	}
-    }
+	{
+		static_assert(32 % sizeof(T) == 0, "the value has to repeat within the 32 byte pattern");
+
+		u8 pattern[32];
+		for (size i = 0; i < sizeof(pattern); i += sizeof(T))
+		{
+			memcpy(&pattern[i], &value, sizeof(T));
+		}
+		FillMemoryWithPattern(dest, count * sizeof(T), pattern);
+	}
 
 	void SetTypedMemory(void* dest, const Variant& value, size count);
 }
@@ -23,6 +23,9 @@
 #include "../utils/ImageProcessor.h"
 #include "../utils/Filesystem.h"
 #include "../utils/Elevation.h"
+#include "../utils/DecodedTileCache.h"
+#include "../utils/TilePrefetcher.h"
+#include "../utils/ElevationTileStore.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -57,6 +60,7 @@ namespace Layers
 
 		struct ASTERTileContent
 		{
+			shared_ptr<Image> image; // owns elevation if it was allocated by LoadASTERTileContent
 			s16* elevation;
 			//s16* quality;
 
@@ -67,10 +71,32 @@ namespace Layers
 			double geoTransform[6];
 		};
 
+		struct SRTMTile
+		{
+			int column; // CGIAR tile numbers start at 1, i.e. srtm_01_01 is column 0 and row 0
+			int row;
+			string filename_dem;
+		};
+
+		struct PixelWindow
+		{
+			int left;
+			int top;
+			int right;	// exclusive
+			int bottom;	// exclusive
+
+			int GetWidth() const { return right - left; }
+			int GetHeight() const { return bottom - top; }
+			bool IsEmpty() const { return left >= right || top >= bottom; }
+		};
+
 		OGRSpatialReference* ASTER_SpatRef;
 		OGRSpatialReference* SRTM_SpatRef;
 		
 		ASTERTile* asterTiles;
+		unique_ptr<DecodedTileCache> asterTileCache;
+		unique_ptr<TilePrefetcher> asterTilePrefetcher;
+		unique_ptr<ElevationTileStore> tileStore; // optional native storage replacing GDAL on the hot path
 		int asterTileStartLatitude;
 		int asterTileEndLatitude;
 		const int AsterTileStartLongitude = -180;
@@ -80,6 +106,19 @@ namespace Layers
 		const int AsterPixelsPerDegree = 3600;
 		const double AsterDegreesPerPixel = 1.0 / (double)AsterPixelsPerDegree;
 
+		// CGIAR SRTMv4 tiles cover 5x5 degrees from -180;60 up to 180;-60, the first pixel of a tile is centered on its west
+		// and north border and its last one lies a pixel short of the east and south border, thus neighboring tiles share no pixels
+		vector<SRTMTile> srtmTiles; // empty if gap filling is disabled
+		const int SRTMTileStartLongitude = -180;
+		const int SRTMTileStartLatitude = 60; // north border of the first row
+		const int NumSRTMTilesX = 72;
+		const int NumSRTMTilesY = 24;
+		const int SRTMDegreesPerTile = 5;
+		const int SRTMPixelsPerDegree = 1200;
+		const int SRTMTileSize = SRTMDegreesPerTile * SRTMPixelsPerDegree;
+		const s16 InvalidValueSRTM = -32768;
+		const DecodedTileCache::Key SRTMTileKeyNamespace = 1ull << 32; // SRTM tiles share the decoded tile cache with ASTER tiles
+
 	public:
 
 		virtual bool Init(libconfig::ChainedSetting& config) override
@@ -95,6 +134,9 @@ namespace Layers
 				return false;
 			}
 
+			const int decodedTileCacheSizeInMB = config["DecodedTileCacheSize"].min(0).defaultValue(1024);
+			asterTileCache.reset(new DecodedTileCache((size)decodedTileCacheSizeInMB * 1024 * 1024));
+
 			// load antarctic data
 			{
 				/*const path antarcticDataPath("E:/NSIDC-0082/ramp200dem_wgs_v2.bin");
@@ -137,38 +179,96 @@ namespace Layers
 			memset(fileExists.get(), 0, NumASTERTilesX * 180);
 			asterTileStartLatitude = 90;
 			asterTileEndLatitude = -90;
-			for (directory_iterator di(ASTERSourceDir); di != end(di); di++)
+			auto markTileAsExisting = [&](int longitude, int latitude)
+			{
+				fileExists.get()[(latitude + 90) * NumASTERTilesX + longitude + 180] = true;
+
+				asterTileStartLatitude = min(asterTileStartLatitude, latitude);
+				asterTileEndLatitude = max(asterTileEndLatitude, latitude);
+			};
+
+			const string tileStorePath = config["TileStorePath"].defaultValue("");
+			if (!tileStorePath.empty())
 			{
-				const auto& entity = *di;
-				const auto extension = entity.path().extension();
-				if (is_regular_file(entity.status()) && extension.generic_string() == ".zip")
+				// tiles converted by druckwelle_convert_aster are read from a memory mapped file instead of zipped GeoTIFFs
+				tileStore.reset(new ElevationTileStore());
+				if (!tileStore->Open(tileStorePath))
 				{
-					string filepath = entity.path().string();
-					int latitudeSign = 1;
-					int longitudeSign = 1;
+					cout << "Quality Elevation Layer: " << "unable to open ASTER tile store: " << tileStorePath << endl;
+					return false;
+				}
 
-					size_t coordinateStart = filepath.find_last_of('_');
-					size_t latOffset = filepath.find_last_of('N');
-					if (latOffset == std::string::npos || latOffset < coordinateStart)
+				for (int latitude = -90; latitude < 90; latitude++)
+				{
+					for (int longitude = AsterTileStartLongitude; longitude <= AsterTileEndLongitude; longitude++)
 					{
-						latOffset = filepath.find_last_of('S');
-						latitudeSign = -1;
+						if (tileStore->HasTile(longitude, latitude))
+						{
+							markTileAsExisting(longitude, latitude);
+						}
 					}
-					size_t lonOffset = filepath.find_last_of('E');
-					if (lonOffset == std::string::npos || lonOffset < coordinateStart)
+				}
+			}
+			else
+			{
+				for (directory_iterator di(ASTERSourceDir); di != end(di); di++)
+				{
+					const auto& entity = *di;
+					const auto extension = entity.path().extension();
+					if (is_regular_file(entity.status()) && extension.generic_string() == ".zip")
 					{
-						lonOffset = filepath.find_last_of('W');
-						longitudeSign = -1;
+						string filepath = entity.path().string();
+						int latitudeSign = 1;
+						int longitudeSign = 1;
+
+						size_t coordinateStart = filepath.find_last_of('_');
+						size_t latOffset = filepath.find_last_of('N');
+						if (latOffset == std::string::npos || latOffset < coordinateStart)
+						{
+							latOffset = filepath.find_last_of('S');
+							latitudeSign = -1;
+						}
+						size_t lonOffset = filepath.find_last_of('E');
+						if (lonOffset == std::string::npos || lonOffset < coordinateStart)
+						{
+							lonOffset = filepath.find_last_of('W');
+							longitudeSign = -1;
+						}
+						if (latOffset != std::string::npos)
+						{
+							int latitude = atoi(filepath.c_str() + latOffset + 1) * latitudeSign;
+							int longitude = atoi(filepath.c_str() + lonOffset + 1) * longitudeSign;
+
+							markTileAsExisting(longitude, latitude);
+						}
 					}
-					if (latOffset != std::string::npos)
-					{
-						int latitude = atoi(filepath.c_str() + latOffset + 1) * latitudeSign;
-						int longitude = atoi(filepath.c_str() + lonOffset + 1) * longitudeSign;
+				}
+			}
 
-						fileExists.get()[(latitude + 90) * NumASTERTilesX + longitude + 180] = true;
+			const string SRTMSourceDir = config["SRTMPath"].defaultValue("");
+			if (!SRTMSourceDir.empty())
+			{
+				srtmTiles.resize(NumSRTMTilesX * NumSRTMTilesY);
+				for (int t = 0; t < (int)srtmTiles.size(); t++)
+				{
+					srtmTiles[t].column = t % NumSRTMTilesX;
+					srtmTiles[t].row = t / NumSRTMTilesX;
+				}
 
-						asterTileStartLatitude = min(asterTileStartLatitude, latitude);
-						asterTileEndLatitude = max(asterTileEndLatitude, latitude);
+				for (directory_iterator di((path(SRTMSourceDir))); di != end(di); di++)
+				{
+					const auto& entity = *di;
+					const auto extension = entity.path().extension();
+					if (is_regular_file(entity.status()) && extension.generic_string() == ".zip")
+					{
+						const string name = entity.path().stem().string(); // e.g. srtm_38_03
+						int column, row;
+						if (sscanf(name.c_str(), "srtm_%d_%d", &column, &row) != 2 || column < 1 || column > NumSRTMTilesX || row < 1 || row > NumSRTMTilesY)
+						{
+							continue;
+						}
+
+						srtmTiles[(row - 1) * NumSRTMTilesX + column - 1].filename_dem = "/vsizip/" + entity.path().string() + "/" + name + ".tif";
 					}
 				}
 			}
@@ -178,7 +278,7 @@ namespace Layers
 
 			if (NumASTERTilesY == 0)
 			{
-				cout << "Quality Elevation Layer: " << "ASTER data not found in " << ASTERSourceDir << endl;
+				cout << "Quality Elevation Layer: " << "ASTER data not found in " << (tileStore ? tileStorePath : ASTERSourceDir.string()) << endl;
 				return false;
 			}
 
@@ -216,6 +316,26 @@ namespace Layers
 				}
 			}
 
+			const int prefetchBudgetInMB = config["PrefetchBudget"].min(0).defaultValue(256);
+			if (asterTileCache->IsEnabled() && prefetchBudgetInMB > 0)
+			{
+				const u32 MaxQueuedTiles = 32;
+				asterTilePrefetcher.reset(new TilePrefetcher(*asterTileCache, [this](const BBox& bbox, vector<TilePrefetcher::Tile>& tilesOut)
+				{
+					vector<ASTERTile*> asterTilesTouched;
+					int startX, startY, numTilesX, numTilesY;
+					GetASTERTiles(asterTilesTouched, bbox, startX, startY, numTilesX, numTilesY);
+
+					for (auto tile : asterTilesTouched)
+					{
+						TilePrefetcher::Tile prefetchTile;
+						prefetchTile.key = GetASTERTileKey(tile);
+						prefetchTile.load = [this, tile](shared_ptr<Image>& tileOut) { return LoadASTERTile(tile, tileOut); };
+						tilesOut.push_back(prefetchTile);
+					}
+				}, (size)prefetchBudgetInMB * 1024 * 1024, MaxQueuedTiles));
+			}
+
 			return true;
 		}
 
@@ -282,6 +402,8 @@ namespace Layers
 
 		virtual ~QualityElevation() override
 		{
+			asterTilePrefetcher.reset(); // the prefetcher thread accesses asterTiles
+
 			delete[] asterTiles;
 
 			for (auto crs : supportedCRS)
@@ -297,17 +419,268 @@ namespace Layers
 
 		void UnloadASTERTileContent(ASTERTileContent& content)
 		{
-			delete[] content.elevation;
+			content.image.reset();
+			content.elevation = NULL;
 			//delete[] content.quality;
 		}
 
-		bool LoadASTERTileContent(const ASTERTile* tile, ASTERTileContent& content, const int* firstLineIncl = NULL, const int* lastLineExcl = NULL)
+		static DecodedTileCache::Key GetASTERTileKey(const ASTERTile* tile)
+		{
+			return (DecodedTileCache::Key)((tile->latitude + 90) * 360 + (tile->longitude + 180));
+		}
+
+		bool LoadASTERTile(const ASTERTile* tile, shared_ptr<Image>& tileOut)
+		{
+			if (tileStore)
+			{
+				return tileStore->LoadTile(tile->longitude, tile->latitude, tileOut);
+			}
+
+			ASTERTileContent content;
+			content.elevation = NULL;
+
+			if (!LoadASTERTileContent(tile, content))
+			{
+				return false;
+			}
+
+			tileOut = content.image;
+			return true;
+		}
+
+		bool LoadSRTMTile(const SRTMTile* tile, shared_ptr<Image>& tileOut)
 		{
+			GDALDataset* demDS = NULL;
+			GDALRasterBand* demRasterBand = NULL;
+			double geoTransform[6];
+			double expectedOriginX, expectedOriginY;
+			shared_ptr<Image> srtmTile;
+
+			demDS = (GDALDataset*)GDALOpen(tile->filename_dem.c_str(), GA_ReadOnly);
+			if (!demDS) goto err;
+
+			// the fill stage addresses pixels by the regular CGIAR grid, thus tiles which do not follow it are rejected
+			if (demDS->GetGeoTransform(geoTransform) != CE_None) goto err;
+			expectedOriginX = SRTMTileStartLongitude + tile->column * SRTMDegreesPerTile - 0.5 / SRTMPixelsPerDegree;
+			expectedOriginY = SRTMTileStartLatitude - tile->row * SRTMDegreesPerTile + 0.5 / SRTMPixelsPerDegree;
+			if (fabs(geoTransform[0] - expectedOriginX) > 0.1 / SRTMPixelsPerDegree || fabs(geoTransform[3] - expectedOriginY) > 0.1 / SRTMPixelsPerDegree ||
+				fabs(geoTransform[1] * SRTMPixelsPerDegree - 1.0) > 0.001 || fabs(geoTransform[5] * SRTMPixelsPerDegree + 1.0) > 0.001) goto err;
+
+			demRasterBand = demDS->GetRasterBand(1);
+			if (!demRasterBand || demRasterBand->GetRasterDataType() != GDT_Int16) goto err;
+			if (demRasterBand->GetXSize() != SRTMTileSize || demRasterBand->GetYSize() != SRTMTileSize) goto err;
+
+			srtmTile.reset(new Image(SRTMTileSize, SRTMTileSize, DT_S16));
+			if (demRasterBand->RasterIO(GF_Read, 0, 0, SRTMTileSize, SRTMTileSize, srtmTile->rawData, SRTMTileSize, SRTMTileSize, GDT_Int16, 0, 0) != CE_None) goto err;
+
+			GDALClose(demDS);
+
+			tileOut = srtmTile;
+			return true;
+		err:
+			if (demDS) GDALClose(demDS);
+			return false;
+		}
+
+		// Replaces invalid values of the ASTER mosaic by bilinearly sampled SRTMv4 data. Rows are scanned with SIMD first,
+		// so only SRTM tiles which overlap the bounding box of the voids get loaded. originX/Y are the coordinates of the
+		// center of the first mosaic pixel.
+		void FillInvalidValuesWithSRTM(Image& elevation, double originX, double originY)
+		{
+			if (srtmTiles.empty())
+			{
+				return;
+			}
+
+			s16* mosaic = (s16*)elevation.rawData;
+
+			vector<int> firstInvalid(elevation.height);
+			vector<int> lastInvalid(elevation.height);
+			int voidLeft = elevation.width;
+			int voidRight = -1;
+			int voidTop = elevation.height;
+			int voidBottom = -1;
+			for (int y = 0; y < elevation.height; y++)
+			{
+				const s16* row = &mosaic[y * elevation.width];
+				firstInvalid[y] = (int)FindFirstValue(row, elevation.width, InvalidValueASTER);
+				if (firstInvalid[y] == elevation.width)
+				{
+					continue;
+				}
+				lastInvalid[y] = (int)FindLastValue(row, elevation.width, InvalidValueASTER);
+
+				voidLeft = min(voidLeft, firstInvalid[y]);
+				voidRight = max(voidRight, lastInvalid[y]);
+				voidTop = min(voidTop, y);
+				voidBottom = max(voidBottom, y);
+			}
+
+			if (voidRight < 0)
+			{
+				return; // no voids at all, which is the common case
+			}
+
+			// SRTM tiles overlapping the voids including the neighbors which are sampled across their seams, beyond the date
+			// border the outermost column is used
+			const double voidMinX = originX + voidLeft * AsterDegreesPerPixel;
+			const double voidMaxX = originX + voidRight * AsterDegreesPerPixel;
+			const double voidMaxY = originY - voidTop * AsterDegreesPerPixel;
+			const double voidMinY = originY - voidBottom * AsterDegreesPerPixel;
+
+			if (voidMinY > SRTMTileStartLatitude || voidMaxY < SRTMTileStartLatitude - NumSRTMTilesY * SRTMDegreesPerTile)
+			{
+				return; // voids lay outside of SRTM coverage
+			}
+
+			const int startColumn = Clamp((int)floor(GetSRTMPixelX(voidMinX) / SRTMTileSize), 0, NumSRTMTilesX - 1);
+			const int endColumn = Clamp((int)floor((GetSRTMPixelX(voidMaxX) + 1.0) / SRTMTileSize), 0, NumSRTMTilesX - 1);
+			const int startRow = Clamp((int)floor(GetSRTMPixelY(voidMaxY) / SRTMTileSize), 0, NumSRTMTilesY - 1);
+			const int endRow = Clamp((int)floor((GetSRTMPixelY(voidMinY) + 1.0) / SRTMTileSize), 0, NumSRTMTilesY - 1);
+			const int numColumns = endColumn - startColumn + 1;
+			const int numRows = endRow - startRow + 1;
+
+			vector<DecodedTileCache::Tile> loadedTiles(numColumns * numRows);
+			vector<const Image*> gridTiles(numColumns * numRows, NULL);
+			bool anyTileLoaded = false;
+			for (int row = startRow; row <= endRow; row++)
+			{
+				for (int column = startColumn; column <= endColumn; column++)
+				{
+					const SRTMTile* tile = &srtmTiles[row * NumSRTMTilesX + column];
+					if (tile->filename_dem.empty())
+					{
+						continue;
+					}
+
+					auto& loadedTile = loadedTiles[(row - startRow) * numColumns + (column - startColumn)];
+					loadedTile = asterTileCache->Acquire(SRTMTileKeyNamespace | (row * NumSRTMTilesX + column), [this, tile](shared_ptr<Image>& tileOut)
+					{
+						return LoadSRTMTile(tile, tileOut);
+					});
+
+					if (!loadedTile)
+					{
+						cout << "Quality Elevation Layer: " << "unable to load SRTM tile: " << tile->filename_dem << endl;
+						continue;
+					}
+					gridTiles[(row - startRow) * numColumns + (column - startColumn)] = loadedTile.get();
+					anyTileLoaded = true;
+				}
+			}
+
+			if (!anyTileLoaded)
+			{
+				return;
+			}
+
+			// voids of SRTM (and missing tiles) stay voids, otherwise the nearest valid sample is used at their borders
+			TileGrid grid;
+			grid.tiles = gridTiles.data();
+			grid.numTilesX = numColumns;
+			grid.numTilesY = numRows;
+			grid.tileSize = SRTMTileSize;
+			grid.originX = SRTMTileStartLongitude + startColumn * SRTMDegreesPerTile;
+			grid.originY = SRTMTileStartLatitude - startRow * SRTMDegreesPerTile;
+			grid.pixelsPerDegree = SRTMPixelsPerDegree;
+
+			#pragma omp parallel for
+			for (int y = voidTop; y <= voidBottom; y++)
+			{
+				if (firstInvalid[y] == elevation.width)
+				{
+					continue;
+				}
+
+				s16* row = &mosaic[y * elevation.width];
+				const double latitude = originY - y * AsterDegreesPerPixel;
+
+				for (int x = firstInvalid[y]; x <= lastInvalid[y]; x++)
+				{
+					if (row[x] != InvalidValueASTER)
+					{
+						continue;
+					}
+
+					s16 srtmElevation;
+					if (SampleTileGridAt(grid, originX + x * AsterDegreesPerPixel, latitude, InvalidValueSRTM, srtmElevation))
+					{
+						row[x] = srtmElevation;
+					}
+				}
+			}
+		}
+
+		// position in pixels of all SRTM tiles, 0 is the center of the first pixel of the first tile which lies on -180;60
+		double GetSRTMPixelX(double longitude) const
+		{
+			return (longitude - SRTMTileStartLongitude) * SRTMPixelsPerDegree;
+		}
+
+		double GetSRTMPixelY(double latitude) const
+		{
+			return (SRTMTileStartLatitude - latitude) * SRTMPixelsPerDegree;
+		}
+
+		bool LoadASTERTileContentFromStore(const ASTERTile* tile, ASTERTileContent& content, const PixelWindow* window)
+		{
+			int tileWidth, tileHeight;
+			if (!tileStore->GetTileSize(tile->longitude, tile->latitude, tileWidth, tileHeight))
+			{
+				return false;
+			}
+
+			PixelWindow pixelWindow;
+			pixelWindow.left = window ? Max(window->left, 0) : 0;
+			pixelWindow.top = window ? Max(window->top, 0) : 0;
+			pixelWindow.right = window ? Min(window->right, tileWidth) : tileWidth;
+			pixelWindow.bottom = window ? Min(window->bottom, tileHeight) : tileHeight;
+			if (pixelWindow.IsEmpty()) return false;
+
+			// compressed tiles decode only the part of the tile the window needs
+			shared_ptr<Image> storedWindow;
+			if (!tileStore->LoadTileWindow(tile->longitude, tile->latitude, pixelWindow.left, pixelWindow.top, pixelWindow.GetWidth(), pixelWindow.GetHeight(), storedWindow))
+			{
+				return false;
+			}
+
+			content.width = pixelWindow.GetWidth();
+			content.height = pixelWindow.GetHeight();
+
+			if (!content.elevation)
+			{
+				content.image = storedWindow;
+				content.pitchInPixels = content.width;
+				content.elevation = (s16*)content.image->rawData;
+				return true;
+			}
+
+			assert(content.pitchInPixels > 0);
+
+			const s16* storedElevation = (const s16*)storedWindow->rawData;
+			for (int y = 0; y < content.height; y++)
+			{
+				memcpy(&content.elevation[y * content.pitchInPixels], &storedElevation[y * content.width], content.width * sizeof(s16));
+			}
+
+			return true;
+		}
+
+		// reads only the rows and columns of the given window (tile pixel coordinates) if window is not NULL
+		bool LoadASTERTileContent(const ASTERTile* tile, ASTERTileContent& content, const PixelWindow* window = NULL)
+		{
+			if (tileStore)
+			{
+				return LoadASTERTileContentFromStore(tile, content, window);
+			}
+
 			GDALDataset* demDS = NULL;
 			//GDALDataset* numDS = NULL;
 			GDALRasterBand* demRasterBand = NULL;
 			int blockSizeX , blockSizeY;
-			int startY, endY;
+			int rasterWidth, rasterHeight;
+			PixelWindow pixelWindow;
+			vector<s16> rowBuffer;
 
 			demDS = (GDALDataset*)GDALOpen(tile->filename_dem.c_str(), GA_ReadOnly);
 			if (!demDS) goto err;
@@ -320,17 +693,17 @@ namespace Layers
 			demRasterBand = demDS->GetRasterBand(1);
 			if (!demRasterBand || demRasterBand->GetRasterDataType() != GDT_Int16) goto err;
 
-			content.width = demRasterBand->GetXSize();
-			content.height = demRasterBand->GetYSize();
+			rasterWidth = demRasterBand->GetXSize();
+			rasterHeight = demRasterBand->GetYSize();
 
-			if (firstLineIncl)
-			{
-				content.height -= *firstLineIncl;
-			}
-			if (lastLineExcl)
-			{
-				content.height -= demRasterBand->GetYSize() - *lastLineExcl;
-			}
+			pixelWindow.left = window ? Max(window->left, 0) : 0;
+			pixelWindow.top = window ? Max(window->top, 0) : 0;
+			pixelWindow.right = window ? Min(window->right, rasterWidth) : rasterWidth;
+			pixelWindow.bottom = window ? Min(window->bottom, rasterHeight) : rasterHeight;
+			if (pixelWindow.IsEmpty()) goto err;
+
+			content.width = pixelWindow.GetWidth();
+			content.height = pixelWindow.GetHeight();
 
 			if (content.elevation)
 			{
@@ -338,24 +711,34 @@ namespace Layers
 			}
 			else
 			{
+				content.image.reset(new Image(content.width, content.height, DT_S16));
 				content.pitchInPixels = content.width;
-				content.elevation = new s16[content.width * content.height];
+				content.elevation = (s16*)content.image->rawData;
 			}
 			//content.quality = new s16[content.width * content.height];
 
 			demRasterBand->GetBlockSize(&blockSizeX, &blockSizeY);
-			if (blockSizeX != content.width && blockSizeY != 1) goto err;
+			if (blockSizeX != rasterWidth || blockSizeY != 1) goto err;
 
-			
-			startY = firstLineIncl ? *firstLineIncl : 0;
-			endY = startY + (lastLineExcl ? *lastLineExcl : content.height);
+			if (content.width != rasterWidth)
+			{
+				rowBuffer.resize(rasterWidth); // a block always spans a whole row, thus partial rows are cropped from here
+			}
 
-			for (int y = startY; y < endY; y++)
+			for (int y = pixelWindow.top; y < pixelWindow.bottom; y++)
 			{
-				if (demRasterBand->ReadBlock(0, y, &content.elevation[(y - startY) * content.pitchInPixels]) != CE_None)
+				s16* elevationRow = &content.elevation[(y - pixelWindow.top) * content.pitchInPixels];
+				s16* blockRow = rowBuffer.empty() ? elevationRow : rowBuffer.data();
+
+				if (demRasterBand->ReadBlock(0, y, blockRow) != CE_None)
 				{
 					goto err;
 				}
+
+				if (blockRow != elevationRow)
+				{
+					memcpy(elevationRow, blockRow + pixelWindow.left, content.width * sizeof(s16));
+				}
 			}
 
 			/*auto numRasterBand = numDS->GetRasterBand(1);
@@ -412,7 +795,22 @@ namespace Layers
 			const int numPixelsX = numAsterTilesX * AsterPixelsPerDegree + 1;
 			const int numPixelsY = numAsterTilesY * AsterPixelsPerDegree + 1;
 
-			Image elevation(numPixelsX, numPixelsY, DT_S16);
+			// only the union of the touched tiles which is covered by the padded bbox gets loaded into the mosaic
+			const double mosaicLeft = asterStartX + AsterTileStartLongitude; // coordinates of the center of the first pixel of all touched tiles
+			const double mosaicTop = asterStartY + asterTileStartLatitude + numAsterTilesY;
+
+			PixelWindow mosaicWindow;
+			mosaicWindow.left = Clamp((int)floor((extendedAsterBBox.minX - mosaicLeft) * AsterPixelsPerDegree), 0, numPixelsX);
+			mosaicWindow.top = Clamp((int)floor((mosaicTop - extendedAsterBBox.maxY) * AsterPixelsPerDegree), 0, numPixelsY);
+			mosaicWindow.right = Clamp((int)ceil((extendedAsterBBox.maxX - mosaicLeft) * AsterPixelsPerDegree) + 1, 0, numPixelsX);
+			mosaicWindow.bottom = Clamp((int)ceil((mosaicTop - extendedAsterBBox.minY) * AsterPixelsPerDegree) + 1, 0, numPixelsY);
+
+			if (mosaicWindow.IsEmpty())
+			{
+				return HGMRR_InvalidBBox;
+			}
+
+			Image elevation(mosaicWindow.GetWidth(), mosaicWindow.GetHeight(), DT_S16);
 			SetTypedMemory((s16*)elevation.rawData, InvalidValueASTER, elevation.width * elevation.height);
 
 			HandleGetMapRequestResult result = HGMRR_OK;
@@ -420,23 +818,61 @@ namespace Layers
 			#pragma omp parallel for
 			for (int t = 0; t < numTiles; t++)
 			{
-				ASTERTileContent asterTileContent;
-				asterTileContent.pitchInPixels = numPixelsX;
-
 				const auto& tile = asterTilesTouched[t];
 
 				int x = (tile->longitude - asterStartX - AsterTileStartLongitude + NumASTERTilesX) % NumASTERTilesX;
 				int y = tile->latitude - asterStartY - asterTileStartLatitude;
 
-				int pixelOffset = ((numAsterTilesY - y - 1) * numPixelsX + x) * AsterPixelsPerDegree * sizeof(s16);
-				asterTileContent.elevation = (s16*)&elevation.rawData[pixelOffset];
+				const int tileLeft = x * AsterPixelsPerDegree;
+				const int tileTop = (numAsterTilesY - y - 1) * AsterPixelsPerDegree;
+
+				PixelWindow tileWindow; // part of the tile which overlaps with the mosaic window in tile pixel coordinates
+				tileWindow.left = Max(mosaicWindow.left - tileLeft, 0);
+				tileWindow.top = Max(mosaicWindow.top - tileTop, 0);
+				tileWindow.right = Min(mosaicWindow.right - tileLeft, AsterPixelsPerDegree + 1);
+				tileWindow.bottom = Min(mosaicWindow.bottom - tileTop, AsterPixelsPerDegree + 1);
 
-				if (!LoadASTERTileContent(tile, asterTileContent))
+				if (tileWindow.IsEmpty())
+				{
+					continue;
+				}
+
+				const int targetX = tileLeft + tileWindow.left - mosaicWindow.left;
+				const int targetY = tileTop + tileWindow.top - mosaicWindow.top;
+
+				if (!asterTileCache->IsEnabled())
+				{
+					ASTERTileContent asterTileContent;
+					asterTileContent.pitchInPixels = elevation.width;
+					asterTileContent.elevation = &((s16*)elevation.rawData)[targetY * elevation.width + targetX];
+
+					if (!LoadASTERTileContent(tile, asterTileContent, &tileWindow))
+					{
+						result = HGMRR_InternalError;
+					}
+					continue;
+				}
+
+				// hot tiles are already decoded, stitching them is a plain copy of rows
+				auto asterTile = asterTileCache->Acquire(GetASTERTileKey(tile), [this, tile](shared_ptr<Image>& tileOut)
+				{
+					return LoadASTERTile(tile, tileOut);
+				});
+
+				if (!asterTile)
 				{
 					result = HGMRR_InternalError;
-					break;
+					continue;
 				}
+
+				elevation.CopyFromSubImage(*asterTile, tileWindow.left, tileWindow.top, tileWindow.GetWidth(), tileWindow.GetHeight(), targetX, targetY);
+			}
+
+			if (asterTilePrefetcher)
+			{
+				asterTilePrefetcher->OnRequest(extendedAsterBBox);
 			}
+
 			if (result != HGMRR_OK)
 			{
 				return result;
@@ -451,20 +887,20 @@ namespace Layers
 			SampleTransform st;
 			st.scaleX = RequestedDegreesPerPixelX * AsterPixelsPerDegree;
 			st.scaleY = RequestedDegreesPerPixelY * AsterPixelsPerDegree;
-			st.offsetX = (asterBBox.minX - loadedBBox.minX) * AsterPixelsPerDegree;
-			st.offsetY = (loadedBBox.maxY - asterBBox.maxY) * AsterPixelsPerDegree;
+			st.offsetX = (asterBBox.minX - loadedBBox.minX) * AsterPixelsPerDegree - mosaicWindow.left;
+			st.offsetY = (loadedBBox.maxY - asterBBox.maxY) * AsterPixelsPerDegree - mosaicWindow.top;
 
-			BBox srtmBBox;
-			if (!TransformBBox(gmr.bbox, srtmBBox, requestSRS, SRTM_SpatRef))
-			{
-				return HGMRR_InvalidBBox; // TODO: according to WMS specs bbox may lay outside of valid areas (e.g. latitudes greater than 90 degrees in CRS:84)
-			}
+			high_resolution_clock::time_point t0 = high_resolution_clock::now();
 
-			// TODO: fill up invalid values within sampling area with SRTMv4 data
-			// SRTMv4 starts at -180;60 up to 180;-60 in 5 steps
-			// if (srtmBBox overlaps with full SRTMBBOX) { fill the gaps... }
+			// SRTM_SpatRef equals ASTER_SpatRef, hence the mosaic's pixel coordinates address SRTM data as well
+			FillInvalidValuesWithSRTM(elevation, mosaicLeft + mosaicWindow.left * AsterDegreesPerPixel, mosaicTop - mosaicWindow.top * AsterDegreesPerPixel);
 
 			high_resolution_clock::time_point t1 = high_resolution_clock::now();
+			if (!srtmTiles.empty())
+			{
+				duration<double> fillTime = duration_cast<duration<double>>(t1 - t0) * 1000.0;
+				std::cout << "SRTM gap filling was processed within " << std::setprecision(5) << fillTime.count() << " ms" << endl;
+			}
 
 			Variant iv(InvalidValueASTER);
 			SampleWithLanczos(elevation, img, st, iv);
@@ -473,6 +909,18 @@ namespace Layers
 			duration<double> time_span = duration_cast<duration<double>>(t2 - t1) * 1000.0;
 			std::cout << "SampleWithLanczos was processed within " << std::setprecision(5) << time_span.count() << " ms" << endl;
 
+			if (asterTileCache->IsEnabled())
+			{
+				const auto cacheStats = asterTileCache->GetStatistics();
+				std::cout << "ASTER tile cache: " << cacheStats.numTiles << " tiles (" << (cacheStats.usedBytes >> 20) << "/" << (cacheStats.budgetInBytes >> 20) << " MB)"
+					<< " hit rate " << std::setprecision(3) << cacheStats.GetHitRate() * 100.0 << "% (" << cacheStats.hits << " hits, " << cacheStats.misses << " misses, " << cacheStats.evictions << " evictions)" << endl;
+				if (asterTilePrefetcher)
+				{
+					std::cout << "ASTER tile prefetcher: " << cacheStats.prefetches << " prefetches (" << cacheStats.usefulPrefetches << " useful, " << cacheStats.wastedPrefetches << " wasted, "
+						<< (cacheStats.prefetchedBytes >> 20) << " MB pending)" << endl;
+				}
+			}
+
 			if(false) // debug output of loaded region of ASTER tiles
 			{
 				elevation.SaveToPNG<s16, u8>("stitchedAster.png", [](s16 e) { return (u8)Clamp<s32>(e / 6, 0, 255); });
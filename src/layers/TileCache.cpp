@@ -1,7 +1,11 @@
 
 #include "../WebMapTileService.h"
+#include "../WebMapService.h"
 #include "../utils/ImageProcessor.h"
 #include "../utils/Elevation.h"
+#include "../utils/BoundedQueue.h"
+#include "../utils/TileStatusIndex.h"
+#include "../utils/TileStorage.h"
 
 #include "../utils/HTTP/HTTP.h"
 #include <istream>
@@ -11,25 +15,179 @@
 
 #include "../utils/Filesystem.h"
 
+#include <mutex>
+#include <atomic>
 #include <thread>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <numeric>
+#include <functional>
+#include <chrono>
+#include <iomanip>
 
 #include <ZFXMath.h>
 
 using namespace std;
+using namespace std::chrono;
 using namespace ZFXMath;
 
 namespace dw
 {
 	namespace Layers
 	{
+		// Renders the source tiles of a cache. Every worker thread uses its own source, the rows of a tile are read band by band.
+		class ITileSource
+		{
+		public:
+			virtual ~ITileSource() {};
+
+			virtual bool RequestTile(const WebMapService::GetMapRequest& gmr) = 0;
+
+			// returns the next numRows rows of the requested tile, valid until the next call, or NULL if they are not available
+			virtual const u8* ReadRows(int numRows) = 0;
+		};
+
+		// a layer of a remote WMS, the rows are received while they are read
+		class HTTPTileSource : public ITileSource
+		{
+		public:
+			HTTPTileSource(IHTTPClient& client, const string& layerName, ContentType contentType)
+				: client(client)
+				, layerName(layerName)
+				, contentType(contentType)
+				, rowSize(0)
+			{
+			}
+
+			virtual bool RequestTile(const WebMapService::GetMapRequest& gmr) override
+			{
+				string tileRequestUri = "/?SERVICE=WMS&VERSION=1.3.0&REQUEST=GetMap&CRS=" + gmr.crs + "&LAYERS=" + layerName + "&STYLES=" + gmr.styles;
+				tileRequestUri += "&WIDTH=" + to_string(gmr.width);
+				tileRequestUri += "&HEIGHT=" + to_string(gmr.height);
+				tileRequestUri += "&FORMAT=" + ContentTypeId[contentType];
+				tileRequestUri += "&BBOX=" + to_string(gmr.bbox.minX) + "," + to_string(gmr.bbox.minY) + "," + to_string(gmr.bbox.maxX) + "," + to_string(gmr.bbox.maxY);
+
+				response = client.Request(tileRequestUri);
+				rowSize = (size)gmr.width * DataTypePixelSize[gmr.dataType];
+
+				if (response->GetStatusCode() != HTTP_OK)
+				{
+					cout << "Tile Cache Error: failed to receive tile! http return code: " << response->GetStatusCode() << endl;
+					return false;
+				}
+				return true;
+			}
+
+			virtual const u8* ReadRows(int numRows) override
+			{
+				const size rowsSize = numRows * rowSize;
+				if (rows.size() < rowsSize)
+				{
+					rows.resize(rowsSize);
+				}
+
+				if (!response || response->ReadBody(rows.data(), rowsSize) < rowsSize)
+				{
+					return NULL;
+				}
+				return rows.data();
+			}
+
+		private:
+			IHTTPClient& client;
+			string layerName;
+			ContentType contentType;
+
+			shared_ptr<IHTTPResponse> response;
+			size rowSize;
+			vector<u8> rows;
+		};
+
+		// a layer of the WMS of this process, the tile is rendered right into memory and its rows are read without copying them
+		class LocalTileSource : public ITileSource
+		{
+		public:
+			LocalTileSource(WebMapService::Layer& layer)
+				: layer(layer)
+				, nextRow(0)
+			{
+			}
+
+			virtual bool RequestTile(const WebMapService::GetMapRequest& gmr) override
+			{
+				if (!tile || tile->width != gmr.width || tile->height != gmr.height || tile->rawDataType != gmr.dataType)
+				{
+					tile.reset(new Image(gmr.width, gmr.height, gmr.dataType));
+				}
+				nextRow = 0;
+
+				WebMapService::Layer::HandleGetMapRequestResult result = layer.HandleGetMapRequest(gmr, *tile.get());
+				if (result != WebMapService::Layer::HGMRR_OK)
+				{
+					cout << "Tile Cache Error: failed to render tile! result: " << result << endl;
+					return false;
+				}
+				return true;
+			}
+
+			virtual const u8* ReadRows(int numRows) override
+			{
+				if (!tile || numRows < 0 || nextRow + numRows > tile->height)
+				{
+					return NULL;
+				}
+
+				const u8* rows = tile->rawData + (size)nextRow * tile->width * tile->rawPixelSize;
+				nextRow += numRows;
+				return rows;
+			}
+
+		private:
+			WebMapService::Layer& layer;
+
+			unique_ptr<Image> tile; // reused for all tiles of a worker
+			int nextRow;
+		};
+
 		class TileCache : public WebMapTileService::Layer
 		{
-			virtual ~TileCache() override {};
+			// the running build is cancelled, the tiles in flight are stored before the build thread returns
+			virtual ~TileCache() override
+			{
+				if (!createTileCacheThread)
+				{
+					return;
+				}
+
+				{
+					lock_guard<mutex> lock(buildMutex);
+					isStopRequested = true;
+					if (runningSchedule)
+					{
+						runningSchedule->Cancel();
+					}
+				}
+				buildRequested.notify_all();
+
+				createTileCacheThread->join();
+				delete createTileCacheThread;
+			};
 
 			thread* createTileCacheThread;
 
 		public:
 
+			TileCache()
+				: createTileCacheThread(NULL)
+				, isBuildRequested(false)
+				, isStopRequested(false)
+				, runningSchedule(NULL)
+			{
+			}
+
 			virtual const char* GetIdentifier() const override
 			{
 				return desc.id.c_str();
@@ -57,28 +215,196 @@ namespace dw
 
 			virtual const vector<DataType>& GetSuppordetFormats() const override
 			{
-				static const vector<DataType> SuppordetFormats = { DT_S16 };
-				return SuppordetFormats;
+				return supportedFormats;
 			}
 
-			virtual bool Init(/* layerconfig */) override
+			virtual bool Init(libconfig::ChainedSetting& config, WebMapService* localWMS) override
 			{
-				ReadConfig();
+				if (!ReadConfig(config)) return false;
 
 				if (!EnumerateFiles()) return false;
+				if (!LoadTilePriorities()) return false;
+
+				// a source layer served by this process is rendered directly, the loopback connection would only copy every pixel twice
+				localSrcLayer = (localWMS && IsLocalHost(desc.srcHost)) ? localWMS->FindLayer(desc.srcLayerName) : NULL;
+				if (localSrcLayer)
+				{
+					if (FindCompatibleDataType(desc.srcContentType, localSrcLayer->GetSuppordetFormats()) != desc.dataType)
+					{
+						cout << "Tile Cache Error: source layer " << desc.srcLayerName << " does not support the cached data type" << endl;
+						return false;
+					}
+					cout << "Tile Cache: rendering tiles of " << desc.srcLayerName << " in process" << endl;
+				}
+				else
+				{
+					srcClient.reset(IHTTPClient::Create("http://" + desc.srcHost + ":" + to_string(desc.srcPort)));
+				}
 
-				createTileCacheThread = new thread([this] { CreateTileCacheAsync(); });
+				numInvalidations = 0;
+
+				// a read-through cache builds its tiles once they are requested, the background build just warms popular regions
+				createTileCacheThread = (desc.prebuild || desc.warmingInterval > 0) ? new thread([this] { CreateTileCacheAsync(); }) : NULL;
 
 				return true;
 			};
 
-			virtual HandleGetTileRequestResult HandleGetTileRequest(const WebMapTileService::GetTileRequest& gmr, Image& img) override
+			virtual HandleGetTileRequestResult HandleGetTileRequest(const WebMapTileService::GetTileRequest& gtr, Image& img) override
+			{
+				const int x = gtr.tileCol;
+				const int y = gtr.tileRow;
+				const int level = gtr.tileMatrix;
+				if (!IsValidTile(x, y, level))
+				{
+					return HGTRR_TileOutOfRange;
+				}
+
+				CountTileRequest(x, y, level);
+
+				if (img.rawDataType != desc.dataType || img.width != (int)desc.tileWidth || img.height != (int)desc.tileHeight)
+				{
+					return HGTRR_InvalidFormat;
+				}
+
+				u8 status = GetFileStatus(x, y, level);
+				if (IsToBeBuiltOnRequest(status) && IsBuildableOnRequest(x, y, level, desc.maxOnRequestDepth))
+				{
+					// the tile is loaded once it has been stored, thus it is served as it is served by every later request
+					if (!BuildTileOnRequest(x, y, level, desc.maxOnRequestDepth))
+					{
+						return HGTRR_InternalError;
+					}
+					status = GetFileStatus(x, y, level);
+				}
+
+				if (status == FileStatus_Missing)
+				{
+					return HGTRR_NotYetBuilt; // left to the background build
+				}
+
+				// an outdated tile is served until it has been replaced
+				shared_ptr<Image> tile;
+				if (status != FileStatus_Empty && !LoadTileFromDisk(tile, x, y, level))
+				{
+					return HGTRR_InternalError;
+				}
+
+				// empty tiles are stored without pixels
+				if (!tile || tile->width == 0)
+				{
+					SetTypedMemory(img.rawData, desc.invalidValue.IsSet() ? desc.invalidValue : desc.defaultValue, (size)img.width * img.height);
+					return HGTRR_OK;
+				}
+
+				if (tile->width != img.width || tile->height != img.height)
+				{
+					std::cout << "Tile Cache Error: stored tile has an unexpected size: (" << x << "," << y << ") of level " << level << std::endl;
+					return HGTRR_InternalError;
+				}
+
+				memcpy(img.rawData, tile->rawData, img.rawDataSize);
+				return HGTRR_OK;
+			}
+
+			virtual HandleGetTileRequestResult HandleGetTileMetadataRequest(const WebMapTileService::GetTileRequest& gtr, string& metadataOut) override
+			{
+				if (desc.cachedContentType != CT_Image_Elevation)
+				{
+					return HGTRR_NotSupported;
+				}
+
+				if (IsValidTile(gtr.tileCol, gtr.tileRow, gtr.tileMatrix) && IsToBeBuiltOnRequest(GetFileStatus(gtr.tileCol, gtr.tileRow, gtr.tileMatrix)) &&
+					IsBuildableOnRequest(gtr.tileCol, gtr.tileRow, gtr.tileMatrix, desc.maxOnRequestDepth))
+				{
+					BuildTileOnRequest(gtr.tileCol, gtr.tileRow, gtr.tileMatrix, desc.maxOnRequestDepth);
+				}
+
+				utils::ElevationStatistics statistics;
+				HandleGetTileRequestResult result = FindTileStatistics(gtr.tileCol, gtr.tileRow, gtr.tileMatrix, statistics);
+				if (result != HGTRR_OK)
+				{
+					return result;
+				}
+
+				ostringstream metadata;
+				metadata << "{\"numValidPixels\":" << statistics.numValidPixels;
+				if (statistics.numValidPixels > 0)
+				{
+					metadata << ",\"minElevation\":" << statistics.minElevation << ",\"maxElevation\":" << statistics.maxElevation;
+					metadata << ",\"meanElevation\":" << statistics.GetMeanElevation();
+				}
+				metadata << "}";
+
+				metadataOut = metadata.str();
+				return HGTRR_OK;
+			}
+
+			virtual HandleGetTileRequestResult HandleInvalidateTilesRequest(const WebMapTileService::InvalidateTilesRequest& itr, string& resultOut) override
 			{
+				// anyone could make the cache rebuild the whole world otherwise
+				if (desc.invalidationToken.empty())
+				{
+					return HGTRR_NotSupported;
+				}
+				if (itr.token != desc.invalidationToken)
+				{
+					return HGTRR_AccessDenied;
+				}
+
+				const int minLevel = Max(itr.minTileMatrix, 0);
+				const int maxLevel = Min(itr.maxTileMatrix, (int)desc.numLevels - 1);
+				if (minLevel > maxLevel || itr.bbox.maxX < -180.0 || itr.bbox.minX > 180.0 || itr.bbox.maxY < -90.0 || itr.bbox.minY > 90.0)
+				{
+					return HGTRR_TileOutOfRange;
+				}
+
+				size numInvalidatedTiles = 0;
+				{
+					lock_guard<mutex> lock(fileStatusMutex);
+					invalidations.push_back({ itr.bbox, minLevel, maxLevel });
+					numInvalidations++;
+
+					for (int level = minLevel; level <= maxLevel; level++)
+					{
+						TileRange range;
+						GetTileRange(itr.bbox, level, range);
+
+						for (int y = range.minY; y <= range.maxY; y++)
+						{
+							for (int x = range.minX; x <= range.maxX; x++)
+							{
+								const u8 status = GetFileStatus(x, y, level);
+								if (status == FileStatus_Exists || status == FileStatus_Empty)
+								{
+									SetFileStatus(x, y, level, FileStatus_Stale);
+									numInvalidatedTiles++;
+								}
+							}
+						}
+					}
+				}
+
+				cout << "Tile Cache: " << numInvalidatedTiles << " tiles of levels " << minLevel << " to " << maxLevel << " invalidated" << endl;
+
+				// the running build may have skipped the invalidated tiles, they are built by the next one
+				{
+					lock_guard<mutex> lock(buildMutex);
+					isBuildRequested = true;
+				}
+				buildRequested.notify_all();
+
+				resultOut = "{\"numInvalidatedTiles\":" + to_string(numInvalidatedTiles) + "}";
 				return HGTRR_OK;
 			}
 
 		private:
 
+			enum TileStorageType
+			{
+				TileStorage_Files,		// one file per tile
+				TileStorage_Bundles,	// bundles of 128 x 128 tiles
+			};
+
 			struct TileCacheDescription
 			{
 				string id;
@@ -89,7 +415,16 @@ namespace dw
 				u16 srcPort;
 				string srcLayerName;
 				string storagePath;
-				string fileExtension;
+				TileStorageType storageType;
+				string fileExtension; // of tiles stored as files
+				bool verifyTiles; // enumerates and decodes all stored tiles at startup instead of trusting the status index
+				bool prebuild; // builds all missing tiles in the background, otherwise tiles are only built on request
+				bool buildOnRequest; // a request for a missing tile builds it instead of failing
+				u32 maxOnRequestDepth; // levels of missing tiles a requested mip tile builds along with it, coarser ones are left to the background build
+				u32 warmingInterval; // in seconds, the popular regions of a read-through cache are built in the background, 0 disables it
+				string invalidationToken; // authorizes invalidation requests, they are rejected if it is empty
+				string heatmapPath; // requested tiles of e.g. an access log (one "level x y count" per line) which are built first
+				u32 priorityLevel; // tiles of the finest level are prioritized by the requests counted for the tile of this level covering them
 
 				u32 tileWidth;
 				u32 tileHeight;
@@ -108,428 +443,1769 @@ namespace dw
 				u32 numTilesY;
 
 				u32 numLevels;
+				vector<u16> maxErrorPerLevel; // maximum vertical error of the cached elevation per level, 0 is lossless (elevation only)
 
 				u32 numXDigits;
 				u32 numYDigits;
 				u32 numLevelDigits;
+
+				u32 numFetchThreads; // render or receive source tiles
+				u32 numEncodeThreads;
+				u32 maxQueuedTiles; // per queue between the stages of the build pipeline
+				u32 maxTileRetries; // a tile which still fails is left missing and listed in the failed tiles of its level
+				u32 initialRetryDelay; // in milliseconds, doubled with every retry of a tile
 			};
 
 			TileCacheDescription desc;
+			vector<DataType> supportedFormats; // the data type of the cached tiles
+
+			WebMapService::Layer* localSrcLayer;
+			unique_ptr<IHTTPClient> srcClient; // only used for sources of other processes
+
+			struct TileStatistics
+			{
+				bool isKnown;
+				utils::ElevationStatistics statistics;
+			};
+
+			struct TilePosition
+			{
+				int x;
+				int y;
+			};
 
 			struct Level
 			{
-				unique_ptr<u8> fileStatus;
+				vector<TileStatistics> statistics; // filled while tiles are stored or on their first metadata request
+				vector<TilePosition> failedTiles; // given up by the last build, they stay missing and are built again after a restart
 			};
 
-			unique_ptr<Level> levels;
+			unique_ptr<utils::ITileStorage> storage;
+			utils::TileStatusIndex statusIndex; // file status of the tiles of all levels
+			unique_ptr<Level[]> levels;
+			mutex statisticsMutex;
 
 			const u8 FileStatus_Missing = 0;
 			const u8 FileStatus_Empty = 1;
 			const u8 FileStatus_Exists = 2;
+			const u8 FileStatus_Stale = 3; // invalidated, the stored tile is served until it has been built again
 
-			void ReadConfig(/* layerconfig */)
+			bool IsToBeBuilt(u8 status) const
 			{
-				const int AsterPixelsPerDegree = 3600;
+				return status == FileStatus_Missing || status == FileStatus_Stale;
+			}
 
-				const int NumSrcPixelsAlongLongitude = 360 * AsterPixelsPerDegree;
-				const int NumSrcPixelsAlongLatitude = 180 * AsterPixelsPerDegree;
+			// outdated tiles are replaced by the background build if there is one
+			bool IsToBeBuiltOnRequest(u8 status) const
+			{
+				return desc.buildOnRequest && (status == FileStatus_Missing || (status == FileStatus_Stale && !desc.prebuild));
+			}
 
-				const u32 NumDstPixelsAlongLongitude = NextPowerOfTwo(NumSrcPixelsAlongLongitude) / 2;
-				const u32 NumDstPixelsAlongLatitude = NextPowerOfTwo(NumSrcPixelsAlongLatitude) / 2;
+			struct Invalidation
+			{
+				BBox bbox;
+				int minLevel;
+				int maxLevel;
+			};
 
-				desc.id = "Tile Cache";
-				desc.title = "Tile Cache";
-				desc.abstract = "";
+			mutex fileStatusMutex; // orders invalidations and the status updates of built tiles
+			vector<Invalidation> invalidations; // in the order they were requested
+			atomic<u32> numInvalidations; // the size of invalidations, read without locking when a tile is fetched
 
-				desc.srcHost = "localhost";
-				desc.srcPort = 8282;
-				desc.srcLayerName = "QualityElevation";
-				//desc.storagePath = "D:/QECache";
-				desc.storagePath = "E:/QECache";
-				//desc.storagePath = "/home/rsc/Desktop/QECache";
-				desc.fileExtension = ".cem";
+			mutex buildMutex;
+			condition_variable buildRequested;
+			bool isBuildRequested;
+			bool isStopRequested;
 
-				//const u32 TileQuadCount = 16;
-				//const u32 MaxTesselationFactor = 32;
-				const u32 Padding = 0;//MaxTesselationFactor / 2;
-
-				desc.tileWidth = 2048; // TileQuadCount * MaxTesselationFactor;
-				desc.tileHeight = desc.tileWidth;
-				desc.tilePaddingLeft = Padding;
-				desc.tilePaddingTop = Padding;
-				desc.tilePaddingRight = Padding;
-				desc.tilePaddingBottom = Padding;
-
-				desc.srcContentType = CT_Image_Raw_S16;
-				desc.cachedContentType = CT_Image_Elevation;
-				desc.dataType = DT_S16;
-				desc.invalidValue = Variant(InvalidValueASTER);
-				desc.defaultValue = Variant((s16)0);
-
-				desc.numTilesX = NumDstPixelsAlongLongitude / desc.tileWidth;
-				desc.numTilesY = NumDstPixelsAlongLatitude / desc.tileHeight;
-				desc.numLevels = Min(Log2OfPowerOfTwo(desc.numTilesX), Log2OfPowerOfTwo(desc.numTilesY)) + 1;
+			unique_ptr<atomic<u32>[]> requestCounts; // served requests per tile of the priority level
+			vector<u32> heatmapCounts; // per tile of the priority level
+			vector<u32> warmedPriorities; // the priorities of the last build, a region is warmed again once it has been requested since
 
-				desc.numXDigits = (u32)RoundUp(Log10<double>(desc.numTilesX));
-				desc.numYDigits = (u32)RoundUp(Log10<double>(desc.numTilesY));
-				desc.numLevelDigits = (u32)RoundUp(Log10<double>(desc.numLevels));
+			mutex claimedTilesMutex;
+			condition_variable tileReleased;
+			set<u64> claimedTiles; // tiles which are being built, by the background build or on request
 
-				assert(desc.dataType != DT_Unknown);
-				assert(!desc.invalidValue.IsSet() || desc.dataType == desc.invalidValue.GetDataType());
-				assert(desc.defaultValue.IsSet() && desc.dataType == desc.defaultValue.GetDataType());
+			static u64 GetTileKey(int level, TilePosition position)
+			{
+				return ((u64)level << 48) | ((u64)position.y << 24) | (u64)position.x;
 			}
 
-			bool EnumerateFiles()
+			// Waits until no one else is building the tile, thus concurrent requests of a missing tile build it just once and a
+			// tile is never stored twice at the same time.
+			void ClaimTile(int level, TilePosition position)
 			{
-				path root = desc.storagePath;
+				const u64 key = GetTileKey(level, position);
 
-				error_code err;
-				create_directories(root, err);
-
-				if (err)
-				{
-					cout << "Tile Cache Error: Creating Directory Failed: " << root << " (" << err.message() << ")"<< endl;
-					return false;
-				}
-
-				levels.reset(new Level[desc.numLevels]);
+				unique_lock<mutex> lock(claimedTilesMutex);
+				tileReleased.wait(lock, [&] { return claimedTiles.count(key) == 0; });
+				claimedTiles.insert(key);
+			}
 
-				for (u32 l = 0; l < desc.numLevels; l++)
+			void ReleaseTile(int level, TilePosition position)
+			{
 				{
-					EnumerateFilesForLevel(l, root);
+					lock_guard<mutex> lock(claimedTilesMutex);
+					claimedTiles.erase(GetTileKey(level, position));
 				}
-
-				return true;
+				tileReleased.notify_all();
 			}
 
-			void EnumerateFilesForLevel(int level, const path& storagePath)
-			{
-				path levelPath = desc.storagePath;
-				levelPath /= CreateZeroPaddedString(level, desc.numLevelDigits);
-
-				int numTilesX = desc.numTilesX >> (desc.numLevels - level - 1);
-				int numTilesY = desc.numTilesY >> (desc.numLevels - level - 1);
+			static const int MaxCompressedTileHeaderSize = 64;
 
-				auto& fileStatus = levels.get()[level].fileStatus;
-				fileStatus.reset(new u8[numTilesX * numTilesY]);
-				memset(fileStatus.get(), FileStatus_Missing, numTilesX * numTilesY);
-				if (exists(levelPath))
+			static DataType GetRawDataType(ContentType contentType)
+			{
+				switch (contentType)
 				{
-					for (directory_iterator di(levelPath); di != end(di); di++)
-					{
-						const auto& entity = *di;
-						if (!is_directory(entity.status())) continue;
-
-						int y = atoi(entity.path().filename().generic_string().c_str());
-
-						for (directory_iterator fi(entity.path()); fi != end(fi); fi++)
-						{
-							const auto& fileEntity = *fi;
-							const auto extension = fileEntity.path().extension();
-							if (is_regular_file(fileEntity.status()) && extension == desc.fileExtension)
-							{
-								int x = atoi(fileEntity.path().filename().generic_string().c_str());
-
-								auto fileSize = file_size(fileEntity.path());
-
-								fileStatus.get()[y * numTilesX + x] = (fileSize > 0) ? FileStatus_Exists : FileStatus_Empty;
-							}
-						}
-					}
+				case CT_Image_Raw_S16: return DT_S16;
+				case CT_Image_Raw_U8: return DT_U8;
+				case CT_Image_Raw_U32: return DT_U32;
+				case CT_Image_Raw_F32: return DT_F32;
+				case CT_Image_Raw_F64: return DT_F64;
+				default: return DT_Unknown;
 				}
 			}
 
-			string CreateZeroPaddedString(int number, u32 numberOfDigits)
+			static Variant GetZero(DataType dataType)
 			{
-				string str = "";
-				string strEnd = to_string(number);
-				for (u32 d = 0; d < numberOfDigits - (u32)strEnd.length(); d++)
+				switch (dataType)
 				{
-					str.push_back('0');
+				case DT_U8: return Variant((u8)0);
+				case DT_S16: return Variant((s16)0);
+				case DT_U32: return Variant((u32)0);
+				case DT_F32: return Variant((f32)0);
+				case DT_F64: return Variant((f64)0);
+				default: return Variant();
 				}
-				str += strEnd;
-				return str;
 			}
 
-			bool StoreTileToDisk(Image& tileImg, int x, int y, int level)
+			bool ReadConfig(libconfig::ChainedSetting& config)
 			{
-				path path = desc.storagePath;
-
-				string levelString = CreateZeroPaddedString(level, desc.numLevelDigits);
-				string yString = CreateZeroPaddedString(y, desc.numYDigits);
+				// by default the finest level matches the resolution of ASTER (an arc second)
+				const int AsterPixelsPerDegree = 3600;
 
-				path /= levelString;
-				path /= yString;
+				const int NumSrcPixelsAlongLongitude = 360 * AsterPixelsPerDegree;
+				const int NumSrcPixelsAlongLatitude = 180 * AsterPixelsPerDegree;
 
-				error_code err;
-				create_directories(path, err);
+				const u32 NumDstPixelsAlongLongitude = NextPowerOfTwo(NumSrcPixelsAlongLongitude) / 2;
+				const u32 NumDstPixelsAlongLatitude = NextPowerOfTwo(NumSrcPixelsAlongLatitude) / 2;
 
-				if (err)
+				string id = config["Identifier"].defaultValue("TileCache");
+				string title = config["Title"].defaultValue("");
+				string abstract = config["Abstract"].defaultValue("");
+				desc.id = id;
+				desc.title = title.empty() ? id : title;
+				desc.abstract = abstract;
+
+				string srcLayerName = config["SourceLayer"].isMandatory();
+				string srcHost = config["SourceHost"].defaultValue("localhost");
+				desc.srcLayerName = srcLayerName;
+				desc.srcHost = srcHost;
+				desc.srcPort = (u16)(int)config["SourcePort"].min(0).max(65535).defaultValue(8282);
+
+				string storagePath = config["StoragePath"].isMandatory();
+				string storageType = config["Storage"].defaultValue("bundles");
+				desc.storagePath = storagePath;
+				desc.storageType = (storageType == "files") ? TileStorage_Files : TileStorage_Bundles;
+				desc.fileExtension = ".cem";
+				desc.verifyTiles = config["VerifyTiles"].defaultValue(false);
+				desc.prebuild = config["Prebuild"].defaultValue(false);
+				desc.buildOnRequest = config["BuildOnRequest"].defaultValue(true);
+				desc.maxOnRequestDepth = (int)config["MaxOnRequestDepth"].min(0).max(4).defaultValue(2);
+				desc.warmingInterval = (int)config["WarmingInterval"].min(0).defaultValue(60);
+
+				string heatmapPath = config["HeatmapPath"].defaultValue("");
+				desc.heatmapPath = heatmapPath;
+
+				string invalidationToken = config["InvalidationToken"].defaultValue("");
+				desc.invalidationToken = invalidationToken;
+
+				desc.tileWidth = (int)config["TileWidth"].min(1).max(16384).defaultValue(2048);
+				desc.tileHeight = (int)config["TileHeight"].min(1).max(16384).defaultValue((int)desc.tileWidth);
+
+				const u32 padding = (int)config["TilePadding"].min(0).max(1024).defaultValue(0);
+				desc.tilePaddingLeft = padding;
+				desc.tilePaddingTop = padding;
+				desc.tilePaddingRight = padding;
+				desc.tilePaddingBottom = padding;
+
+				string srcContentType = config["SourceContentType"].defaultValue(ContentTypeId[CT_Image_Raw_S16].c_str());
+				desc.srcContentType = GetContentType(srcContentType);
+				desc.dataType = GetRawDataType(desc.srcContentType);
+
+				// raw elevation is compressed, tiles of other types are stored as they are rendered
+				const string defaultCachedContentType = (desc.dataType == DT_S16) ? ContentTypeId[CT_Image_Elevation] : srcContentType;
+				string cachedContentType = config["CachedContentType"].defaultValue(defaultCachedContentType.c_str());
+				desc.cachedContentType = GetContentType(cachedContentType);
+
+				// the number of tiles of the finest level along both axes, every coarser level halves them
+				desc.numTilesX = (int)config["NumTilesX"].min(1).defaultValue((int)Max(1u, NumDstPixelsAlongLongitude / desc.tileWidth));
+				desc.numTilesY = (int)config["NumTilesY"].min(1).defaultValue((int)Max(1u, NumDstPixelsAlongLatitude / desc.tileHeight));
+
+				// without MaxErrorPerLevel the finest level stays lossless, the box filtered mip levels tolerate a meter of error and
+				// shrink considerably
+				const u16 maxMipError = (u16)(int)config["MaxMipError"].min(0).max(1000).defaultValue(1);
+
+				// rendering and compressing share the cores, a single thread writes
+				const u32 numCores = Max(1u, thread::hardware_concurrency());
+				const u32 numFetchThreads = (int)config["NumFetchThreads"].min(0).max(256).defaultValue(0);
+				const u32 numEncodeThreads = (int)config["NumEncodeThreads"].min(0).max(256).defaultValue(0);
+				desc.numFetchThreads = (numFetchThreads > 0) ? numFetchThreads : numCores;
+				desc.numEncodeThreads = (numEncodeThreads > 0) ? numEncodeThreads : Max(1u, numCores / 2);
+				desc.maxQueuedTiles = (int)config["MaxQueuedTiles"].min(1).max(1024).defaultValue(4);
+				desc.maxTileRetries = (int)config["MaxTileRetries"].min(0).max(100).defaultValue(5);
+				desc.initialRetryDelay = (int)config["InitialRetryDelay"].min(0).defaultValue(1000);
+
+				if (config.isAnyMandatorySettingMissing()) return false;
+
+				if (desc.dataType == DT_Unknown)
 				{
-					cout << "Tile Cache Error: Creating Directory Failed: " << path << " (" << err.message() << ")" << endl;
+					cout << "Tile Cache Error: the source content type has to be raw: " << srcContentType << endl;
 					return false;
 				}
 
-				string xString = CreateZeroPaddedString(x, desc.numXDigits);
-
-				string filename = xString + desc.fileExtension;
-				path /= filename;
-
-				if (!utils::ConvertRawImageToContentType(tileImg, desc.cachedContentType))
+				if (desc.cachedContentType != desc.srcContentType && (desc.cachedContentType != CT_Image_Elevation || desc.dataType != DT_S16))
 				{
-					std::cout << "Tile Cache Error: compressing elevation failed" << std::endl;
+					cout << "Tile Cache Error: " << srcContentType << " cannot be cached as " << cachedContentType << endl;
 					return false;
 				}
-				if (!tileImg.SaveProcessedDataToFile(path.string()))
+
+				if (storageType != "bundles" && storageType != "files")
 				{
-					std::cout << "Tile Cache Error: writing to file failed: " << path << std::endl;
+					cout << "Tile Cache Error: unknown storage (has to be bundles or files): " << storageType << endl;
 					return false;
 				}
 
-				return true;
-			}
-
-			bool LoadTileFromDisk(shared_ptr<Image>& imageOut, int x, int y, int level)
-			{
-				imageOut.reset((Image*)NULL);
-
-				path path = desc.storagePath;
-
-				string levelString = CreateZeroPaddedString(level, desc.numLevelDigits);
-				string yString = CreateZeroPaddedString(y, desc.numYDigits);
-
-				path /= levelString;
-				path /= yString;
-
-				string xString = CreateZeroPaddedString(x, desc.numXDigits);
-
-				string filename = xString + desc.fileExtension;
-				path /= filename;
-
-				if (!Image::LoadContentFromFile(path.string(), desc.cachedContentType, imageOut))
+				if (!desc.prebuild && !desc.buildOnRequest)
 				{
-					std::cout << "Tile Cache Error: reading from file failed: " << path << std::endl;
+					cout << "Tile Cache Error: tiles are neither prebuilt nor built on request" << endl;
 					return false;
 				}
-				if (!utils::ConvertContentTypeToRawImage(*imageOut.get()))
+
+				if (NextPowerOfTwo(desc.numTilesX) != desc.numTilesX || NextPowerOfTwo(desc.numTilesY) != desc.numTilesY)
 				{
-					std::cout << "Tile Cache Error: decompressing elevation failed" << std::endl;
+					cout << "Tile Cache Error: the number of tiles of the finest level has to be a power of two" << endl;
 					return false;
 				}
 
-				return true;
-			}
-
-			void CreateTileCacheAsync()
-			{
-				CreateTileCacheLevel0();
-				CreateTileCacheMipLevels();
-			}
-
-			void CreateTileCacheLevel0()
-			{
-				Image emptyTile(0, 0, desc.dataType);
+				desc.invalidValue = (desc.cachedContentType == CT_Image_Elevation) ? Variant(InvalidValueASTER) : Variant();
+				desc.defaultValue = GetZero(desc.dataType);
 
-				const double TileWidthInDegree = (360.0 / desc.numTilesX);
-				const double TileHeightInDegree = (180.0 / desc.numTilesY);
-				const double TilePaddingLeftInDegree = TileWidthInDegree * (desc.tilePaddingLeft / (double)desc.tileWidth);
-				const double TilePaddingRightInDegree = TileWidthInDegree * (desc.tilePaddingRight / (double)desc.tileWidth);
-				const double TilePaddingTopInDegree = TileHeightInDegree * (desc.tilePaddingTop / (double)desc.tileHeight);
-				const double TilePaddingBottomInDegree = TileHeightInDegree * (desc.tilePaddingBottom / (double)desc.tileHeight);
+				desc.numLevels = Min(Log2OfPowerOfTwo(desc.numTilesX), Log2OfPowerOfTwo(desc.numTilesY)) + 1;
 
-				const auto& fileStatus = levels.get()[desc.numLevels - 1].fileStatus;
-				
-				unique_ptr<IHTTPClient> client(IHTTPClient::Create("http://" + desc.srcHost + ":" + to_string(desc.srcPort)));
+				// by default the requests of 8 x 8 tiles of the finest level are counted together
+				desc.priorityLevel = (int)config["PriorityLevel"].min(0).max((int)desc.numLevels - 1).defaultValue(Max(0, (int)desc.numLevels - 4));
 
-				for (u32 y = 0; y < desc.numTilesY; y++)
+				// the maximum error of each level from the coarsest to the finest one, e.g. [2, 2, 1, 1, 0]
+				auto maxErrorPerLevel = config["MaxErrorPerLevel"];
+				const int numMaxErrors = maxErrorPerLevel.getLength();
+				if (numMaxErrors > 0)
 				{
-					#pragma omp parallel for
-					for (int x = 0; x < (int)desc.numTilesX; x++)
+					if (numMaxErrors != (int)desc.numLevels)
+					{
+						cout << "Tile Cache Error: MaxErrorPerLevel has " << numMaxErrors << " values instead of one per level: " << desc.numLevels << endl;
+						return false;
+					}
+
+					desc.maxErrorPerLevel.resize(desc.numLevels);
+					for (int l = 0; l < numMaxErrors; l++)
 					{
-						if (fileStatus.get()[y * desc.numTilesX + x] != FileStatus_Missing)
+						const int maxError = maxErrorPerLevel[l];
+						if (maxError < 0 || maxError > 4095) // the limit of the compressed elevation
 						{
-							continue;
+							cout << "Tile Cache Error: the maximum error of level " << l << " has to be within 0 and 4095: " << maxError << endl;
+							return false;
 						}
+						desc.maxErrorPerLevel[l] = (u16)maxError;
+					}
+				}
+				else
+				{
+					desc.maxErrorPerLevel.assign(desc.numLevels, maxMipError);
+					desc.maxErrorPerLevel[desc.numLevels - 1] = 0;
+				}
 
-						Image tileImg(desc.tileWidth, desc.tileHeight, desc.dataType);
-						const size expectedTileSize = tileImg.rawDataSize;
-
-						string tileRequestUri = "/?SERVICE=WMS&VERSION=1.3.0&REQUEST=GetMap&CRS=EPSG:4326&LAYERS=" + desc.srcLayerName + "&STYLES=";
-						tileRequestUri += "&WIDTH=" + to_string(desc.tileWidth);
-						tileRequestUri += "&HEIGHT=" + to_string(desc.tileHeight);
-						tileRequestUri += "&FORMAT=" + ContentTypeId[desc.srcContentType];
-
-						const double left = (x / (double)desc.numTilesX) * 360.0 - 180.0 - TilePaddingLeftInDegree;
-						const double top = -(y / (double)desc.numTilesY) * 180.0 + 90.0 + TilePaddingTopInDegree;
-						const double right = left + TileWidthInDegree + TilePaddingRightInDegree;
-						const double bottom = top - TileHeightInDegree - TilePaddingBottomInDegree;
+				// digits of the largest index, thus a single tile or level has one digit
+				desc.numXDigits = (u32)to_string(desc.numTilesX - 1).length();
+				desc.numYDigits = (u32)to_string(desc.numTilesY - 1).length();
+				desc.numLevelDigits = (u32)to_string(desc.numLevels - 1).length();
 
-						tileRequestUri += "&BBOX=" + to_string(left) + "," + to_string(bottom) + "," + to_string(right) + "," + to_string(top);
+				supportedFormats.assign(1, desc.dataType);
 
-						bool retry = false;
-						do
+				assert(!desc.invalidValue.IsSet() || desc.dataType == desc.invalidValue.GetDataType());
+				assert(desc.defaultValue.IsSet() && desc.dataType == desc.defaultValue.GetDataType());
+				return true;
+			}
+
+			bool EnumerateFiles()
+			{
+				path root = desc.storagePath;
+
+				error_code err;
+				create_directories(root, err);
+
+				if (err)
+				{
+					cout << "Tile Cache Error: Creating Directory Failed: " << root << " (" << err.message() << ")"<< endl;
+					return false;
+				}
+
+				if (desc.storageType == TileStorage_Bundles)
+				{
+					storage.reset(utils::ITileStorage::CreateBundleStorage(desc.storagePath, desc.numLevelDigits));
+				}
+				else
+				{
+					storage.reset(utils::ITileStorage::CreateFileStorage(desc.storagePath, desc.fileExtension, desc.numLevelDigits, desc.numXDigits, desc.numYDigits));
+				}
+
+				levels.reset(new Level[desc.numLevels]);
+
+				vector<u32> numTilesPerLevel;
+				for (u32 l = 0; l < desc.numLevels; l++)
+				{
+					TileStatistics unknownStatistics;
+					unknownStatistics.isKnown = false;
+					levels.get()[l].statistics.assign(GetNumTilesX(l) * GetNumTilesY(l), unknownStatistics);
+
+					numTilesPerLevel.push_back(GetNumTilesX(l) * GetNumTilesY(l));
+				}
+
+				// the index holds the status of all stored tiles, only a cache without index (or one of another layout) is enumerated
+				path indexPath = root;
+				indexPath /= "tiles.dwi";
+				if (!desc.verifyTiles && statusIndex.Open(indexPath.string(), storage->GetFourCC(), numTilesPerLevel))
+				{
+					return true;
+				}
+
+				if (!statusIndex.Create(indexPath.string(), storage->GetFourCC(), numTilesPerLevel))
+				{
+					cout << "Tile Cache Error: Creating Tile Index Failed: " << indexPath << endl;
+					return false;
+				}
+
+				for (u32 l = 0; l < desc.numLevels; l++)
+				{
+					if (!EnumerateFilesForLevel(l)) return false;
+				}
+
+				if (!statusIndex.Commit())
+				{
+					cout << "Tile Cache Error: Storing Tile Index Failed: " << indexPath << endl;
+					return false;
+				}
+
+				return true;
+			}
+
+			bool EnumerateFilesForLevel(int level)
+			{
+				const int numTilesX = GetNumTilesX(level);
+				const int numTilesY = GetNumTilesY(level);
+
+				vector<utils::ITileStorage::StoredTile> storedTiles;
+				if (!storage->EnumerateTiles(level, storedTiles))
+				{
+					cout << "Tile Cache Error: Enumerating Tiles Failed (Level: " << level << ")" << endl;
+					return false;
+				}
+
+				// tiles of builds without index may have been truncated by a crash, a tile which cannot be decoded is built again
+				#pragma omp parallel for schedule(dynamic)
+				for (int t = 0; t < (int)storedTiles.size(); t++)
+				{
+					const utils::ITileStorage::StoredTile& storedTile = storedTiles[t];
+					if (storedTile.x < 0 || storedTile.y < 0 || storedTile.x >= numTilesX || storedTile.y >= numTilesY)
+					{
+						continue;
+					}
+
+					shared_ptr<Image> tile;
+					if (storedTile.dataSize == 0 || LoadTileFromDisk(tile, storedTile.x, storedTile.y, level))
+					{
+						// empty elevation tiles are compressed without pixels, empty tiles of other types are stored without data
+						const bool isEmpty = !tile || tile->width == 0;
+						statusIndex.SetStatus(level, storedTile.y * numTilesX + storedTile.x, isEmpty ? FileStatus_Empty : FileStatus_Exists);
+					}
+				}
+
+				return true;
+			}
+
+
+			static bool IsLocalHost(const string& host)
+			{
+				return host.empty() || host == "localhost" || host == "127.0.0.1";
+			}
+
+			unique_ptr<ITileSource> CreateTileSource()
+			{
+				if (localSrcLayer)
+				{
+					return unique_ptr<ITileSource>(new LocalTileSource(*localSrcLayer));
+				}
+				return unique_ptr<ITileSource>(new HTTPTileSource(*srcClient.get(), desc.srcLayerName, desc.srcContentType));
+			}
+
+			utils::ElevationCompressionOptions GetCompressionOptions(int level) const
+			{
+				utils::ElevationCompressionOptions options;
+				options.maxError = desc.maxErrorPerLevel[level];
+				return options;
+			}
+
+			// compressionBuffer is reused by the calls of a thread, it grows to the worst case compressed tile size once
+			size CompressTile(const Image& tileImg, int level, vector<u8>& compressionBuffer)
+			{
+				if (desc.cachedContentType != CT_Image_Elevation)
+				{
+					// raw tiles are stored uncompressed
+					compressionBuffer.assign(tileImg.rawData, tileImg.rawData + tileImg.rawDataSize);
+					return tileImg.rawDataSize;
+				}
+
+				const utils::ElevationCompressionOptions options = GetCompressionOptions(level);
+
+				const size maxCompressedSize = utils::GetMaxCompressedElevationSize(tileImg.width, tileImg.height, options);
+				if (compressionBuffer.size() < maxCompressedSize)
+				{
+					compressionBuffer.resize(maxCompressedSize);
+				}
+
+				const size compressedSize = utils::CompressElevation(tileImg, desc.invalidValue, compressionBuffer.data(), compressionBuffer.size(), options);
+				if (compressedSize == 0)
+				{
+					std::cout << "Tile Cache Error: compressing elevation failed" << std::endl;
+				}
+
+				return compressedSize;
+			}
+
+			// the statistics written by the encoder replace a scan of the raw tile for invalid pixels
+			bool IsCompressedTileCompletelyInvalid(u8* compressedData, size compressedSize) const
+			{
+				if (desc.cachedContentType != CT_Image_Elevation)
+				{
+					return false;
+				}
+
+				utils::ElevationStatistics statistics;
+				Image compressedTile(compressedData, compressedSize, desc.cachedContentType, false);
+				return desc.invalidValue.IsSet() && utils::ReadCompressedElevationStatistics(compressedTile, statistics) && statistics.numValidPixels == 0;
+			}
+
+			bool StoreCompressedTileToDisk(u8* compressedData, size compressedSize, int x, int y, int level)
+			{
+				if (!storage->StoreTile(x, y, level, compressedData, compressedSize))
+				{
+					std::cout << "Tile Cache Error: storing tile failed: (" << x << "," << y << ") of level " << level << std::endl;
+					return false;
+				}
+
+				Image compressedTile(compressedData, compressedSize, desc.cachedContentType, false);
+				utils::ElevationStatistics statistics;
+				if (desc.cachedContentType == CT_Image_Elevation && utils::ReadCompressedElevationStatistics(compressedTile, statistics))
+				{
+					SetTileStatistics(x, y, level, statistics);
+				}
+
+				return true;
+			}
+
+			// the status of a tile is set once it has been stored completely
+			void SetFileStatus(int x, int y, int level, u8 status)
+			{
+				statusIndex.SetStatus(level, y * GetNumTilesX(level) + x, status);
+			}
+
+			u8 GetFileStatus(int x, int y, int level) const
+			{
+				return statusIndex.GetStatus(level, y * GetNumTilesX(level) + x);
+			}
+
+			int GetNumTilesX(int level) const
+			{
+				return desc.numTilesX >> (desc.numLevels - level - 1);
+			}
+
+			int GetNumTilesY(int level) const
+			{
+				return desc.numTilesY >> (desc.numLevels - level - 1);
+			}
+
+			void SetTileStatistics(int x, int y, int level, const utils::ElevationStatistics& statistics)
+			{
+				lock_guard<mutex> lock(statisticsMutex);
+
+				TileStatistics& tileStatistics = levels.get()[level].statistics[y * GetNumTilesX(level) + x];
+				tileStatistics.statistics = statistics;
+				tileStatistics.isKnown = true;
+			}
+
+			struct TileRange
+			{
+				int minX;
+				int minY;
+				int maxX;
+				int maxY;
+			};
+
+			// the tiles of a level intersecting the bbox (EPSG:4326), the tiles of the finest level are rendered including their padding
+			void GetTileRange(const BBox& bbox, int level, TileRange& rangeOut) const
+			{
+				const double tileWidthInDegree = 360.0 / GetNumTilesX(level);
+				const double tileHeightInDegree = 180.0 / GetNumTilesY(level);
+
+				const bool isFinestLevel = (level == (int)desc.numLevels - 1);
+				const double paddingX = isFinestLevel ? tileWidthInDegree * Max(desc.tilePaddingLeft, desc.tilePaddingRight) / desc.tileWidth : 0.0;
+				const double paddingY = isFinestLevel ? tileHeightInDegree * Max(desc.tilePaddingTop, desc.tilePaddingBottom) / desc.tileHeight : 0.0;
+
+				rangeOut.minX = Max((int)floor((bbox.minX - paddingX + 180.0) / tileWidthInDegree), 0);
+				rangeOut.maxX = Min((int)floor((bbox.maxX + paddingX + 180.0) / tileWidthInDegree), GetNumTilesX(level) - 1);
+				rangeOut.minY = Max((int)floor((90.0 - bbox.maxY - paddingY) / tileHeightInDegree), 0);
+				rangeOut.maxY = Min((int)floor((90.0 - bbox.minY + paddingY) / tileHeightInDegree), GetNumTilesY(level) - 1);
+			}
+
+			bool IsValidTile(int x, int y, int level) const
+			{
+				return level >= 0 && level < (int)desc.numLevels && x >= 0 && y >= 0 && x < GetNumTilesX(level) && y < GetNumTilesY(level);
+			}
+
+			// Looks the statistics up in the index, tiles of earlier runs are indexed on their first request by reading their header
+			HandleGetTileRequestResult FindTileStatistics(int x, int y, int level, utils::ElevationStatistics& statisticsOut)
+			{
+				if (!IsValidTile(x, y, level))
+				{
+					return HGTRR_TileOutOfRange;
+				}
+
+				const int tileIndex = y * GetNumTilesX(level) + x;
+				{
+					lock_guard<mutex> lock(statisticsMutex);
+
+					const TileStatistics& tileStatistics = levels.get()[level].statistics[tileIndex];
+					if (tileStatistics.isKnown)
+					{
+						statisticsOut = tileStatistics.statistics;
+						return HGTRR_OK;
+					}
+				}
+
+				if (GetFileStatus(x, y, level) == FileStatus_Missing)
+				{
+					return HGTRR_NotYetBuilt;
+				}
+
+				vector<u8> header;
+				storage->LoadTile(x, y, level, header, MaxCompressedTileHeaderSize);
+
+				Image compressedHeader(header.data(), header.size(), desc.cachedContentType, false);
+				if (header.empty() || !utils::ReadCompressedElevationStatistics(compressedHeader, statisticsOut))
+				{
+					std::cout << "Tile Cache Error: reading tile statistics failed: (" << x << "," << y << ") of level " << level << std::endl;
+					return HGTRR_InternalError;
+				}
+
+				SetTileStatistics(x, y, level, statisticsOut);
+				return HGTRR_OK;
+			}
+
+			bool LoadTileFromDisk(shared_ptr<Image>& imageOut, int x, int y, int level)
+			{
+				imageOut.reset((Image*)NULL);
+
+				vector<u8> compressedTile;
+				if (!storage->LoadTile(x, y, level, compressedTile))
+				{
+					std::cout << "Tile Cache Error: reading tile failed: (" << x << "," << y << ") of level " << level << std::endl;
+					return false;
+				}
+
+				if (desc.cachedContentType != CT_Image_Elevation)
+				{
+					// empty raw tiles are stored without pixels as well
+					const bool isEmpty = compressedTile.empty();
+					imageOut.reset(new Image(isEmpty ? 0 : desc.tileWidth, isEmpty ? 0 : desc.tileHeight, desc.dataType));
+					if (compressedTile.size() != imageOut->rawDataSize)
+					{
+						std::cout << "Tile Cache Error: stored tile has an unexpected size: (" << x << "," << y << ") of level " << level << std::endl;
+						return false;
+					}
+
+					memcpy(imageOut->rawData, compressedTile.data(), compressedTile.size());
+					return true;
+				}
+
+				imageOut.reset(new Image(compressedTile.data(), compressedTile.size(), desc.cachedContentType, false));
+				const bool isDecompressed = utils::ConvertContentTypeToRawImage(*imageOut.get());
+				imageOut->processedData = NULL; // compressedTile is released with this function
+				imageOut->processedDataSize = 0;
+
+				if (!isDecompressed)
+				{
+					std::cout << "Tile Cache Error: decompressing elevation failed" << std::endl;
+					return false;
+				}
+
+				return true;
+			}
+
+			// a tile on its way through the build pipeline, jobs are reused for the following tiles
+			struct TileJob
+			{
+				TilePosition position;
+				int level;
+				u32 numFailures;
+
+				bool isRendered; // the rows of the tile are read from source, otherwise tile holds it
+				unique_ptr<ITileSource> source; // delivers the rows of a rendered tile
+				unique_ptr<Image> tile; // a box filtered tile of a mip level
+				Image* parentChildren; // receives the pixels of the tile if the mip tile covering it is built as well, otherwise NULL
+				u32 numInvalidations; // when the tile was fetched
+
+				vector<u8> compressionBuffer;
+				size compressedSize;
+				bool isEmpty;
+			};
+
+			// prepares job in the fetch stage by requesting its tile from a source or by creating the tile, returns false on failure
+			typedef function<bool(TileJob& job)> FetchTile;
+
+			// the four tiles covered by a mip tile, each one in its quadrant, a tile which is not filled in stays invalid
+			static Image* CreateMipChildren(const TileCacheDescription& desc)
+			{
+				Image* children = new Image(desc.tileWidth * 2, desc.tileHeight * 2, desc.dataType);
+				SetTypedMemory(children->rawData, desc.invalidValue.IsSet() ? desc.invalidValue : desc.defaultValue, (size)children->width * children->height);
+				return children;
+			}
+
+			// A tile which was invalidated while it was built is stored as outdated, even if it was missing before, it may have been
+			// created from the replaced source data. Invalidations of other regions or levels do not affect it.
+			void SetBuiltFileStatus(const TileJob& job)
+			{
+				lock_guard<mutex> lock(fileStatusMutex);
+				for (size i = job.numInvalidations; i < invalidations.size(); i++)
+				{
+					const Invalidation& invalidation = invalidations[i];
+					if (job.level < invalidation.minLevel || job.level > invalidation.maxLevel)
+					{
+						continue;
+					}
+
+					TileRange range;
+					GetTileRange(invalidation.bbox, job.level, range);
+					if (job.position.x >= range.minX && job.position.x <= range.maxX && job.position.y >= range.minY && job.position.y <= range.maxY)
+					{
+						SetFileStatus(job.position.x, job.position.y, job.level, FileStatus_Stale);
+						return;
+					}
+				}
+
+				SetFileStatus(job.position.x, job.position.y, job.level, job.isEmpty ? FileStatus_Empty : FileStatus_Exists);
+			}
+
+			struct ScheduledTile
+			{
+				TilePosition position;
+				int level;
+				u32 numFailures;
+			};
+
+			// Hands the tiles of a build out to the fetch stage. A mip tile waits until the four tiles it covers are finished and is
+			// handed out before all other tiles then, thus the decoded tiles it is created from are only held for a short while.
+			// The tiles covered by a mip tile coarser than the priority level are not held, they may be finished by regions of
+			// different priorities far apart and are loaded once the mip tile is built.
+			// A failed tile is handed out again after a delay, which doubles with every failure, until it has failed maxRetries
+			// times, the mip tiles covering it are given up along with it. The build is complete once every tile has been stored
+			// or given up.
+			class TileBuildSchedule
+			{
+			public:
+				TileBuildSchedule(const TileCacheDescription& desc, u32 maxRetries, milliseconds initialRetryDelay)
+					: desc(desc)
+					, numUnfinishedTiles(0)
+					, maxRetries(maxRetries)
+					, initialRetryDelay(initialRetryDelay)
+					, failedTiles(desc.numLevels)
+					, isCancelled(false)
+				{
+				}
+
+				// tiles are handed out in the order they were added
+				void AddTile(int level, TilePosition position)
+				{
+					lock_guard<mutex> lock(scheduleMutex);
+					numUnfinishedTiles++;
+					pending.push_back({ position, level, 0 });
+				}
+
+				// numChildren of the four tiles covered by the mip tile are part of the build, the others are stored already
+				void AddMipTile(int level, TilePosition position, int numChildren)
+				{
+					lock_guard<mutex> lock(scheduleMutex);
+					numUnfinishedTiles++;
+
+					MipTile& mipTile = mipTiles[GetTileKey(level, position)];
+					mipTile.numUnfinishedChildren = numChildren;
+					mipTile.deliveredChildren = 0;
+					mipTile.hasFailedChild = false;
+
+					if (numChildren == 0)
+					{
+						pending.push_back({ position, level, 0 });
+					}
+				}
+
+				// waits for the next tile, returns false once the build is complete
+				bool NextTile(ScheduledTile& tileOut)
+				{
+					unique_lock<mutex> lock(scheduleMutex);
+					for (;;)
+					{
+						if (isCancelled)
+						{
+							return false;
+						}
+
+						// retries which are due are handed out before the remaining tiles, their failure may have been temporary
+						const steady_clock::time_point now = steady_clock::now();
+						while (!delayed.empty() && delayed.begin()->first <= now)
+						{
+							pending.push_front(delayed.begin()->second);
+							delayed.erase(delayed.begin());
+						}
+
+						if (!pending.empty())
+						{
+							tileOut = pending.front();
+							pending.pop_front();
+							return true;
+						}
+
+						if (numUnfinishedTiles == 0)
+						{
+							return false;
+						}
+
+						if (delayed.empty())
+						{
+							scheduleChanged.wait(lock);
+						}
+						else
+						{
+							scheduleChanged.wait_until(lock, delayed.begin()->first);
+						}
+					}
+				}
+
+				void OnTileFinished(ScheduledTile tile, bool isStored)
+				{
+					{
+						lock_guard<mutex> lock(scheduleMutex);
+						if (!isStored && ++tile.numFailures <= maxRetries)
+						{
+							delayed.insert(make_pair(steady_clock::now() + initialRetryDelay * (1 << Min(tile.numFailures - 1, 16u)), tile));
+						}
+						else
+						{
+							if (!isStored)
+							{
+								failedTiles[tile.level].push_back(tile.position);
+							}
+							FinishTile(tile.level, tile.position, isStored);
+						}
+					}
+					scheduleChanged.notify_all();
+				}
+
+				// The decoded tiles covered by the mip tile which covers the given tile, each one in its quadrant. NULL if that
+				// mip tile is not part of the build or does not hold its tiles. The image stays valid until the mip tile is finished.
+				Image* GetParentChildren(int level, TilePosition position)
+				{
+					if (level == 0 || !HoldsChildren(level - 1))
+					{
+						return NULL;
+					}
+
+					lock_guard<mutex> lock(scheduleMutex);
+
+					auto parent = mipTiles.find(GetTileKey(level - 1, { position.x / 2, position.y / 2 }));
+					return (parent != mipTiles.end()) ? GetChildren(parent->second) : NULL;
+				}
+
+				// the tiles covered by a mip tile, deliveredChildrenOut flags the quadrants (bit y * 2 + x) which were built by this build
+				Image* GetChildren(int level, TilePosition position, u8& deliveredChildrenOut)
+				{
+					lock_guard<mutex> lock(scheduleMutex);
+
+					MipTile& mipTile = mipTiles.at(GetTileKey(level, position));
+					deliveredChildrenOut = mipTile.deliveredChildren;
+					return GetChildren(mipTile);
+				}
+
+				// no further tiles are handed out, the tiles in flight are still finished
+				void Cancel()
+				{
+					{
+						lock_guard<mutex> lock(scheduleMutex);
+						isCancelled = true;
+					}
+					scheduleChanged.notify_all();
+				}
+
+				// the tiles covered by a mip tile of the priority level or a finer one are finished close to each other
+				bool HoldsChildren(int level) const
+				{
+					return level >= (int)desc.priorityLevel;
+				}
+
+				// the tiles of a level which failed more than maxRetries times
+				vector<TilePosition> GetFailedTiles(int level)
+				{
+					lock_guard<mutex> lock(scheduleMutex);
+					return failedTiles[level];
+				}
+
+			private:
+				struct MipTile
+				{
+					unique_ptr<Image> children; // allocated once the first of the covered tiles is fetched
+					int numUnfinishedChildren;
+					u8 deliveredChildren;
+					bool hasFailedChild;
+				};
+
+				Image* GetChildren(MipTile& mipTile)
+				{
+					if (!mipTile.children)
+					{
+						mipTile.children.reset(CreateMipChildren(desc));
+					}
+					return mipTile.children.get();
+				}
+
+				// hands the mip tile covering the tile out once its tiles are finished, or gives it up if one of them failed
+				void FinishTile(int level, TilePosition position, bool isStored)
+				{
+					for (;;)
+					{
+						numUnfinishedTiles--;
+						mipTiles.erase(GetTileKey(level, position));
+
+						auto parent = (level > 0) ? mipTiles.find(GetTileKey(level - 1, { position.x / 2, position.y / 2 })) : mipTiles.end();
+						if (parent == mipTiles.end())
+						{
+							return;
+						}
+
+						MipTile& mipTile = parent->second;
+						if (isStored)
+						{
+							mipTile.deliveredChildren |= 1 << ((position.y % 2) * 2 + position.x % 2);
+						}
+						else
+						{
+							mipTile.hasFailedChild = true;
+						}
+
+						if (--mipTile.numUnfinishedChildren > 0)
+						{
+							return;
+						}
+
+						level--;
+						position = { position.x / 2, position.y / 2 };
+
+						if (!mipTile.hasFailedChild)
+						{
+							pending.push_front({ position, level, 0 });
+							return;
+						}
+
+						isStored = false;
+					}
+				}
+
+				const TileCacheDescription& desc;
+				mutex scheduleMutex;
+				condition_variable scheduleChanged;
+				deque<ScheduledTile> pending;
+				multimap<steady_clock::time_point, ScheduledTile> delayed; // failed tiles waiting for their retry
+				map<u64, MipTile> mipTiles; // mip tiles of the build which have not been finished yet
+				size numUnfinishedTiles;
+				const u32 maxRetries;
+				const milliseconds initialRetryDelay;
+				vector<vector<TilePosition>> failedTiles;
+				bool isCancelled;
+			};
+
+			TileBuildSchedule* runningSchedule; // guarded by buildMutex, cancelled once the cache is stopped
+
+			// reports the number of stored tiles and the throughput at most once a second and once the build has finished
+			class BuildProgress
+			{
+			public:
+				BuildProgress(const vector<size>& numTilesPerLevel)
+					: numTilesPerLevel(numTilesPerLevel)
+					, numStoredTilesPerLevel(numTilesPerLevel.size(), 0)
+					, numTiles(0)
+					, numStoredTiles(0)
+					, numReportedTiles(0)
+					, start(steady_clock::now())
+					, lastReport(start)
+				{
+					for (size numLevelTiles : numTilesPerLevel)
+					{
+						numTiles += numLevelTiles;
+					}
+				}
+
+				void OnTileStored(int level)
+				{
+					numStoredTilesPerLevel[level]++;
+					numStoredTiles++;
+
+					const steady_clock::time_point now = steady_clock::now();
+					if (now - lastReport < seconds(1))
+					{
+						return;
+					}
+
+					const double tilesPerSecond = (numStoredTiles - numReportedTiles) / duration_cast<duration<double>>(now - lastReport).count();
+					numReportedTiles = numStoredTiles;
+					lastReport = now;
+
+					cout << "Tile Cache: " << numStoredTiles << "/" << numTiles << " tiles, " << fixed << setprecision(1)
+						<< tilesPerSecond << " tiles/s (" << GetAverageTilesPerSecond(now) << " tiles/s on average)    \r" << flush;
+					cout.unsetf(ios::fixed);
+				}
+
+				void OnBuildFinished()
+				{
+					for (int level = (int)numTilesPerLevel.size() - 1; level >= 0; level--)
+					{
+						if (numTilesPerLevel[level] > 0)
+						{
+							cout << "Tile Cache: Level " << level << ": " << numStoredTilesPerLevel[level] << "/" << numTilesPerLevel[level] << " tiles stored          " << endl;
+						}
+					}
+
+					cout << "Tile Cache: " << numStoredTiles << "/" << numTiles << " tiles stored, " << fixed << setprecision(1)
+						<< GetAverageTilesPerSecond(steady_clock::now()) << " tiles/s on average" << endl;
+					cout.unsetf(ios::fixed);
+				}
+
+			private:
+				double GetAverageTilesPerSecond(steady_clock::time_point now) const
+				{
+					return numStoredTiles / max(duration_cast<duration<double>>(now - start).count(), 1e-3);
+				}
+
+				const vector<size> numTilesPerLevel;
+				vector<size> numStoredTilesPerLevel;
+				size numTiles;
+				size numStoredTiles;
+				size numReportedTiles;
+				const steady_clock::time_point start;
+				steady_clock::time_point lastReport;
+			};
+
+			// Builds the scheduled tiles in a pipeline of three stages: fetch threads render, receive or box filter the tiles, encode
+			// threads compress them and a writer thread stores them. The bounded queues between the stages throttle a stage to
+			// the pace of the next one, thus cpus and disk are busy at the same time while only a few tiles are held in memory.
+			void BuildTiles(TileBuildSchedule& schedule, BuildProgress& progress, const FetchTile& fetchTile)
+			{
+				// a fetch thread waits for a free job if the later stages fall behind, thus the jobs bound the tiles in flight
+				const size numJobs = desc.numFetchThreads + desc.numEncodeThreads + 2 * desc.maxQueuedTiles + 1;
+				utils::BoundedQueue<unique_ptr<TileJob>> freeJobs(numJobs);
+				for (size j = 0; j < numJobs; j++)
+				{
+					unique_ptr<TileJob> job(new TileJob());
+					freeJobs.Push(job);
+				}
+
+				utils::BoundedQueue<unique_ptr<TileJob>> encodeQueue(desc.maxQueuedTiles);
+				utils::BoundedQueue<unique_ptr<TileJob>> writeQueue(desc.maxQueuedTiles);
+
+				vector<thread> fetchThreads;
+				for (u32 t = 0; t < desc.numFetchThreads; t++)
+				{
+					fetchThreads.push_back(thread([&]
+					{
+						ScheduledTile scheduledTile;
+						while (schedule.NextTile(scheduledTile))
+						{
+							const TilePosition& position = scheduledTile.position;
+
+							unique_ptr<TileJob> job;
+							freeJobs.Pop(job);
+							job->position = position;
+							job->level = scheduledTile.level;
+							job->numFailures = scheduledTile.numFailures;
+							job->parentChildren = schedule.GetParentChildren(job->level, position);
+
+							// a tile which has been built on request meanwhile is only built again if its pixels are needed for a mip tile
+							ClaimTile(job->level, position);
+							if (!job->parentChildren && !IsToBeBuilt(GetFileStatus(position.x, position.y, job->level)))
+							{
+								ReleaseTile(job->level, position);
+								schedule.OnTileFinished(scheduledTile, true);
+								freeJobs.Push(job);
+								continue;
+							}
+							job->numInvalidations = numInvalidations;
+
+							bool isFetched = false;
+							try
+							{
+								isFetched = fetchTile(*job.get());
+							}
+							catch (...)
+							{
+								cout << "Tile Cache Error: " << "unknown error during tile retrieval" << endl;
+							}
+
+							if (!isFetched)
+							{
+								cout << "Tile Cache Error: failed to fetch tile (" << position.x << "," << position.y << ") of level " << job->level << "!" << endl;
+								ReleaseTile(job->level, position);
+								schedule.OnTileFinished(scheduledTile, false);
+								freeJobs.Push(job);
+								continue;
+							}
+
+							encodeQueue.Push(job);
+						}
+					}));
+				}
+
+				vector<thread> encodeThreads;
+				for (u32 t = 0; t < desc.numEncodeThreads; t++)
+				{
+					encodeThreads.push_back(thread([&]
+					{
+						utils::ElevationStreamEncoder encoder;
+
+						unique_ptr<TileJob> job;
+						while (encodeQueue.Pop(job))
+						{
+							bool isEncoded = false;
+							try
+							{
+								isEncoded = EncodeTile(*job.get(), encoder);
+							}
+							catch (...)
+							{
+								cout << "Tile Cache Error: " << "unknown error while encoding a tile" << endl;
+							}
+
+							if (!isEncoded)
+							{
+								cout << "Tile Cache Error: failed to encode tile (" << job->position.x << "," << job->position.y << ") of level " << job->level << "!" << endl;
+								ReleaseTile(job->level, job->position);
+								schedule.OnTileFinished({ job->position, job->level, job->numFailures }, false);
+								freeJobs.Push(job);
+								continue;
+							}
+
+							writeQueue.Push(job);
+						}
+					}));
+				}
+
+				thread writeThread([&]
+				{
+					unique_ptr<TileJob> job;
+					while (writeQueue.Pop(job))
+					{
+						const bool isStored = StoreCompressedTileToDisk(job->compressionBuffer.data(), job->compressedSize, job->position.x, job->position.y, job->level);
+						if (isStored)
+						{
+							SetBuiltFileStatus(*job.get());
+							progress.OnTileStored(job->level);
+						}
+						ReleaseTile(job->level, job->position);
+
+						schedule.OnTileFinished({ job->position, job->level, job->numFailures }, isStored);
+						freeJobs.Push(job);
+					}
+				});
+
+				// the fetch threads return once all tiles are stored or given up, the other stages drain their queues
+				for (auto& fetchThread : fetchThreads)
+				{
+					fetchThread.join();
+				}
+				encodeQueue.Close();
+				for (auto& encodeThread : encodeThreads)
+				{
+					encodeThread.join();
+				}
+				writeQueue.Close();
+				writeThread.join();
+
+				if (!statusIndex.Flush())
+				{
+					cout << "Tile Cache Error: writing the tile index failed" << endl;
+				}
+
+				progress.OnBuildFinished();
+			}
+
+			// a request of a coarser level is counted for all regions it covers, a mip tile is only built once they have been warmed
+			void CountTileRequest(int x, int y, int level)
+			{
+				const int numPriorityTilesX = GetNumTilesX(desc.priorityLevel);
+				if (level >= (int)desc.priorityLevel)
+				{
+					const int shift = level - desc.priorityLevel;
+					requestCounts[(y >> shift) * numPriorityTilesX + (x >> shift)].fetch_add(1, memory_order_relaxed);
+					return;
+				}
+
+				const int shift = desc.priorityLevel - level;
+				for (int py = y << shift; py < (y + 1) << shift; py++)
+				{
+					for (int px = x << shift; px < (x + 1) << shift; px++)
+					{
+						requestCounts[py * numPriorityTilesX + px].fetch_add(1, memory_order_relaxed);
+					}
+				}
+			}
+
+			// the served requests counted by an earlier run are stored next to the levels
+			path GetTileRequestsPath() const
+			{
+				path path = desc.storagePath;
+				path /= "tile_requests.txt";
+				return path;
+			}
+
+			// Adds the counts of a file with one "level x y count" per line to the tiles of the priority level, a count of a
+			// coarser level is added to all tiles it covers. Lines starting with # are skipped.
+			bool ReadTileCounts(const string& filename, vector<u32>& countsOut)
+			{
+				ifstream file(filename);
+				if (!file)
+				{
+					return false;
+				}
+
+				const int numPriorityTilesX = GetNumTilesX(desc.priorityLevel);
+
+				string line;
+				while (getline(file, line))
+				{
+					istringstream values(line);
+					int level, x, y;
+					u32 count;
+					if (line.empty() || line[0] == '#' || !(values >> level >> x >> y >> count) || !IsValidTile(x, y, level))
+					{
+						continue;
+					}
+
+					if (level >= (int)desc.priorityLevel)
+					{
+						const int shift = level - desc.priorityLevel;
+						countsOut[(y >> shift) * numPriorityTilesX + (x >> shift)] += count;
+						continue;
+					}
+
+					const int shift = desc.priorityLevel - level;
+					for (int py = y << shift; py < (y + 1) << shift; py++)
+					{
+						for (int px = x << shift; px < (x + 1) << shift; px++)
+						{
+							countsOut[py * numPriorityTilesX + px] += count;
+						}
+					}
+				}
+
+				return true;
+			}
+
+			bool LoadTilePriorities()
+			{
+				const size numPriorityTiles = (size)GetNumTilesX(desc.priorityLevel) * GetNumTilesY(desc.priorityLevel);
+				heatmapCounts.assign(numPriorityTiles, 0);
+				warmedPriorities.assign(numPriorityTiles, 0);
+
+				if (!desc.heatmapPath.empty() && !ReadTileCounts(desc.heatmapPath, heatmapCounts))
+				{
+					cout << "Tile Cache Error: reading the heatmap failed: " << desc.heatmapPath << endl;
+					return false;
+				}
+
+				vector<u32> storedRequestCounts(numPriorityTiles, 0);
+				ReadTileCounts(GetTileRequestsPath().string(), storedRequestCounts);
+
+				requestCounts.reset(new atomic<u32>[numPriorityTiles]);
+				for (size t = 0; t < numPriorityTiles; t++)
+				{
+					requestCounts[t] = storedRequestCounts[t];
+				}
+
+				return true;
+			}
+
+			// keeps the counted requests for the next run
+			void StoreTileRequests()
+			{
+				const int numPriorityTilesX = GetNumTilesX(desc.priorityLevel);
+				const int numPriorityTilesY = GetNumTilesY(desc.priorityLevel);
+
+				const string filename = GetTileRequestsPath().string();
+				const string tempFilename = filename + ".tmp";
+				{
+					ofstream file(tempFilename.c_str(), ios::out | ios::trunc);
+					file << "# level x y count\n";
+					for (int y = 0; y < numPriorityTilesY; y++)
+					{
+						for (int x = 0; x < numPriorityTilesX; x++)
 						{
-							try 
+							const u32 count = requestCounts[y * numPriorityTilesX + x].load(memory_order_relaxed);
+							if (count > 0)
 							{
-								retry = false;
+								file << desc.priorityLevel << " " << x << " " << y << " " << count << "\n";
+							}
+						}
+					}
+
+					file.close();
+					if (file.fail())
+					{
+						cout << "Tile Cache Error: writing the tile requests failed: " << tempFilename << endl;
+						return;
+					}
+				}
 
-								auto response = client->Request(tileRequestUri);
+				error_code err;
+				rename(tempFilename, filename, err);
+			}
 
-								if (response->GetStatusCode() != HTTP_OK)
-								{
-									cout << "Tile Cache Error: failed to receive tile (" << x << "," << y << ")! http return code: "  << response->GetStatusCode() << endl;
-									retry = true;
-									continue;
-								}
+			vector<u32> GetTilePriorities() const
+			{
+				vector<u32> priorities(heatmapCounts);
+				for (size t = 0; t < priorities.size(); t++)
+				{
+					priorities[t] += requestCounts[t].load(memory_order_relaxed);
+				}
+				return priorities;
+			}
+
+			// Looks at the finest stored tile covering the given tile, which is empty or has no elevation above sea level if the
+			// region is empty or ocean. A mip tile only has the mean elevation of its pixels, thus small islands are missed.
+			bool IsLikelyEmpty(int x, int y, int level)
+			{
+				for (; level >= 0; level--, x /= 2, y /= 2)
+				{
+					const u8 status = GetFileStatus(x, y, level);
+					if (status == FileStatus_Missing)
+					{
+						continue;
+					}
+
+					utils::ElevationStatistics statistics;
+					return status == FileStatus_Empty || (desc.cachedContentType == CT_Image_Elevation &&
+						FindTileStatistics(x, y, level, statistics) == HGTRR_OK && (statistics.numValidPixels == 0 || statistics.maxElevation <= 0));
+				}
+				return false;
+			}
+
+			// lists the failed tiles of a level in a text file next to its tiles (one "x y" per line), which is removed once there are none
+			void StoreFailedTiles(int level)
+			{
+				const vector<TilePosition>& failedTiles = levels.get()[level].failedTiles;
+
+				path path = desc.storagePath;
+				path /= utils::CreateZeroPaddedString(level, desc.numLevelDigits);
+				path /= "failed_tiles.txt";
+
+				if (failedTiles.empty())
+				{
+					error_code err;
+					remove(path, err);
+					return;
+				}
+
+				cout << "Tile Cache Error: " << failedTiles.size() << " tiles of level " << level << " failed, they are listed in " << path << endl;
+
+				ofstream file(path.string(), ios::out | ios::trunc);
+				for (const auto& tile : failedTiles)
+				{
+					file << tile.x << " " << tile.y << "\n";
+				}
+			}
+
+			// compresses the tile of job into its compression buffer, completely invalid tiles are replaced by an empty tile
+			bool EncodeTile(TileJob& job, utils::ElevationStreamEncoder& encoder)
+			{
+				if (!job.isRendered)
+				{
+					// a mip tile has been box filtered in the fetch stage
+					job.compressedSize = CompressTile(*job.tile.get(), job.level, job.compressionBuffer);
+					CopyRowsToParent(job, job.tile->rawData, 0, desc.tileHeight);
+				}
+				else if (desc.cachedContentType != CT_Image_Elevation)
+				{
+					// raw rows are stored as they arrive
+					const u32 RowsPerBand = 64;
+					const size rowSize = (size)desc.tileWidth * DataTypePixelSize[desc.dataType];
+					job.compressionBuffer.resize(rowSize * desc.tileHeight);
+
+					for (u32 row = 0; row < desc.tileHeight; row += RowsPerBand)
+					{
+						const int numRows = (int)min(RowsPerBand, desc.tileHeight - row);
+						const u8* band = job.source->ReadRows(numRows);
+						if (!band)
+						{
+							return false;
+						}
+
+						memcpy(&job.compressionBuffer[row * rowSize], band, numRows * rowSize);
+						CopyRowsToParent(job, band, row, numRows);
+					}
+
+					job.compressedSize = job.compressionBuffer.size();
+				}
+				else
+				{
+					// the rows of a remote tile are compressed band by band while the response body arrives
+					const utils::ElevationCompressionOptions options = GetCompressionOptions(job.level);
+					const size maxCompressedSize = utils::GetMaxCompressedElevationSize(desc.tileWidth, desc.tileHeight, options);
+					if (job.compressionBuffer.size() < maxCompressedSize)
+					{
+						job.compressionBuffer.resize(maxCompressedSize);
+					}
+
+					if (!encoder.Begin(desc.tileWidth, desc.tileHeight, desc.invalidValue, job.compressionBuffer.data(), job.compressionBuffer.size(), options))
+					{
+						return false;
+					}
+
+					for (u32 row = 0; row < desc.tileHeight; row += encoder.GetRowsPerBand())
+					{
+						const int numRows = (int)min((u32)encoder.GetRowsPerBand(), desc.tileHeight - row);
+						const u8* band = job.source->ReadRows(numRows);
+						if (!band)
+						{
+							return false;
+						}
+
+						encoder.PushRows((const s16*)band, numRows);
+						CopyRowsToParent(job, band, row, numRows);
+					}
+
+					job.compressedSize = encoder.Finish();
+				}
+
+				if (job.compressedSize == 0)
+				{
+					return false;
+				}
+
+				job.isEmpty = IsCompressedTileCompletelyInvalid(job.compressionBuffer.data(), job.compressedSize);
+				if (job.isEmpty)
+				{
+					Image emptyTile(0, 0, desc.dataType);
+					job.compressedSize = CompressTile(emptyTile, job.level, job.compressionBuffer);
+				}
+
+				return job.compressedSize > 0;
+			}
+
+			// keeps the decoded rows of the tile of job for the mip tile covering it, which is built next and would decode the tile otherwise
+			void CopyRowsToParent(const TileJob& job, const u8* rows, u32 firstRow, u32 numRows)
+			{
+				if (!job.parentChildren)
+				{
+					return;
+				}
+
+				const size rowSize = (size)desc.tileWidth * DataTypePixelSize[desc.dataType];
+				const size parentPitch = (size)job.parentChildren->width * DataTypePixelSize[desc.dataType];
+
+				u8* parentRow = &job.parentChildren->rawData[((job.position.y % 2) * desc.tileHeight + firstRow) * parentPitch + (job.position.x % 2) * rowSize];
+				for (u32 row = 0; row < numRows; row++)
+				{
+					memcpy(parentRow, rows, rowSize);
+
+					rows += rowSize;
+					parentRow += parentPitch;
+				}
+			}
+
+			void CreateTileCacheAsync()
+			{
+				for (;;)
+				{
+					CreateTileCache();
+
+					StoreTileRequests();
+
+					// invalidated tiles are built once the running build has finished, a read-through cache warms the regions requested meanwhile
+					unique_lock<mutex> lock(buildMutex);
+					if (desc.prebuild || desc.warmingInterval == 0)
+					{
+						buildRequested.wait(lock, [this] { return isBuildRequested || isStopRequested; });
+					}
+					else
+					{
+						buildRequested.wait_for(lock, seconds(desc.warmingInterval), [this] { return isBuildRequested || isStopRequested; });
+					}
+
+					if (isStopRequested)
+					{
+						return;
+					}
+					isBuildRequested = false;
+				}
+			}
+
+			// interleaves the bits of the coordinates, thus the four tiles covered by a mip tile follow each other on every level
+			static u64 GetZOrder(const TilePosition& position)
+			{
+				u64 zOrder = 0;
+				for (int bit = 0; bit < 24; bit++)
+				{
+					zOrder |= (u64)((position.x >> bit) & 1) << (bit * 2);
+					zOrder |= (u64)((position.y >> bit) & 1) << (bit * 2 + 1);
+				}
+				return zOrder;
+			}
+
+			// Builds the missing tiles of all levels in one pass. The tiles of the finest level are built in Z-order and a mip
+			// tile is built as soon as the four tiles it covers are stored, from their pixels which are still in memory. Thus every
+			// tile is decoded at most once. Tiles which fail for good leave the mip tiles covering them missing.
+			// The regions of the priority level are built by descending priority, regions which are likely empty or ocean are
+			// built last. A read-through cache only warms the regions which have been requested since its last build.
+			bool CreateTileCache()
+			{
+				const int finestLevel = desc.numLevels - 1;
+				TileBuildSchedule schedule(desc, desc.maxTileRetries, milliseconds(desc.initialRetryDelay));
+				vector<size> numTilesPerLevel(desc.numLevels, 0);
+
+				const vector<u32> priorities = GetTilePriorities();
+				const int priorityShift = finestLevel - desc.priorityLevel;
+				const int numPriorityTilesX = GetNumTilesX(desc.priorityLevel);
+				vector<u8> isRegionDeferred(priorities.size(), 2); // 2 until it is known
+
+				struct PrioritizedTile
+				{
+					TilePosition position;
+					bool isDeferred;
+					u32 priority;
+					u64 zOrder;
+				};
+
+				vector<PrioritizedTile> tiles;
+				for (int y = 0; y < GetNumTilesY(finestLevel); y++)
+				{
+					for (int x = 0; x < GetNumTilesX(finestLevel); x++)
+					{
+						const int region = (y >> priorityShift) * numPriorityTilesX + (x >> priorityShift);
+						if (!IsToBeBuilt(GetFileStatus(x, y, finestLevel)) || (!desc.prebuild && priorities[region] <= warmedPriorities[region]))
+						{
+							continue;
+						}
+
+						if (isRegionDeferred[region] == 2)
+						{
+							isRegionDeferred[region] = IsLikelyEmpty(x >> priorityShift, y >> priorityShift, desc.priorityLevel) ? 1 : 0;
+						}
+
+						tiles.push_back({ { x, y }, isRegionDeferred[region] != 0, priorities[region], GetZOrder({ x, y }) });
+					}
+				}
+
+				// the tiles of a region of the priority level are adjacent in Z-order, thus they stay together
+				sort(tiles.begin(), tiles.end(), [](const PrioritizedTile& a, const PrioritizedTile& b)
+				{
+					if (a.isDeferred != b.isDeferred) return b.isDeferred;
+					if (a.priority != b.priority) return a.priority > b.priority;
+					return a.zOrder < b.zOrder;
+				});
+				warmedPriorities = priorities;
+
+				vector<vector<bool>> isScheduled(desc.numLevels);
+				isScheduled[finestLevel].assign(GetNumTilesX(finestLevel) * GetNumTilesY(finestLevel), false);
+				for (const auto& tile : tiles)
+				{
+					schedule.AddTile(finestLevel, tile.position);
+					isScheduled[finestLevel][tile.position.y * GetNumTilesX(finestLevel) + tile.position.x] = true;
+				}
+				numTilesPerLevel[finestLevel] = tiles.size();
+
+				if (desc.tilePaddingLeft != 0 || desc.tilePaddingTop != 0 || desc.tilePaddingRight != 0 || desc.tilePaddingBottom != 0)
+				{
+					cout << "Tile Cache Error: " << "Cannot create Mip Levels for Tile Cache with padding yet" << endl;
+				}
+				else
+				{
+					// a mip tile is built if none of the four tiles it covers stays missing, otherwise it would lack their elevation for good
+					for (int level = finestLevel - 1; level >= 0; level--)
+					{
+						const int numTilesX = GetNumTilesX(level);
+						const int numTilesY = GetNumTilesY(level);
+						isScheduled[level].assign(numTilesX * numTilesY, false);
 
-								size readSize = response->ReadBody(tileImg.rawData, expectedTileSize);
-								if (readSize < expectedTileSize)
+						for (int y = 0; y < numTilesY; y++)
+						{
+							for (int x = 0; x < numTilesX; x++)
+							{
+								if (!IsToBeBuilt(GetFileStatus(x, y, level)))
 								{
-									cout << "Tile Cache Error: Cache Creation failed! Failed to receive valid tile (" << x << "," << y << ")!" << endl;
-									retry = true;
 									continue;
 								}
 
-								if (desc.invalidValue.IsSet() && utils::IsImageCompletelyInvalid(tileImg, desc.invalidValue))
+								int numChildren = 0;
+								bool isBuildable = true;
+								for (int child = 0; child < 4; child++)
 								{
-									if (StoreTileToDisk(emptyTile, x, y, desc.numLevels - 1))
+									const int childX = x * 2 + child % 2;
+									const int childY = y * 2 + child / 2;
+									if (IsToBeBuilt(GetFileStatus(childX, childY, level + 1)))
 									{
-										fileStatus.get()[y * desc.numTilesX + x] = FileStatus_Empty;
+										const bool isChildScheduled = isScheduled[level + 1][childY * numTilesX * 2 + childX];
+										numChildren += isChildScheduled ? 1 : 0;
+										isBuildable = isBuildable && isChildScheduled;
 									}
-									else
-									{
-										retry = true;
-										continue;
-									}
-								}
-								else if (StoreTileToDisk(tileImg, x, y, desc.numLevels - 1))
-								{
-									fileStatus.get()[y * desc.numTilesX + x] = FileStatus_Exists;
 								}
-								else
+
+								if (isBuildable)
 								{
-									retry = true;
-									continue;
+									schedule.AddMipTile(level, { x, y }, numChildren);
+									isScheduled[level][y * numTilesX + x] = true;
+									numTilesPerLevel[level]++;
 								}
 							}
-							catch (...)
-							{
-								cout << "Tile Cache Error: " << "unknown error during tile retrieval ... retrying" << std::endl;
-								retry = true;
-							}
-						} 
-						while (retry);
+						}
+					}
+				}
 
+				if (accumulate(numTilesPerLevel.begin(), numTilesPerLevel.end(), (size)0) == 0)
+				{
+					return true;
+				}
+
+				{
+					lock_guard<mutex> lock(buildMutex);
+					runningSchedule = &schedule;
+					if (isStopRequested)
+					{
+						schedule.Cancel();
 					}
 				}
-			}
 
-			void CreateTileCacheMipLevels()
-			{
-				if (desc.tilePaddingLeft != 0 || desc.tilePaddingTop != 0 || desc.tilePaddingRight != 0 || desc.tilePaddingBottom != 0)
+				BuildProgress progress(numTilesPerLevel);
+				BuildTiles(schedule, progress, [&](TileJob& job)
 				{
-					cout << "Tile Cache Error: " << "Cannot create Mip Levels for Tile Cache with padding yet" << endl;
-					return;
+					return (job.level == finestLevel) ? RequestSourceTile(job) : CreateMipTile(job, schedule);
+				});
+
+				{
+					lock_guard<mutex> lock(buildMutex);
+					runningSchedule = NULL;
 				}
 
-				Image emptyTile(0, 0, desc.dataType);
+				bool isComplete = true;
+				for (u32 level = 0; level < desc.numLevels; level++)
+				{
+					levels.get()[level].failedTiles = schedule.GetFailedTiles(level);
+					StoreFailedTiles(level);
+
+					isComplete = isComplete && levels.get()[level].failedTiles.empty();
+				}
+
+				return isComplete;
+			}
+
+			// a source may be unavailable for a while, its tiles are retried with increasing delays
+			bool RequestSourceTile(TileJob& job)
+			{
+				const double TileWidthInDegree = (360.0 / GetNumTilesX(job.level));
+				const double TileHeightInDegree = (180.0 / GetNumTilesY(job.level));
+				const double TilePaddingLeftInDegree = TileWidthInDegree * (desc.tilePaddingLeft / (double)desc.tileWidth);
+				const double TilePaddingRightInDegree = TileWidthInDegree * (desc.tilePaddingRight / (double)desc.tileWidth);
+				const double TilePaddingTopInDegree = TileHeightInDegree * (desc.tilePaddingTop / (double)desc.tileHeight);
+				const double TilePaddingBottomInDegree = TileHeightInDegree * (desc.tilePaddingBottom / (double)desc.tileHeight);
 
-				// All actions here are assumed to be done on disk locally. Therefore, any errors are fatal to the whole process of creating mip tiles.
+				if (!job.source)
+				{
+					job.source = CreateTileSource();
+				}
+				job.isRendered = true;
+
+				WebMapService::GetMapRequest gmr;
+				gmr.crs = "EPSG:4326";
+				gmr.width = desc.tileWidth;
+				gmr.height = desc.tileHeight;
+				gmr.dataType = desc.dataType;
+				gmr.bbox.minX = job.position.x * TileWidthInDegree - 180.0 - TilePaddingLeftInDegree;
+				gmr.bbox.maxY = -job.position.y * TileHeightInDegree + 90.0 + TilePaddingTopInDegree;
+				gmr.bbox.maxX = gmr.bbox.minX + TileWidthInDegree + TilePaddingRightInDegree;
+				gmr.bbox.minY = gmr.bbox.maxY - TileHeightInDegree - TilePaddingBottomInDegree;
+
+				return job.source->RequestTile(gmr);
+			}
 
-				bool keepRunning = true;
-				int level = desc.numLevels - 1;
-				int numTilesX = desc.numTilesX;
-				int numTilesY = desc.numTilesY;
-				while (level > 0 && keepRunning)
+			// box filters the four tiles of the next finer level which are covered by the tile of job, tiles of this build are
+			// still in memory if the mip tile holds them, only the others are loaded
+			bool CreateMipTile(TileJob& job, TileBuildSchedule& schedule)
+			{
+				if (!schedule.HoldsChildren(job.level))
 				{
-					level--;
-					numTilesX /= 2;
-					numTilesY /= 2;
+					unique_ptr<Image> higherLevelTiles(CreateMipChildren(desc));
+					return BoxFilterChildren(job, *higherLevelTiles.get(), 0);
+				}
 
-					const auto& fileStatus = levels.get()[level].fileStatus;
-					const auto& fileStatusHigherLOD = levels.get()[level + 1].fileStatus;
+				u8 deliveredChildren = 0;
+				Image& higherLevelTiles = *schedule.GetChildren(job.level, job.position, deliveredChildren);
+				return BoxFilterChildren(job, higherLevelTiles, deliveredChildren);
+			}
 
-					const int numPixelsX = desc.tileWidth * 2;
-					const int numPixelsY = desc.tileHeight * 2;
+			// higherLevelTiles holds the tiles which are flagged in deliveredChildren (bit y * 2 + x), the others are loaded
+			bool BoxFilterChildren(TileJob& job, Image& higherLevelTiles, u8 deliveredChildren)
+			{
+				const int higherLevel = job.level + 1;
 
-					for (int y = 0; y < numTilesY && keepRunning; y++)
+				for (int sy = 0; sy < 2; sy++)
+				{
+					for (int sx = 0; sx < 2; sx++)
 					{
-						cout << "Tile Cache Mip Level Generation: (Level: " << level << " Row: " << y << "/" << numTilesY << ")!" << "\r";
+						int higherLevelX = job.position.x * 2 + sx;
+						int higherLevelY = job.position.y * 2 + sy;
 
-						//#pragma omp parallel for
-						for (int x = 0; x < numTilesX; x++)
+						// an outdated tile is loaded as well, it is only outdated if it has been invalidated after it was built
+						const u8 status = GetFileStatus(higherLevelX, higherLevelY, higherLevel);
+						if ((deliveredChildren & (1 << (sy * 2 + sx))) || status == FileStatus_Missing || status == FileStatus_Empty)
 						{
-							if (!keepRunning)
-							{
-								break;
-							}
+							continue;
+						}
 
-							if (fileStatus.get()[y * numTilesX + x] != FileStatus_Missing)
-							{
-								continue;
-							}
+						shared_ptr<Image> subImg;
+						if (!LoadTileFromDisk(subImg, higherLevelX, higherLevelY, higherLevel))
+						{
+							return false;
+						}
 
-							Image higherLevel(numPixelsX, numPixelsY, desc.dataType);
-							SetTypedMemory(higherLevel.rawData, desc.invalidValue.IsSet() ? desc.invalidValue : desc.defaultValue, higherLevel.width * higherLevel.height);
+						if (subImg.get()->width == 0)
+						{
+							continue;
+						}
 
-							for (int sy = 0; sy < 2; sy++)
-							{
-								for (int sx = 0; sx < 2; sx++)
-								{
-									int higherLevelX = x * 2 + sx;
-									int higherLevelY = y * 2 + sy;
-									int higherLevelIndex = higherLevelY * (numTilesX * 2) + higherLevelX;
+						higherLevelTiles.CopyFromSubImage(*subImg.get(), desc.tileWidth * sx, desc.tileHeight * sy);
+					}
+				}
 
-									if (fileStatusHigherLOD.get()[higherLevelIndex] != FileStatus_Exists)
-									{
-										continue;
-									}
+				if (!job.tile)
+				{
+					job.tile.reset(new Image(desc.tileWidth, desc.tileHeight, desc.dataType));
+				}
+				utils::SampleWithBoxFilter(higherLevelTiles, *job.tile.get(), desc.invalidValue);
+				job.isRendered = false;
 
-									shared_ptr<Image> subImg;
-									if (!LoadTileFromDisk(subImg, higherLevelX, higherLevelY, level + 1))
-									{
-										keepRunning = false;
-										break;
-									}
+				return true;
+			}
 
-									if (subImg.get()->width == 0)
-									{
-										continue;
-									}
+			bool HasPadding() const
+			{
+				return desc.tilePaddingLeft != 0 || desc.tilePaddingTop != 0 || desc.tilePaddingRight != 0 || desc.tilePaddingBottom != 0;
+			}
 
-									higherLevel.CopyFromSubImage(*subImg.get(), desc.tileWidth * sx, desc.tileHeight * sy);
-								}
-							}
+			// A tile of the finest level is rendered by the source, a mip tile is box filtered from the four tiles it covers. The
+			// missing ones of them are built along with it down to depth levels, a mip tile which lacks tiles below that is left to
+			// the background build. The source cannot render the bbox of a coarse mip tile at once (e.g. QualityElevation).
+			bool IsBuildableOnRequest(int x, int y, int level, u32 depth) const
+			{
+				if (level == (int)desc.numLevels - 1 || HasPadding())
+				{
+					return true;
+				}
 
-							Image mipLevel(desc.tileWidth, desc.tileHeight, desc.dataType);
-							utils::SampleWithBoxFilter(higherLevel, mipLevel, desc.invalidValue);
+				for (int child = 0; child < 4; child++)
+				{
+					const int childX = x * 2 + child % 2;
+					const int childY = y * 2 + child / 2;
+					const u8 status = GetFileStatus(childX, childY, level + 1);
+					if (IsToBeBuilt(status) && (depth == 0 || !IsToBeBuiltOnRequest(status) || !IsBuildableOnRequest(childX, childY, level + 1, depth - 1)))
+					{
+						return false;
+					}
+				}
+				return true;
+			}
 
-							if (desc.invalidValue.IsSet() && utils::IsImageCompletelyInvalid(mipLevel, desc.invalidValue))
-							{
-								if (StoreTileToDisk(emptyTile, x, y, level))
-								{
-									fileStatus.get()[y * numTilesX + x] = FileStatus_Empty;
-								}
-								else
-								{
-									cout << "Tile Cache Error: Mip level tile creation failed. (" << x << "," << y << ")!" << endl;
-									keepRunning = false;
-									break;
-								}
-							}
-							else if (StoreTileToDisk(mipLevel, x, y, level))
-							{
-								fileStatus.get()[y * numTilesX + x] = FileStatus_Exists;
-							}
-							else
-							{
-								cout << "Tile Cache Error: Mip level tile creation failed. (" << x << "," << y << ")!" << endl;
-								keepRunning = false;
-								break;
-							}
-						}
+			// mip tiles of a cache with padding are rendered by the source, they cannot be box filtered
+			bool CreateMipTileOnRequest(TileJob& job, u32 depth)
+			{
+				if (HasPadding())
+				{
+					return RequestSourceTile(job);
+				}
+
+				for (int child = 0; child < 4; child++)
+				{
+					const int childX = job.position.x * 2 + child % 2;
+					const int childY = job.position.y * 2 + child / 2;
+					if (IsToBeBuilt(GetFileStatus(childX, childY, job.level + 1)) && depth > 0)
+					{
+						BuildTileOnRequest(childX, childY, job.level + 1, depth - 1);
+					}
+
+					// a tile which failed or which is outdated and left to the background build lacks the current source data
+					if (IsToBeBuilt(GetFileStatus(childX, childY, job.level + 1)))
+					{
+						return false;
+					}
+				}
+
+				unique_ptr<Image> higherLevelTiles(CreateMipChildren(desc));
+				return BoxFilterChildren(job, *higherLevelTiles.get(), 0);
+			}
+
+			// Builds a tile in the thread of the request, which waits if the tile is being built already. The tile is claimed before
+			// the tiles it covers, thus requests and the background build claim tiles in the same order.
+			bool BuildTileOnRequest(int x, int y, int level, u32 depth)
+			{
+				const TilePosition position = { x, y };
+				ClaimTile(level, position);
+
+				bool isStored = !IsToBeBuiltOnRequest(GetFileStatus(x, y, level)); // built by the request or build holding the tile before
+				if (!isStored)
+				{
+					TileJob job;
+					job.position = position;
+					job.level = level;
+					job.numFailures = 0;
+					job.parentChildren = NULL;
+					job.numInvalidations = numInvalidations;
+
+					try
+					{
+						utils::ElevationStreamEncoder encoder;
+
+						const bool isFetched = (level == (int)desc.numLevels - 1) ? RequestSourceTile(job) : CreateMipTileOnRequest(job, depth);
+						isStored = isFetched && EncodeTile(job, encoder) &&
+							StoreCompressedTileToDisk(job.compressionBuffer.data(), job.compressedSize, x, y, level);
+					}
+					catch (...)
+					{
+						cout << "Tile Cache Error: " << "unknown error while building a tile on request" << endl;
+					}
+
+					if (isStored)
+					{
+						SetBuiltFileStatus(job);
+					}
+					else
+					{
+						cout << "Tile Cache Error: failed to build tile (" << x << "," << y << ") of level " << level << " on request!" << endl;
 					}
 				}
+
+				ReleaseTile(level, position);
+				return isStored;
 			}
 		};
 
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "../dwcore.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace dw
+{
+	namespace utils
+	{
+		// Hands items from one stage of a pipeline to the next. Push blocks while the queue is full, which throttles the producing
+		// stage to the pace of the consuming one. After Close, Pop still returns the queued items and fails once the queue is empty.
+		template<typename T>
+		class BoundedQueue
+		{
+		public:
+			BoundedQueue(size capacity)
+				: capacity(capacity)
+				, isClosed(false)
+			{
+			}
+			BoundedQueue(const BoundedQueue&) = delete;
+
+			// returns false if the queue has been closed, item is not moved in that case
+			bool Push(T& item)
+			{
+				{
+					std::unique_lock<std::mutex> lock(queueMutex);
+					queueChanged.wait(lock, [this] { return isClosed || items.size() < capacity; });
+
+					if (isClosed)
+					{
+						return false;
+					}
+
+					items.push_back(std::move(item));
+				}
+				queueChanged.notify_all();
+				return true;
+			}
+
+			// waits for the next item, returns false if the queue has been closed and is empty
+			bool Pop(T& itemOut)
+			{
+				{
+					std::unique_lock<std::mutex> lock(queueMutex);
+					queueChanged.wait(lock, [this] { return isClosed || !items.empty(); });
+
+					if (items.empty())
+					{
+						return false;
+					}
+
+					itemOut = std::move(items.front());
+					items.pop_front();
+				}
+				queueChanged.notify_all();
+				return true;
+			}
+
+			void Close()
+			{
+				{
+					std::lock_guard<std::mutex> lock(queueMutex);
+					isClosed = true;
+				}
+				queueChanged.notify_all();
+			}
+
+			size GetSize() const
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				return items.size();
+			}
+
+		private:
+			const size capacity;
+
+			mutable std::mutex queueMutex;
+			std::condition_variable queueChanged; // signals both, free space and new items
+			std::deque<T> items;
+			bool isClosed;
+		};
+	}
+}
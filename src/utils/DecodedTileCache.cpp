@@ -0,0 +1,235 @@
+
+#include "DecodedTileCache.h"
+
+using namespace std;
+
+namespace dw
+{
+	namespace utils
+	{
+		DecodedTileCache::DecodedTileCache(size budgetInBytes)
+			: budgetInBytes(budgetInBytes)
+			, usedBytes(0)
+			, prefetchedBytes(0)
+			, hits(0)
+			, misses(0)
+			, evictions(0)
+			, prefetches(0)
+			, usefulPrefetches(0)
+			, wastedPrefetches(0)
+		{
+		}
+
+		DecodedTileCache::~DecodedTileCache()
+		{
+		}
+
+		DecodedTileCache::Tile DecodedTileCache::Acquire(Key key, const LoadTile& load)
+		{
+			if (!IsEnabled())
+			{
+				misses++;
+				shared_ptr<Image> tile;
+				return load(tile) ? tile : Tile();
+			}
+
+			unique_lock<mutex> lock(entriesMutex);
+			for (;;)
+			{
+				auto existingEntry = entries.find(key);
+				if (existingEntry == entries.end())
+				{
+					break;
+				}
+
+				if (!existingEntry->second.isLoading)
+				{
+					hits++;
+					Touch(existingEntry->second);
+					return existingEntry->second.tile;
+				}
+
+				// waiting for the prefetcher would make the request as slow as the prefetcher, thus the first request decodes the
+				// tile itself, later requests wait for either one
+				if (existingEntry->second.isPrefetched)
+				{
+					existingEntry->second.isPrefetched = false;
+					break;
+				}
+
+				loadFinished.wait(lock); // another request is decoding this tile right now
+			}
+
+			misses++;
+
+			return Load(key, load, lock, false);
+		}
+
+		DecodedTileCache::Tile DecodedTileCache::Find(Key key)
+		{
+			lock_guard<mutex> lock(entriesMutex);
+
+			auto entry = entries.find(key);
+			if (entry == entries.end() || entry->second.isLoading)
+			{
+				return Tile();
+			}
+
+			hits++;
+			Touch(entry->second);
+			return entry->second.tile;
+		}
+
+		bool DecodedTileCache::Prefetch(Key key, const LoadTile& load)
+		{
+			if (!IsEnabled())
+			{
+				return false;
+			}
+
+			unique_lock<mutex> lock(entriesMutex);
+
+			if (entries.find(key) != entries.end())
+			{
+				return false;
+			}
+
+			return Load(key, load, lock, true) != NULL;
+		}
+
+		DecodedTileCache::Statistics DecodedTileCache::GetStatistics() const
+		{
+			lock_guard<mutex> lock(entriesMutex);
+
+			Statistics stats;
+			stats.hits = hits;
+			stats.misses = misses;
+			stats.evictions = evictions;
+			stats.usedBytes = usedBytes;
+			stats.budgetInBytes = budgetInBytes;
+			stats.numTiles = (u32)entries.size();
+			stats.prefetches = prefetches;
+			stats.usefulPrefetches = usefulPrefetches;
+			stats.wastedPrefetches = wastedPrefetches;
+			stats.prefetchedBytes = prefetchedBytes;
+			return stats;
+		}
+
+		DecodedTileCache::Tile DecodedTileCache::Load(Key key, const LoadTile& load, unique_lock<mutex>& lock, bool isPrefetch)
+		{
+			if (entries.find(key) == entries.end())
+			{
+				Entry& newEntry = entries[key];
+				newEntry.isLoading = true;
+				newEntry.isPrefetched = isPrefetch;
+				newEntry.sizeInBytes = 0;
+				newEntry.numLoads = 0;
+				lru.push_front(key);
+				newEntry.lruPosition = lru.begin();
+			}
+			entries[key].numLoads++;
+
+			lock.unlock();
+
+			shared_ptr<Image> tile;
+			const bool loaded = load(tile) && tile;
+
+			lock.lock();
+
+			auto entry = entries.find(key); // entries which are loading are never evicted
+			assert(entry != entries.end());
+			entry->second.numLoads--;
+
+			if (!entry->second.isLoading)
+			{
+				// the other load of the tile finished first, the prefetch was not needed anymore
+				if (isPrefetch)
+				{
+					return Tile();
+				}
+
+				Touch(entry->second);
+				return entry->second.tile;
+			}
+
+			if (!loaded)
+			{
+				// the other load of the tile may still succeed
+				if (entry->second.numLoads == 0)
+				{
+					lru.erase(entry->second.lruPosition);
+					entries.erase(entry);
+					loadFinished.notify_all();
+				}
+				return Tile();
+			}
+
+			entry->second.tile = tile;
+			entry->second.sizeInBytes = tile->rawDataSize;
+			entry->second.isLoading = false;
+			usedBytes += tile->rawDataSize;
+
+			if (isPrefetch)
+			{
+				// a request decoding the tile as well is served by the prefetch
+				prefetches++;
+				if (entry->second.isPrefetched)
+				{
+					prefetchedBytes += tile->rawDataSize;
+				}
+				else
+				{
+					usefulPrefetches++;
+				}
+			}
+
+			EvictUnpinnedTiles(); // the new tile is pinned by us, thus it survives the eviction
+
+			loadFinished.notify_all();
+
+			return tile;
+		}
+
+		void DecodedTileCache::Touch(Entry& entry)
+		{
+			lru.splice(lru.begin(), lru, entry.lruPosition);
+
+			if (entry.isPrefetched)
+			{
+				entry.isPrefetched = false;
+				usefulPrefetches++;
+				prefetchedBytes -= entry.sizeInBytes;
+			}
+		}
+
+		void DecodedTileCache::EvictUnpinnedTiles()
+		{
+			auto candidate = lru.end();
+			while (usedBytes > budgetInBytes && candidate != lru.begin())
+			{
+				candidate--;
+
+				auto entry = entries.find(*candidate);
+				assert(entry != entries.end());
+
+				// nobody can pin a tile without holding the mutex, hence a use count of one is reliable here
+				if (entry->second.isLoading || entry->second.tile.use_count() > 1)
+				{
+					continue;
+				}
+
+				usedBytes -= entry->second.sizeInBytes;
+				evictions++;
+
+				if (entry->second.isPrefetched)
+				{
+					wastedPrefetches++;
+					prefetchedBytes -= entry->second.sizeInBytes;
+				}
+
+				candidate = lru.erase(candidate);
+				entries.erase(entry);
+			}
+		}
+	}
+}
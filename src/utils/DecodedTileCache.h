@@ -0,0 +1,97 @@
+#pragma once
+
+#include "ImageProcessor.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace dw
+{
+	namespace utils
+	{
+		// Memory budgeted LRU cache of decoded source tiles which is shared by all requests of a layer.
+		// A tile handed out by Acquire is pinned for as long as the caller holds on to the returned pointer,
+		// pinned tiles are never evicted. Concurrent misses of the same key are resolved by a single load, only a request
+		// missing a tile which is being prefetched decodes it as well, the prefetcher may run at a low priority.
+		class DecodedTileCache
+		{
+		public:
+			typedef u64 Key;
+			typedef std::shared_ptr<const Image> Tile;
+			typedef std::function<bool(std::shared_ptr<Image>& tileOut)> LoadTile;
+
+			struct Statistics
+			{
+				u64 hits;
+				u64 misses;
+				u64 evictions;
+				size usedBytes;
+				size budgetInBytes;
+				u32 numTiles;
+
+				u64 prefetches;
+				u64 usefulPrefetches;	// prefetched tiles which were acquired by a request later on
+				u64 wastedPrefetches;	// prefetched tiles which got evicted without ever being acquired
+				size prefetchedBytes;	// prefetched tiles not acquired yet
+
+				double GetHitRate() const { return (hits + misses) > 0 ? hits / (double)(hits + misses) : 0.0; }
+			};
+
+			DecodedTileCache(size budgetInBytes);
+			DecodedTileCache(const DecodedTileCache&) = delete;
+			~DecodedTileCache();
+
+			// Returns the cached tile of the given key or decodes it by calling load (outside of any lock).
+			// Returns NULL if load failed.
+			Tile Acquire(Key key, const LoadTile& load);
+
+			// Returns the cached tile of the given key without ever loading it. Returns NULL on a miss.
+			Tile Find(Key key);
+
+			// Speculatively loads the tile of the given key unless it is cached already.
+			// Returns true if the tile was loaded by this call.
+			bool Prefetch(Key key, const LoadTile& load);
+
+			bool IsEnabled() const { return budgetInBytes > 0; }
+
+			Statistics GetStatistics() const;
+
+		private:
+			struct Entry
+			{
+				std::shared_ptr<Image> tile;
+				std::list<Key>::iterator lruPosition;
+				size sizeInBytes;
+				bool isLoading;
+				bool isPrefetched; // not acquired since it was prefetched
+				u32 numLoads; // in flight, a prefetch and a request decoding the same tile, the first decoded tile is kept
+			};
+
+			// adds the entry unless it is loading already, caller must hold mutex
+			Tile Load(Key key, const LoadTile& load, std::unique_lock<std::mutex>& lock, bool isPrefetch);
+			void Touch(Entry& entry);
+			void EvictUnpinnedTiles(); // caller must hold mutex
+
+			const size budgetInBytes;
+			size usedBytes;
+			size prefetchedBytes;
+
+			mutable std::mutex entriesMutex;
+			std::condition_variable loadFinished;
+			std::unordered_map<Key, Entry> entries;
+			std::list<Key> lru; // most recently used first
+
+			std::atomic<u64> hits;
+			std::atomic<u64> misses;
+			std::atomic<u64> evictions;
+			std::atomic<u64> prefetches;
+			std::atomic<u64> usefulPrefetches;
+			std::atomic<u64> wastedPrefetches;
+		};
+	}
+}
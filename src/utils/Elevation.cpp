@@ -1,13 +1,24 @@
 
 
 #include <algorithm>
+#include <climits>
 #include <fstream>
+#include <memory>
 #include <vector>
 
 #include <ZFXMath.h>
 
 #include "Elevation.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DW_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 using namespace std;
 using namespace ZFXMath;
 
@@ -18,6 +29,7 @@ namespace dw
 	namespace utils
 	{
 		static const BigEndianU32 CompressedElevationModelFourCC = BigEndianU32::MakeFourCC('C', 'E', 'M', 1);  // version 1
+		static const BigEndianU32 CompressedElevationModelV2FourCC = BigEndianU32::MakeFourCC('C', 'E', 'M', 2);  // version 2
 
 		struct ElevationHeader
 		{
@@ -43,213 +55,262 @@ namespace dw
 		static const u8 ElevationFlag_RLE = 0xFE;
 		static const u8 ElevationFlag_RelativeBulk = 0xFF;
 		static const int MaxNumElementsPerRowSegment = (1 << (sizeof(u16) * 8)) - 1;
-		bool CompressElevation(Image& img, const Variant& invalidValue)
+
+		static inline u16 ReadBigEndianU16(const u8* data)
 		{
-			assert(img.rawDataType == DT_S16);
+			return (u16)((data[0] << 8) | data[1]);
+		}
+
+		static inline u32 ReadBigEndianU32(const u8* data)
+		{
+			return ((u32)data[0] << 24) | ((u32)data[1] << 16) | ((u32)data[2] << 8) | data[3];
+		}
 
-			img.processedDataSize = 0;
-			img.processedData = new u8[sizeof(ElevationHeader) + img.rawDataSize * 2 + img.height * sizeof(u32)];
+		static const int MaxNumElementsPerMergedRLESegment = 5; // RLE segments up to this length are cheaper as part of a neighboring relative bulk segment
 
-			s16* elevation = (s16*)img.rawData;
-			u8* compressedElevation = img.processedData + sizeof(ElevationHeader) + img.height * sizeof(u32);
-			u8* compressedElevationRowOffset = img.processedData + sizeof(ElevationHeader);
+		// worst case are five bytes per element (single element RLE segments) plus the header of a short bulk segment at the end
+		static size MaxCompressedElevationRowSize(int width)
+		{
+			return (size)width * 5 + 3;
+		}
 
-			ElevationHeader header(CompressedElevationModelFourCC, img.width, img.height);
+		static size MaxCompressedElevationV1Size(int width, int height)
+		{
+			return sizeof(ElevationHeader) + (size)height * (sizeof(u32) + MaxCompressedElevationRowSize(width));
+		}
 
-			img.processedData[0] = header.fourCC.b3;
-			img.processedData[1] = header.fourCC.b2;
-			img.processedData[2] = header.fourCC.b1;
-			img.processedData[3] = header.fourCC.b0;
+		// Finds the segment starting at elevation, a run of equal values (RLE) or of differing values (relative bulk).
+		// Returns the end of the segment.
+		static const s16* FindRowSegment(const s16* elevation, const s16* elevationRowEnd, RowSegment& segment)
+		{
+			segment.flag = 0;
+			segment.numElements = 1;
+			segment.startValue = *elevation;
 
-			img.processedData[4] = header.width.b3;
-			img.processedData[5] = header.width.b2;
-			img.processedData[6] = header.width.b1;
-			img.processedData[7] = header.width.b0;
+			s16 lastValue = *elevation;
+			elevation++;
+			while (elevation < elevationRowEnd && segment.numElements < MaxNumElementsPerRowSegment)
+			{
+				const s16 value = *elevation;
+				const u8 flag = (value == lastValue) ? ElevationFlag_RLE : ElevationFlag_RelativeBulk;
+				if (segment.flag == 0)
+				{
+					segment.flag = flag;
+				}
+				else if (segment.flag != flag)
+				{
+					if (segment.flag == ElevationFlag_RelativeBulk &&
+						flag == ElevationFlag_RLE) // we switch to RLE which means we already consumed a value which belongs to the new RLE segment
+					{
+						elevation--;
+						segment.numElements--;
+					}
+					break;
+				}
 
-			img.processedData[8] = header.height.b3;
-			img.processedData[9] = header.height.b2;
-			img.processedData[10] = header.height.b1;
-			img.processedData[11] = header.height.b0;
+				lastValue = value;
+				segment.numElements++;
+				elevation++;
+			}
 
-			vector<RowSegment> segments(img.width / 2);
-			for (int y = 0; y < img.height; y++)
+			if (segment.numElements == 1)
 			{
-				BigEndianU32 offset((u32)(compressedElevation - img.processedData));
-				compressedElevationRowOffset[y * 4 + 0] = offset.b3;
-				compressedElevationRowOffset[y * 4 + 1] = offset.b2;
-				compressedElevationRowOffset[y * 4 + 2] = offset.b1;
-				compressedElevationRowOffset[y * 4 + 3] = offset.b0;
+				segment.flag = ElevationFlag_RLE;
+			}
 
-				segments.clear();
+			return elevation;
+		}
 
-				// approximate segments to consider
-				s16* elevationRow = elevation;
-				const s16* elevationRowEnd = elevation + img.width;
-				while (elevation < elevationRowEnd)
-				{
-					RowSegment segment;
-					segment.flag = 0;
-					segment.numElements = 1;
+		static u8* WriteRowSegment(const RowSegment& segment, const s16* elevation, u8* compressedElevation)
+		{
+			BigEndianU16 length(segment.numElements);
 
-					bool hasLastValue = false;
-					s16 lastValue = 0;
-					while (elevation < elevationRowEnd)
-					{
-						s16 value = *elevation;
+			compressedElevation[0] = segment.flag;
+			compressedElevation[1] = length.h;
+			compressedElevation[2] = length.l;
+			compressedElevation += 3;
 
-						if (!hasLastValue)
-						{
-							lastValue = value;
-							hasLastValue = true;
-							segment.startValue = value;
-						}
-						else
-						{
-							u8 flag = (value == lastValue) ? ElevationFlag_RLE : ElevationFlag_RelativeBulk;
-							if (segment.flag == 0)
-							{
-								segment.flag = flag;
-							}
-							else if (segment.flag != flag)
-							{
-								if (segment.flag == ElevationFlag_RelativeBulk &&
-									flag == ElevationFlag_RLE) // we switch to RLE which means we already consumed a value which belongs to the new RLE segment
-								{
-									elevation--;
-									segment.numElements--;
-								}
-								break;
-							}
+			if (segment.flag == ElevationFlag_RLE)
+			{
+				BigEndianU16 value(segment.startValue);
 
-							lastValue = value;
-							segment.numElements++;
-						}
+				compressedElevation[0] = value.h;
+				compressedElevation[1] = value.l;
 
-						elevation++;
+				return compressedElevation + 2;
+			}
 
-						if (segment.numElements == MaxNumElementsPerRowSegment)
-						{
-							break;
-						}
-					}
+			const s16* elevationSegmentEnd = elevation + segment.numElements;
+			while (elevation < elevationSegmentEnd)
+			{
+				const s16* elevationSubSegmentStart = elevation;
+
+				s16 min = *elevation;
+				s16 max = min;
 
-					if (segment.numElements == 1)
+				elevation++;
+				while (elevation < elevationSegmentEnd)
+				{
+					s16 value = *elevation;
+					s16 newMin = Min(min, value);
+					s16 newMax = Max(max, value);
+
+					if (newMax - newMin >= ElevationFlag_RelativeBulk)
 					{
-						segment.flag = ElevationFlag_RLE;
+						break;
 					}
 
-					segments.push_back(segment);
+					min = newMin;
+					max = newMax;
+					elevation++;
 				}
 
-				// remove small RLE segments as they better off to be merged with their relative offset neighbor segments
-				for (int s = (int)segments.size() - 1; s >= 0; s--)
+				BigEndianU16 reference(min);
+				compressedElevation[0] = ElevationFlag_RelativeBulk;
+				compressedElevation[1] = reference.h;
+				compressedElevation[2] = reference.l;
+				compressedElevation += 3;
+
+				const s16* elevationSubSegmentEnd = elevation;
+				elevation = elevationSubSegmentStart;
+				while (elevation < elevationSubSegmentEnd)
 				{
-					RowSegment& segment = segments[s];
+					*compressedElevation = (u8)(*elevation - min);
+					compressedElevation++;
+					elevation++;
+				}
+			}
 
-					if (segment.flag != ElevationFlag_RLE ||
-						segment.numElements > 5 ||
-						(invalidValue.IsSet() && (segment.startValue == invalidValue.GetValue().sint16[0])))
-					{
-						continue;
-					}
+			return compressedElevation;
+		}
 
-					// merge into next segment
-					if (s < segments.size() - 2 && segments[s + 1].flag == ElevationFlag_RelativeBulk)
-					{
-						segments[s + 1].numElements += segment.numElements;
-						segments.erase(segments.begin() + s);
-					}
+		// Encodes a single row and returns the end of its compressed data. A compressed row never exceeds MaxCompressedElevationRowSize.
+		// Segments are merged in a single pass: short RLE segments (except runs of the invalid value) join their relative bulk neighbors
+		// and adjacent relative bulk segments share one header, as long as the merged segment does not exceed MaxNumElementsPerRowSegment.
+		static u8* CompressElevationRow(const s16* elevation, int width, const Variant& invalidValue, u8* compressedElevation)
+		{
+			const s16* elevationRowEnd = elevation + width;
 
-					// merge into previous segment
-					if (s > 0 && segments[s - 1].flag == ElevationFlag_RelativeBulk)
-					{
-						segments[s - 1].numElements += segments[s].numElements;
-						segments.erase(segments.begin() + s);
+			RowSegment pending; // the last segment, which may still grow by merging the next one
+			const s16* pendingElevation = NULL;
+			bool isPendingMergeable = false;
 
-						if (s < segments.size()) // reevaluate next segment
-						{
-							s++;
-						}
+			while (elevation < elevationRowEnd)
+			{
+				RowSegment segment;
+				const s16* segmentEnd = FindRowSegment(elevation, elevationRowEnd, segment);
+
+				const bool isMergeable = segment.flag == ElevationFlag_RelativeBulk ||
+					(segment.numElements <= MaxNumElementsPerMergedRLESegment && !(invalidValue.IsSet() && segment.startValue == invalidValue.GetValue().sint16[0]));
+
+				if (pendingElevation && isPendingMergeable && isMergeable &&
+					(pending.flag == ElevationFlag_RelativeBulk || segment.flag == ElevationFlag_RelativeBulk) &&
+					pending.numElements + segment.numElements <= MaxNumElementsPerRowSegment)
+				{
+					pending.flag = ElevationFlag_RelativeBulk;
+					pending.numElements += segment.numElements;
+				}
+				else
+				{
+					if (pendingElevation)
+					{
+						compressedElevation = WriteRowSegment(pending, pendingElevation, compressedElevation);
 					}
+					pending = segment;
+					pendingElevation = elevation;
+					isPendingMergeable = isMergeable;
 				}
 
-				elevation = elevationRow;
-				for (size_t s = 0; s < segments.size(); s++)
-				{
-					RowSegment& segment = segments[s];
+				elevation = segmentEnd;
+			}
 
-					BigEndianU16 length(segment.numElements);
+			if (pendingElevation)
+			{
+				compressedElevation = WriteRowSegment(pending, pendingElevation, compressedElevation);
+			}
 
-					compressedElevation[0] = segment.flag;
-					compressedElevation[1] = length.h;
-					compressedElevation[2] = length.l;
-					compressedElevation += 3;
+			return compressedElevation;
+		}
 
-					if (segment.flag == ElevationFlag_RLE)
-					{
-						BigEndianU16 value(segment.startValue);
+		static inline void WriteRowOffset(u8* compressedElevationRowOffset, int y, size offset)
+		{
+			BigEndianU32 rowOffset((u32)offset);
+			compressedElevationRowOffset[y * 4 + 0] = rowOffset.b3;
+			compressedElevationRowOffset[y * 4 + 1] = rowOffset.b2;
+			compressedElevationRowOffset[y * 4 + 2] = rowOffset.b1;
+			compressedElevationRowOffset[y * 4 + 3] = rowOffset.b0;
+		}
+
+		// compressedElevation has to hold MaxCompressedElevationV1Size bytes, returns the compressed size
+		static size CompressElevationV1(const Image& img, const Variant& invalidValue, u8* compressedElevation)
+		{
+			assert(img.rawDataType == DT_S16);
 
-						compressedElevation[0] = value.h;
-						compressedElevation[1] = value.l;
+			ElevationHeader header(CompressedElevationModelFourCC, img.width, img.height);
 
-						compressedElevation += 2;
+			compressedElevation[0] = header.fourCC.b3;
+			compressedElevation[1] = header.fourCC.b2;
+			compressedElevation[2] = header.fourCC.b1;
+			compressedElevation[3] = header.fourCC.b0;
 
-						elevation += segment.numElements;
-					}
-					else if (segment.flag == ElevationFlag_RelativeBulk)
-					{
-						s16* elevationSegmentStart = elevation;
-						s16* elevationSegmentEnd = elevation + segment.numElements;
+			compressedElevation[4] = header.width.b3;
+			compressedElevation[5] = header.width.b2;
+			compressedElevation[6] = header.width.b1;
+			compressedElevation[7] = header.width.b0;
 
-						while (elevation < elevationSegmentEnd)
-						{
-							s16* elevationSubSegmentStart = elevation;
+			compressedElevation[8] = header.height.b3;
+			compressedElevation[9] = header.height.b2;
+			compressedElevation[10] = header.height.b1;
+			compressedElevation[11] = header.height.b0;
 
-							s16 min = *elevation;
-							s16 max = min;
+			// Rows are encoded in parallel blocks. The position of a row within the output is known only after the sizes of all previous
+			// rows are known, thus each block is encoded into its worst case slot of the output first and moved to its place afterwards.
+			const int RowsPerBlock = 16;
+			const int numBlocks = (img.height + RowsPerBlock - 1) / RowsPerBlock;
+			const size maxCompressedRowSize = MaxCompressedElevationRowSize(img.width);
+			const size compressedDataOffset = sizeof(ElevationHeader) + img.height * sizeof(u32);
 
-							elevation++;
-							while (elevation < elevationSegmentEnd)
-							{
-								s16 value = *elevation;
-								s16 newMin = Min(min, value);
-								s16 newMax = Max(max, value);
-
-								if (newMax - newMin >= ElevationFlag_RelativeBulk)
-								{
-									break;
-								}
-
-								min = newMin;
-								max = newMax;
-								elevation++;
-							}
+			u8* compressedElevationRowOffset = compressedElevation + sizeof(ElevationHeader);
 
-							BigEndianU16 reference(min);
-							compressedElevation[0] = ElevationFlag_RelativeBulk;
-							compressedElevation[1] = reference.h;
-							compressedElevation[2] = reference.l;
-							compressedElevation += 3;
+			#pragma omp parallel for schedule(dynamic) if(numBlocks > 1)
+			for (int b = 0; b < numBlocks; b++)
+			{
+				const int startY = b * RowsPerBlock;
+				const int endY = min(startY + RowsPerBlock, img.height);
 
-							s16* elevationSubSegmentEnd = elevation;
-							elevation = elevationSubSegmentStart;
-							while (elevation < elevationSubSegmentEnd)
-							{
-								*compressedElevation = (u8)(*elevation - min);
-								compressedElevation++;
-								elevation++;
-							}
-						}
-					}
+				// the row offset table holds the row sizes until the blocks are moved
+				u8* compressedBlock = compressedElevation + compressedDataOffset + startY * maxCompressedRowSize;
+				for (int y = startY; y < endY; y++)
+				{
+					const s16* elevation = &((const s16*)img.rawData)[y * img.width];
+					u8* compressedRowEnd = CompressElevationRow(elevation, img.width, invalidValue, compressedBlock);
+					WriteRowOffset(compressedElevationRowOffset, y, compressedRowEnd - compressedBlock);
+					compressedBlock = compressedRowEnd;
 				}
 			}
 
-			img.processedDataSize = (compressedElevation - img.processedData);
+			// blocks only move towards the front, thus no block overwrites a slot which has not been moved yet
+			size compressedDataSize = compressedDataOffset;
+			for (int b = 0; b < numBlocks; b++)
+			{
+				const int startY = b * RowsPerBlock;
+				const int endY = min(startY + RowsPerBlock, img.height);
 
-			return true;
+				const size blockOffset = compressedDataSize;
+				for (int y = startY; y < endY; y++)
+				{
+					const size rowSize = ReadBigEndianU32(compressedElevationRowOffset + y * sizeof(u32));
+					WriteRowOffset(compressedElevationRowOffset, y, compressedDataSize);
+					compressedDataSize += rowSize;
+				}
+
+				memmove(compressedElevation + blockOffset, compressedElevation + compressedDataOffset + startY * maxCompressedRowSize, compressedDataSize - blockOffset);
+			}
+
+			return compressedDataSize;
 		}
 
-		bool DecompressElevation(Image& img)
+		bool DecompressElevationReference(Image& img)
 		{
 			u8* header = img.processedData;
 			BigEndianU32 fourCC(header[0], header[1], header[2], header[3]);
@@ -330,6 +391,1397 @@ namespace dw
 			return true;
 		}
 
+		static inline int CountTrailingZeros(u32 mask)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return (int)index;
+#else
+			return __builtin_ctz(mask);
+#endif
+		}
+
+		static inline void FillElevation(s16* dst, s16 value, int count)
+		{
+			int e = 0;
+#if DW_SSE2
+			const __m128i values = _mm_set1_epi16(value);
+			for (; e + 8 <= count; e += 8)
+			{
+				_mm_storeu_si128((__m128i*)&dst[e], values);
+			}
+#endif
+			for (; e < count; e++)
+			{
+				dst[e] = value;
+			}
+		}
+
+		// Compressed images are untrusted input, their size is limited before anything gets allocated for them.
+		// The encoder refuses larger images, thus everything it writes can be decoded again.
+		static const u64 MaxCompressedElevationPixels = 1 << 28;
+
+		static bool IsValidCompressedElevationSize(u32 width, u32 height)
+		{
+			return width <= INT_MAX && height <= INT_MAX && (u64)width * height <= MaxCompressedElevationPixels;
+		}
+
+		// Decodes numElements bytes of a relative bulk segment. Data bytes never equal ElevationFlag_RelativeBulk,
+		// thus a 0xFF in the stream always starts a new sub segment with a new reference value.
+		// Returns NULL if the segment exceeds srcEnd.
+		static inline const u8* DecodeRelativeBulk(const u8* src, const u8* srcEnd, s16* dst, int numElements)
+		{
+			s16 referenceValue = 0;
+			int e = 0;
+			while (e < numElements)
+			{
+				if (src >= srcEnd) return NULL;
+				if (src[0] == ElevationFlag_RelativeBulk)
+				{
+					if (srcEnd - src < 3) return NULL;
+					referenceValue = (s16)ReadBigEndianU16(src + 1);
+					src += 3;
+				}
+
+#if DW_SSE2
+				// widen 16 bytes at once until the next sub segment header shows up
+				const __m128i references = _mm_set1_epi16(referenceValue);
+				const __m128i zero = _mm_setzero_si128();
+				const __m128i escape = _mm_set1_epi8((char)ElevationFlag_RelativeBulk);
+				while (numElements - e >= 16 && srcEnd - src >= 16)
+				{
+					const __m128i bytes = _mm_loadu_si128((const __m128i*)src);
+					const u32 escapeMask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, escape));
+					if (escapeMask)
+					{
+						const int numDataBytes = CountTrailingZeros(escapeMask);
+						for (int b = 0; b < numDataBytes; b++)
+						{
+							dst[e + b] = referenceValue + src[b];
+						}
+						src += numDataBytes;
+						e += numDataBytes;
+						break;
+					}
+
+					_mm_storeu_si128((__m128i*)&dst[e], _mm_add_epi16(_mm_unpacklo_epi8(bytes, zero), references));
+					_mm_storeu_si128((__m128i*)&dst[e + 8], _mm_add_epi16(_mm_unpackhi_epi8(bytes, zero), references));
+					src += 16;
+					e += 16;
+				}
+				if (numElements - e >= 16 && srcEnd - src >= 16)
+				{
+					continue; // a new sub segment starts
+				}
+#endif
+				// tail of the segment
+				while (e < numElements && src < srcEnd && src[0] != ElevationFlag_RelativeBulk)
+				{
+					dst[e] = referenceValue + src[0];
+					src++;
+					e++;
+				}
+			}
+			return src;
+		}
+
+		// Skips numElements bytes of a relative bulk segment without decoding them, returns NULL if the segment exceeds srcEnd
+		static inline const u8* SkipRelativeBulk(const u8* src, const u8* srcEnd, int numElements)
+		{
+			int e = 0;
+			while (e < numElements)
+			{
+				if (src >= srcEnd) return NULL;
+				if (src[0] == ElevationFlag_RelativeBulk)
+				{
+					if (srcEnd - src < 3) return NULL;
+					src += 3;
+				}
+
+				const size numBytes = min((size)(numElements - e), (size)(srcEnd - src));
+				const u8* nextHeader = (const u8*)memchr(src, ElevationFlag_RelativeBulk, numBytes);
+				const int numDataBytes = nextHeader ? (int)(nextHeader - src) : (int)numBytes;
+				src += numDataBytes;
+				e += numDataBytes;
+			}
+			return src;
+		}
+
+		// Reads the header of a version 1 image and checks that its row offset table fits into the compressed data
+		static bool ReadElevationV1Header(const Image& img, u32& widthOut, u32& heightOut)
+		{
+			if (img.processedDataSize < sizeof(ElevationHeader) || ReadBigEndianU32(img.processedData) != CompressedElevationModelFourCC.value)
+			{
+				return false;
+			}
+
+			widthOut = ReadBigEndianU32(img.processedData + 4);
+			heightOut = ReadBigEndianU32(img.processedData + 8);
+
+			return IsValidCompressedElevationSize(widthOut, heightOut) && sizeof(ElevationHeader) + (size)heightOut * sizeof(u32) <= img.processedDataSize;
+		}
+
+		// Decodes the segments of row y which overlap the columns [left, right) into row, which has to hold the whole row.
+		// Segments left of the window are skipped, decoding stops at the first segment right of it. Returns false if the row is corrupt.
+		static bool DecompressElevationRow(const Image& img, int width, int y, int left, int right, s16* row)
+		{
+			const u8* compressedEnd = img.processedData + img.processedDataSize;
+			const size rowOffset = ReadBigEndianU32(img.processedData + sizeof(ElevationHeader) + sizeof(u32) * y);
+			if (rowOffset >= img.processedDataSize)
+			{
+				return false;
+			}
+
+			const u8* rowDataCompressed = img.processedData + rowOffset;
+			int x = 0;
+			while (x < right)
+			{
+				if (compressedEnd - rowDataCompressed < 3) return false;
+				const u8 elevationFlag = rowDataCompressed[0];
+				const int numElements = ReadBigEndianU16(rowDataCompressed + 1);
+				rowDataCompressed += 3;
+
+				if (x + numElements > width)
+				{
+					return false;
+				}
+
+				const bool overlapsWindow = x + numElements > left;
+				if (elevationFlag == ElevationFlag_RLE)
+				{
+					if (compressedEnd - rowDataCompressed < 2) return false;
+					if (overlapsWindow)
+					{
+						FillElevation(&row[x], (s16)ReadBigEndianU16(rowDataCompressed), numElements);
+					}
+					rowDataCompressed += 2;
+				}
+				else if (elevationFlag == ElevationFlag_RelativeBulk)
+				{
+					rowDataCompressed = overlapsWindow ?
+						DecodeRelativeBulk(rowDataCompressed, compressedEnd, &row[x], numElements) :
+						SkipRelativeBulk(rowDataCompressed, compressedEnd, numElements);
+					if (!rowDataCompressed) return false;
+				}
+				else
+				{
+					return false;
+				}
+
+				x += numElements;
+			}
+
+			return true;
+		}
+
+		static bool DecompressElevationV1(Image& img)
+		{
+			u32 width, height;
+			if (!ReadElevationV1Header(img, width, height))
+			{
+				return false;
+			}
+
+			img.AllocateRawData(width, height, DT_S16);
+
+			s16* imgDataRaw = (s16*)img.rawData;
+
+			// every row is addressed by the offset table, thus rows are decoded in parallel
+			const int RowsPerBlock = 16;
+			const int numBlocks = (img.height + RowsPerBlock - 1) / RowsPerBlock;
+			bool isCorrupt = false;
+
+			#pragma omp parallel for schedule(dynamic) if(numBlocks > 1)
+			for (int b = 0; b < numBlocks; b++)
+			{
+				const int endY = min((b + 1) * RowsPerBlock, img.height);
+				for (int y = b * RowsPerBlock; y < endY; y++)
+				{
+					if (!DecompressElevationRow(img, img.width, y, 0, img.width, &imgDataRaw[(size)y * img.width]))
+					{
+						isCorrupt = true; // written by any thread, but only ever set to true
+					}
+				}
+			}
+
+			return !isCorrupt;
+		}
+
+		static bool DecompressElevationV1Window(Image& img, int left, int top, int width, int height)
+		{
+			u32 sourceWidth, sourceHeight;
+			if (!ReadElevationV1Header(img, sourceWidth, sourceHeight))
+			{
+				return false;
+			}
+
+			if (left < 0 || top < 0 || width <= 0 || height <= 0 || (u32)(left + width) > sourceWidth || (u32)(top + height) > sourceHeight)
+			{
+				return false;
+			}
+
+			img.AllocateRawData(width, height, DT_S16);
+
+			s16* imgDataRaw = (s16*)img.rawData;
+
+			const int RowsPerBlock = 16;
+			const int numBlocks = (height + RowsPerBlock - 1) / RowsPerBlock;
+			bool isCorrupt = false;
+
+			#pragma omp parallel if(numBlocks > 1)
+			{
+				vector<s16> row(sourceWidth);
+
+				#pragma omp for schedule(dynamic)
+				for (int b = 0; b < numBlocks; b++)
+				{
+					const int endY = min((b + 1) * RowsPerBlock, height);
+					for (int y = b * RowsPerBlock; y < endY; y++)
+					{
+						if (!DecompressElevationRow(img, (int)sourceWidth, top + y, left, left + width, row.data()))
+						{
+							isCorrupt = true;
+							continue;
+						}
+						memcpy(&imgDataRaw[y * width], &row[left], width * sizeof(s16));
+					}
+				}
+			}
+
+			return !isCorrupt;
+		}
+
+		// CEM version 2
+		//
+		// header:	fourCC, width, height (u32), flags (u16), invalid value (s16), rows per band (u16), columns per chunk (u16), all big endian,
+		//			[max error (u16), reserved (u16) if ElevationV2Flag_Quantized is set], followed by the big endian u32 offset of each chunk,
+		//			chunks of a band from left to right, bands from top to bottom
+		// chunk:	bands are split into chunks of columns per chunk columns (a multiple of ElevationV2BlockSize, zero keeps a band in one
+		//			chunk). Each pixel is predicted from the plane through its left, upper and upper left neighbor (left + above - aboveLeft,
+		//			missing neighbors count as zero), the prediction restarts in every chunk so chunks decode independently. Each block
+		//			of ElevationV2BlockSize pixels of a row stores the zigzag encoded residuals of its valid pixels bit packed with
+		//			the width of the largest one. All arithmetic wraps around at 16 bits.
+		// block:	u8 header (residual width in bits 0-4, ElevationV2Block_Lossless, ElevationV2Block_HasInvalidMask, ElevationV2Block_AllInvalid),
+		//			[little endian u32 mask of invalid pixels], residuals packed least significant bit first
+		// Invalid pixels carry no residual, their prediction takes their place as neighbor of the following pixels.
+		// Quantized images store residuals divided by 2 * max error + 1 (rounded to the nearest multiple), the encoder predicts from the
+		// reconstructed pixels, thus the error of a valid pixel never exceeds max error and does not accumulate. Invalid pixels stay exact.
+		// Blocks with valid pixels within max error of the s16 range or of the invalid value are stored losslessly, otherwise their
+		// reconstruction could wrap around or turn into the invalid value.
+
+		struct ElevationV2Header
+		{
+			u32 width;
+			u32 height;
+			u16 flags;
+			s16 invalidValue;
+			u16 rowsPerBand;
+			u16 columnsPerChunk;
+			u16 maxError;
+		};
+
+		static const size ElevationV2HeaderSize = 20;
+		static const size ElevationV2QuantizationSize = 4;
+		static const u16 ElevationV2Flag_HasInvalidValue = 0x1;
+		static const u16 ElevationV2Flag_Quantized = 0x2;
+		static const u16 ElevationV2Flag_HasStatistics = 0x4;
+		static const size ElevationV2StatisticsSize = 16; // min, max, number of valid pixels and their sum, behind the quantization
+		static const int ElevationV2MaxError = 4095;
+		static const int ElevationV2RowsPerBand = 16;
+		static const int ElevationV2BlockSize = 32;
+		static const int ElevationV2MaxResidualWidth = 16;
+		static const u8 ElevationV2Block_WidthMask = 0x1F;
+		static const u8 ElevationV2Block_Lossless = 0x20;
+		static const u8 ElevationV2Block_HasInvalidMask = 0x40;
+		static const u8 ElevationV2Block_AllInvalid = 0x80;
+
+		static inline void WriteBigEndianU16(u8* data, u16 value)
+		{
+			data[0] = (u8)(value >> 8);
+			data[1] = (u8)value;
+		}
+
+		static inline void WriteBigEndianU32(u8* data, u32 value)
+		{
+			data[0] = (u8)(value >> 24);
+			data[1] = (u8)(value >> 16);
+			data[2] = (u8)(value >> 8);
+			data[3] = (u8)value;
+		}
+
+		static inline int CountBits(u32 mask)
+		{
+#ifdef _MSC_VER
+			return (int)__popcnt(mask);
+#else
+			return __builtin_popcount(mask);
+#endif
+		}
+
+		static inline u16 ZigZagEncode(s16 value)
+		{
+			return (u16)((u16)value << 1) ^ (u16)(value >> 15);
+		}
+
+		static inline s16 ZigZagDecode(u16 value)
+		{
+			return (s16)((value >> 1) ^ (u16)-(s16)(value & 1));
+		}
+
+		// Planar prediction, unlike MED or Paeth it is linear, which turns decoding into a prefix sum that vectorizes well.
+		// rowAbove is NULL in the first row of a band.
+		static inline s16 PredictElevation(const s16* row, const s16* rowAbove, int x)
+		{
+			const int left = (x > 0) ? row[x - 1] : 0;
+			const int above = rowAbove ? rowAbove[x] : 0;
+			const int aboveLeft = (rowAbove && x > 0) ? rowAbove[x - 1] : 0;
+
+			return (s16)(left + above - aboveLeft);
+		}
+
+		static inline u8* PackResiduals(const u16* residuals, int numResiduals, int bitWidth, u8* compressed)
+		{
+			if (bitWidth == 0)
+			{
+				return compressed;
+			}
+
+			u64 bits = 0;
+			int numBits = 0;
+			for (int r = 0; r < numResiduals; r++)
+			{
+				bits |= (u64)residuals[r] << numBits;
+				numBits += bitWidth;
+				while (numBits >= 8)
+				{
+					*compressed++ = (u8)bits;
+					bits >>= 8;
+					numBits -= 8;
+				}
+			}
+			if (numBits > 0)
+			{
+				*compressed++ = (u8)bits;
+			}
+			return compressed;
+		}
+
+		// rounds residual / step to the nearest integer, step is odd
+		static inline s16 QuantizeResidual(s16 residual, int step)
+		{
+			const int halfStep = step / 2;
+			return (s16)((residual >= 0) ? (residual + halfStep) / step : -((halfStep - residual) / step));
+		}
+
+		static bool RequiresLosslessBlock(const s16* values, int count, const ElevationV2Header& header)
+		{
+			const bool hasInvalidValue = (header.flags & ElevationV2Flag_HasInvalidValue) != 0;
+			for (int i = 0; i < count; i++)
+			{
+				const int value = values[i];
+				if (hasInvalidValue && value == header.invalidValue)
+				{
+					continue;
+				}
+				if (value > 32767 - header.maxError || value < -32768 + header.maxError || (hasInvalidValue && Abs(value - header.invalidValue) <= header.maxError))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		static size MaxCompressedElevationV2RowSize(int width)
+		{
+			const int numBlocks = (width + ElevationV2BlockSize - 1) / ElevationV2BlockSize;
+			return (size)numBlocks * (1 + sizeof(u32)) + (size)width * sizeof(u16);
+		}
+
+		// Encodes numRows rows of width pixels of elevation, whose rows are pitch pixels apart. context (width x numRows) receives the rows
+		// as the decoder sees them while decoding (predictions at invalid pixels), statistics receives the valid pixels of them.
+		static u8* CompressElevationChunk(const s16* elevation, int pitch, s16* context, int width, int numRows, const ElevationV2Header& header, u8* compressed,
+			ElevationStatistics& statistics)
+		{
+			const bool hasInvalidValue = (header.flags & ElevationV2Flag_HasInvalidValue) != 0;
+			const int quantizationStep = 2 * header.maxError + 1;
+			u16 residuals[ElevationV2BlockSize];
+			s16 minElevation = statistics.minElevation;
+			s16 maxElevation = statistics.maxElevation;
+			s64 sumElevation = statistics.sumElevation;
+
+			for (int y = 0; y < numRows; y++)
+			{
+				const s16* row = &elevation[(size)y * pitch];
+				s16* contextRow = &context[y * width];
+				const s16* contextRowAbove = (y > 0) ? &context[(y - 1) * width] : NULL;
+
+				for (int blockStart = 0; blockStart < width; blockStart += ElevationV2BlockSize)
+				{
+					const int blockEnd = min(blockStart + ElevationV2BlockSize, width);
+					const int step = (quantizationStep > 1 && !RequiresLosslessBlock(&row[blockStart], blockEnd - blockStart, header)) ? quantizationStep : 1;
+
+					u32 invalidMask = 0;
+					u16 residualBits = 0;
+					int numResiduals = 0;
+					for (int x = blockStart; x < blockEnd; x++)
+					{
+						const s16 prediction = PredictElevation(contextRow, contextRowAbove, x);
+
+						if (hasInvalidValue && row[x] == header.invalidValue)
+						{
+							invalidMask |= 1u << (x - blockStart);
+							contextRow[x] = prediction;
+							continue;
+						}
+
+						s16 residual = (s16)(row[x] - prediction);
+						if (step > 1)
+						{
+							residual = QuantizeResidual(residual, step);
+							contextRow[x] = (s16)(prediction + residual * step);
+						}
+						else
+						{
+							contextRow[x] = row[x];
+						}
+
+						residuals[numResiduals] = ZigZagEncode(residual);
+						residualBits |= residuals[numResiduals];
+						numResiduals++;
+
+						minElevation = min(minElevation, contextRow[x]);
+						maxElevation = max(maxElevation, contextRow[x]);
+						sumElevation += contextRow[x];
+					}
+
+					statistics.numValidPixels += numResiduals;
+
+					if (numResiduals == 0)
+					{
+						*compressed++ = ElevationV2Block_AllInvalid;
+						continue;
+					}
+
+					int bitWidth = 0;
+					while (bitWidth < ElevationV2MaxResidualWidth && (residualBits >> bitWidth) != 0)
+					{
+						bitWidth++;
+					}
+
+					*compressed++ = (u8)bitWidth | (invalidMask ? ElevationV2Block_HasInvalidMask : 0) | (step < quantizationStep ? ElevationV2Block_Lossless : 0);
+					if (invalidMask)
+					{
+						compressed[0] = (u8)invalidMask;
+						compressed[1] = (u8)(invalidMask >> 8);
+						compressed[2] = (u8)(invalidMask >> 16);
+						compressed[3] = (u8)(invalidMask >> 24);
+						compressed += 4;
+					}
+
+					compressed = PackResiduals(residuals, numResiduals, bitWidth, compressed);
+				}
+			}
+
+			statistics.minElevation = minElevation;
+			statistics.maxElevation = maxElevation;
+			statistics.sumElevation = sumElevation;
+
+			return compressed;
+		}
+
+		static void WriteElevationV2Header(u8* data, const ElevationV2Header& header)
+		{
+			WriteBigEndianU32(data + 0, CompressedElevationModelV2FourCC.value);
+			WriteBigEndianU32(data + 4, header.width);
+			WriteBigEndianU32(data + 8, header.height);
+			WriteBigEndianU16(data + 12, header.flags);
+			WriteBigEndianU16(data + 14, (u16)header.invalidValue);
+			WriteBigEndianU16(data + 16, header.rowsPerBand);
+			WriteBigEndianU16(data + 18, header.columnsPerChunk);
+
+			if (header.flags & ElevationV2Flag_Quantized)
+			{
+				WriteBigEndianU16(data + ElevationV2HeaderSize, header.maxError);
+				WriteBigEndianU16(data + ElevationV2HeaderSize + 2, 0);
+			}
+		}
+
+		// the statistics are only known after encoding, WriteElevationV2Header leaves room for them
+		static void WriteElevationV2Statistics(u8* data, const ElevationV2Header& header, const ElevationStatistics& statistics)
+		{
+			u8* statisticsData = data + ElevationV2HeaderSize + ((header.flags & ElevationV2Flag_Quantized) ? ElevationV2QuantizationSize : 0);
+			WriteBigEndianU16(statisticsData + 0, (u16)(statistics.numValidPixels ? statistics.minElevation : 0));
+			WriteBigEndianU16(statisticsData + 2, (u16)(statistics.numValidPixels ? statistics.maxElevation : 0));
+			WriteBigEndianU32(statisticsData + 4, statistics.numValidPixels);
+			WriteBigEndianU32(statisticsData + 8, (u32)((u64)statistics.sumElevation >> 32));
+			WriteBigEndianU32(statisticsData + 12, (u32)statistics.sumElevation);
+		}
+
+		// offset of the chunk offset table
+		static size GetElevationV2HeaderSize(const ElevationV2Header& header)
+		{
+			return ElevationV2HeaderSize + ((header.flags & ElevationV2Flag_Quantized) ? ElevationV2QuantizationSize : 0) +
+				((header.flags & ElevationV2Flag_HasStatistics) ? ElevationV2StatisticsSize : 0);
+		}
+
+		static bool ReadElevationV2Header(const Image& img, ElevationV2Header& header)
+		{
+			if (img.processedDataSize < ElevationV2HeaderSize || ReadBigEndianU32(img.processedData) != CompressedElevationModelV2FourCC.value)
+			{
+				return false;
+			}
+
+			header.width = ReadBigEndianU32(img.processedData + 4);
+			header.height = ReadBigEndianU32(img.processedData + 8);
+			header.flags = ReadBigEndianU16(img.processedData + 12);
+			header.invalidValue = (s16)ReadBigEndianU16(img.processedData + 14);
+			header.rowsPerBand = ReadBigEndianU16(img.processedData + 16);
+			header.columnsPerChunk = ReadBigEndianU16(img.processedData + 18);
+			header.maxError = 0;
+
+			if (img.processedDataSize < GetElevationV2HeaderSize(header))
+			{
+				return false;
+			}
+
+			if (header.flags & ElevationV2Flag_Quantized)
+			{
+				header.maxError = ReadBigEndianU16(img.processedData + ElevationV2HeaderSize);
+			}
+
+			if (header.rowsPerBand == 0 || header.columnsPerChunk % ElevationV2BlockSize != 0 || header.maxError > ElevationV2MaxError)
+			{
+				return false;
+			}
+
+			// every block takes at least its header byte, thus a forged size is rejected before it gets allocated
+			const size numBlocksPerRow = (header.width + ElevationV2BlockSize - 1) / ElevationV2BlockSize;
+			return IsValidCompressedElevationSize(header.width, header.height) && numBlocksPerRow * header.height <= img.processedDataSize;
+		}
+
+		static int GetChunkWidth(const ElevationV2Header& header)
+		{
+			return header.columnsPerChunk ? min((int)header.columnsPerChunk, (int)header.width) : (int)header.width;
+		}
+
+		static int GetNumChunksPerBand(const ElevationV2Header& header)
+		{
+			return header.columnsPerChunk ? (int)((header.width + header.columnsPerChunk - 1) / header.columnsPerChunk) : 1;
+		}
+
+		// Finds the compressed data of chunk c of numChunks, the chunk ends where the next one starts
+		static bool FindCompressedElevationChunk(const Image& img, const ElevationV2Header& header, int c, int numChunks, const u8*& compressed, const u8*& compressedEnd)
+		{
+			const u8* compressedChunkOffsets = img.processedData + GetElevationV2HeaderSize(header);
+			const size chunkOffset = ReadBigEndianU32(compressedChunkOffsets + c * sizeof(u32));
+			const size chunkEnd = (c + 1 < numChunks) ? ReadBigEndianU32(compressedChunkOffsets + (c + 1) * sizeof(u32)) : img.processedDataSize;
+			if (chunkOffset > chunkEnd || chunkEnd > img.processedDataSize)
+			{
+				return false;
+			}
+
+			compressed = img.processedData + chunkOffset;
+			compressedEnd = img.processedData + chunkEnd;
+			return true;
+		}
+
+		static bool InitElevationV2Header(int width, int height, const Variant& invalidValue, const ElevationCompressionOptions& options, ElevationV2Header& header)
+		{
+			if (options.columnsPerChunk < 0 || options.columnsPerChunk % ElevationV2BlockSize != 0 || options.columnsPerChunk > 0xFFFF ||
+				options.maxError < 0 || options.maxError > ElevationV2MaxError)
+			{
+				return false;
+			}
+
+			header.width = width;
+			header.height = height;
+			header.flags = (invalidValue.IsSet() ? ElevationV2Flag_HasInvalidValue : 0) | (options.maxError > 0 ? ElevationV2Flag_Quantized : 0) |
+				(options.storeStatistics ? ElevationV2Flag_HasStatistics : 0);
+			header.invalidValue = invalidValue.IsSet() ? invalidValue.GetValue().sint16[0] : 0;
+			header.rowsPerBand = ElevationV2RowsPerBand;
+			header.columnsPerChunk = (u16)options.columnsPerChunk;
+			header.maxError = (u16)options.maxError;
+			return true;
+		}
+
+		// worst case size of a row over all chunks of a band
+		static size MaxCompressedElevationV2BandRowSize(const ElevationV2Header& header)
+		{
+			if (header.width == 0)
+			{
+				return 0;
+			}
+
+			const int numChunksPerBand = GetNumChunksPerBand(header);
+			const int chunkWidth = GetChunkWidth(header);
+			const int lastChunkWidth = (int)header.width - (numChunksPerBand - 1) * chunkWidth;
+			return (numChunksPerBand - 1) * MaxCompressedElevationV2RowSize(chunkWidth) + MaxCompressedElevationV2RowSize(lastChunkWidth);
+		}
+
+		static size MaxCompressedElevationV2Size(const ElevationV2Header& header)
+		{
+			const int numBands = (int)((header.height + header.rowsPerBand - 1) / header.rowsPerBand);
+			const size numChunks = (size)numBands * GetNumChunksPerBand(header);
+			return GetElevationV2HeaderSize(header) + numChunks * sizeof(u32) + header.height * MaxCompressedElevationV2BandRowSize(header);
+		}
+
+		// compressed has to hold MaxCompressedElevationV2Size bytes, returns the compressed size
+		static size CompressElevationV2(const Image& img, const ElevationV2Header& header, u8* compressed)
+		{
+			assert(img.rawDataType == DT_S16);
+
+			WriteElevationV2Header(compressed, header);
+
+			// Chunks are encoded in parallel, each into its worst case slot of the output first, like rows of version 1.
+			// The slots of a band follow each other, the slot of a chunk holds numRows times the worst case size of its rows.
+			const int numBands = (img.height + header.rowsPerBand - 1) / header.rowsPerBand;
+			const int numChunksPerBand = GetNumChunksPerBand(header);
+			const int numChunks = numBands * numChunksPerBand;
+			const int chunkWidth = GetChunkWidth(header);
+			const size maxCompressedChunkRowSize = MaxCompressedElevationV2RowSize(chunkWidth);
+			const size maxCompressedBandRowSize = MaxCompressedElevationV2BandRowSize(header);
+			const size headerSize = GetElevationV2HeaderSize(header);
+			const size compressedDataOffset = headerSize + numChunks * sizeof(u32);
+			u8* compressedChunkOffsets = compressed + headerSize;
+
+			auto getChunkSlot = [&](int c)
+			{
+				const int startY = (c / numChunksPerBand) * header.rowsPerBand;
+				const int numRows = min((int)header.rowsPerBand, img.height - startY);
+				return compressed + compressedDataOffset + startY * maxCompressedBandRowSize + (c % numChunksPerBand) * numRows * maxCompressedChunkRowSize;
+			};
+
+			// every thread accumulates the statistics of its chunks, which are merged in any order as they are integers
+			ElevationStatistics statistics;
+
+			#pragma omp parallel if(numChunks > 1)
+			{
+				vector<s16> context((size)chunkWidth * header.rowsPerBand);
+				ElevationStatistics threadStatistics;
+
+				#pragma omp for schedule(dynamic)
+				for (int c = 0; c < numChunks; c++)
+				{
+					const int startY = (c / numChunksPerBand) * header.rowsPerBand;
+					const int startX = (c % numChunksPerBand) * chunkWidth;
+					const int numRows = min((int)header.rowsPerBand, img.height - startY);
+					const int width = min(chunkWidth, img.width - startX);
+					const s16* elevation = &((const s16*)img.rawData)[(size)startY * img.width + startX];
+
+					// the offset table holds the chunk sizes until the chunks are moved
+					u8* compressedChunk = getChunkSlot(c);
+					u8* compressedChunkEnd = CompressElevationChunk(elevation, img.width, context.data(), width, numRows, header, compressedChunk, threadStatistics);
+					WriteBigEndianU32(compressedChunkOffsets + c * sizeof(u32), (u32)(compressedChunkEnd - compressedChunk));
+				}
+
+				#pragma omp critical
+				statistics.Merge(threadStatistics);
+			}
+
+			// chunks only move towards the front, thus no chunk overwrites a slot which has not been moved yet
+			size compressedDataSize = compressedDataOffset;
+			for (int c = 0; c < numChunks; c++)
+			{
+				const size chunkSize = ReadBigEndianU32(compressedChunkOffsets + c * sizeof(u32));
+				WriteBigEndianU32(compressedChunkOffsets + c * sizeof(u32), (u32)compressedDataSize);
+				memmove(compressed + compressedDataSize, getChunkSlot(c), chunkSize);
+				compressedDataSize += chunkSize;
+			}
+
+			if (header.flags & ElevationV2Flag_HasStatistics)
+			{
+				WriteElevationV2Statistics(compressed, header, statistics);
+			}
+
+			return compressedDataSize;
+		}
+
+		static inline void ReplaceInvalidPixels(s16* row, int width, const u32* invalidMasks, s16 invalidValue)
+		{
+			for (int blockStart = 0, block = 0; blockStart < width; blockStart += ElevationV2BlockSize, block++)
+			{
+				u32 invalidMask = invalidMasks[block];
+				while (invalidMask)
+				{
+					const int x = CountTrailingZeros(invalidMask);
+					row[blockStart + x] = invalidValue;
+					invalidMask &= invalidMask - 1;
+				}
+			}
+		}
+
+		static inline u64 LoadLittleEndianU64(const u8* data)
+		{
+			u64 value;
+			memcpy(&value, data, sizeof(value));
+#if !LITTLE_ENDIAN
+			value = ((value & 0x00000000000000FFull) << 56) | ((value & 0x000000000000FF00ull) << 40) | ((value & 0x0000000000FF0000ull) << 24) | ((value & 0x00000000FF000000ull) << 8) |
+				((value & 0x000000FF00000000ull) >> 8) | ((value & 0x0000FF0000000000ull) >> 24) | ((value & 0x00FF000000000000ull) >> 40) | ((value & 0xFF00000000000000ull) >> 56);
+#endif
+			return value;
+		}
+
+		// Groups of eight residuals occupy exactly BitWidth bytes, thus all shifts are constant. Reads up to eight bytes beyond the last group.
+		template<int BitWidth>
+		static void UnpackResidualsOfWidth(const u8* packed, int numResiduals, u16* residuals)
+		{
+			const u64 mask = (1u << BitWidth) - 1;
+			const int highShift = (BitWidth & 1) * 4;
+
+			int r = 0;
+			for (; r + 8 <= numResiduals; r += 8, packed += BitWidth)
+			{
+				const u64 low = LoadLittleEndianU64(packed);
+				const u64 high = LoadLittleEndianU64(packed + BitWidth / 2);
+				residuals[r + 0] = (u16)(low & mask);
+				residuals[r + 1] = (u16)((low >> BitWidth) & mask);
+				residuals[r + 2] = (u16)((low >> (2 * BitWidth)) & mask);
+				residuals[r + 3] = (u16)((low >> (3 * BitWidth)) & mask);
+				residuals[r + 4] = (u16)((high >> highShift) & mask);
+				residuals[r + 5] = (u16)((high >> (highShift + BitWidth)) & mask);
+				residuals[r + 6] = (u16)((high >> (highShift + 2 * BitWidth)) & mask);
+				residuals[r + 7] = (u16)((high >> (highShift + 3 * BitWidth)) & mask);
+			}
+
+			u64 bits = 0;
+			int numBits = 0;
+			for (; r < numResiduals; r++)
+			{
+				while (numBits < BitWidth)
+				{
+					bits |= (u64)*packed++ << numBits;
+					numBits += 8;
+				}
+				residuals[r] = (u16)(bits & mask);
+				bits >>= BitWidth;
+				numBits -= BitWidth;
+			}
+		}
+
+		typedef void(*UnpackResidualsFunction)(const u8* packed, int numResiduals, u16* residuals);
+		static const UnpackResidualsFunction UnpackResidualsByWidth[ElevationV2MaxResidualWidth + 1] =
+		{
+			NULL,
+			UnpackResidualsOfWidth<1>, UnpackResidualsOfWidth<2>, UnpackResidualsOfWidth<3>, UnpackResidualsOfWidth<4>,
+			UnpackResidualsOfWidth<5>, UnpackResidualsOfWidth<6>, UnpackResidualsOfWidth<7>, UnpackResidualsOfWidth<8>,
+			UnpackResidualsOfWidth<9>, UnpackResidualsOfWidth<10>, UnpackResidualsOfWidth<11>, UnpackResidualsOfWidth<12>,
+			UnpackResidualsOfWidth<13>, UnpackResidualsOfWidth<14>, UnpackResidualsOfWidth<15>, UnpackResidualsOfWidth<16>,
+		};
+
+		// Unpacks numResiduals zigzag encoded residuals, returns NULL if they exceed compressedEnd
+		static inline const u8* UnpackResiduals(const u8* compressed, const u8* compressedEnd, int numResiduals, int bitWidth, u16* residuals)
+		{
+			if (bitWidth == 0)
+			{
+				memset(residuals, 0, numResiduals * sizeof(u16));
+				return compressed;
+			}
+
+			const size numBytes = ((size)numResiduals * bitWidth + 7) / 8;
+			if ((size)(compressedEnd - compressed) < numBytes)
+			{
+				return NULL;
+			}
+
+			// near the end of the band a padded copy keeps the wide loads in bounds
+			u8 paddedBlock[ElevationV2BlockSize * sizeof(u16) + sizeof(u64)];
+			const u8* packed = compressed;
+			if ((size)(compressedEnd - compressed) < numBytes + sizeof(u64))
+			{
+				memset(paddedBlock, 0, sizeof(paddedBlock));
+				memcpy(paddedBlock, compressed, numBytes);
+				packed = paddedBlock;
+			}
+
+			UnpackResidualsByWidth[bitWidth](packed, numResiduals, residuals);
+
+			return compressed + numBytes;
+		}
+
+		// Multiplies zigzag encoded residuals by step, zero residuals (invalid pixels) stay zero
+		static inline void DequantizeResiduals(u16* residuals, int count, int step)
+		{
+			int i = 0;
+#if DW_SSE2
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i one = _mm_set1_epi16(1);
+			const __m128i steps = _mm_set1_epi16((short)step);
+			for (; i + 8 <= count; i += 8)
+			{
+				const __m128i zigzag = _mm_loadu_si128((const __m128i*)&residuals[i]);
+				const __m128i quantized = _mm_xor_si128(_mm_srli_epi16(zigzag, 1), _mm_sub_epi16(zero, _mm_and_si128(zigzag, one)));
+				const __m128i residual = _mm_mullo_epi16(quantized, steps);
+				_mm_storeu_si128((__m128i*)&residuals[i], _mm_xor_si128(_mm_slli_epi16(residual, 1), _mm_srai_epi16(residual, 15)));
+			}
+#endif
+			for (; i < count; i++)
+			{
+				residuals[i] = ZigZagEncode((s16)(ZigZagDecode(residuals[i]) * step));
+			}
+		}
+
+		// Reconstructs a row from its zigzag encoded residuals: row[x] = row[x - 1] + rowAbove[x] - rowAbove[x - 1] + residual[x],
+		// which is the prefix sum of (rowAbove[x] - rowAbove[x - 1] + residual[x]). rowAbove is NULL in the first row of a band.
+		static void ReconstructRow(const u16* residuals, const s16* rowAbove, s16* row, int width)
+		{
+			int x = 0;
+			s16 left = 0;
+#if DW_SSE2
+			__m128i carry = _mm_setzero_si128();
+			const __m128i one = _mm_set1_epi16(1);
+			for (; x + 8 <= width; x += 8)
+			{
+				const __m128i zigzag = _mm_loadu_si128((const __m128i*)&residuals[x]);
+				__m128i delta = _mm_xor_si128(_mm_srli_epi16(zigzag, 1), _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(zigzag, one)));
+
+				if (rowAbove)
+				{
+					const __m128i above = _mm_loadu_si128((const __m128i*)&rowAbove[x]);
+					const __m128i aboveLeft = (x > 0) ? _mm_loadu_si128((const __m128i*)&rowAbove[x - 1]) : _mm_slli_si128(above, 2);
+					delta = _mm_add_epi16(delta, _mm_sub_epi16(above, aboveLeft));
+				}
+
+				// inclusive prefix sum within the vector plus the last value of the previous vector
+				delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 2));
+				delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 4));
+				delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 8));
+				delta = _mm_add_epi16(delta, carry);
+
+				_mm_storeu_si128((__m128i*)&row[x], delta);
+				carry = _mm_shuffle_epi32(_mm_shufflehi_epi16(delta, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+			}
+			if (x > 0)
+			{
+				left = row[x - 1];
+			}
+#endif
+			for (; x < width; x++)
+			{
+				const int gradient = rowAbove ? rowAbove[x] - ((x > 0) ? rowAbove[x - 1] : 0) : 0;
+				left = (s16)(left + gradient + ZigZagDecode(residuals[x]));
+				row[x] = left;
+			}
+		}
+
+		// Decodes numRows rows of a band into elevation, returns false if the band is corrupt. The residuals of a row are
+		// unpacked first (zero at invalid pixels, which makes them equal their prediction), then the row is reconstructed at once.
+		// The decoded rows serve as context of the predictor, hence invalid pixels are replaced after the row below has been decoded.
+		// Only the first decodeWidth columns of the chunk are reconstructed, the blocks right of them are merely skipped. The rows of elevation
+		// are pitch pixels apart.
+		static bool DecompressElevationChunk(const u8* compressed, const u8* compressedEnd, s16* elevation, int pitch, int width, int decodeWidth, int numRows,
+			const ElevationV2Header& header, vector<u16>& residuals, vector<u32>& invalidMasks)
+		{
+			const int numBlocksPerRow = (width + ElevationV2BlockSize - 1) / ElevationV2BlockSize;
+			const int quantizationStep = 2 * header.maxError + 1;
+			residuals.resize(width);
+			invalidMasks.assign(numBlocksPerRow * 2, 0); // masks of the current and the previous row
+			bool hasInvalidPixels[2] = { false, false };
+
+			for (int y = 0; y < numRows; y++)
+			{
+				s16* row = &elevation[(size)y * pitch];
+				const s16* rowAbove = (y > 0) ? &elevation[(size)(y - 1) * pitch] : NULL;
+				u32* rowInvalidMasks = &invalidMasks[(y & 1) * numBlocksPerRow];
+				bool rowHasInvalidPixels = false;
+
+				for (int blockStart = 0, block = 0; blockStart < width; blockStart += ElevationV2BlockSize, block++)
+				{
+					const int blockLength = min(ElevationV2BlockSize, width - blockStart);
+					u16* blockResiduals = &residuals[blockStart];
+
+					if (compressed >= compressedEnd) return false;
+					const u8 blockHeader = *compressed++;
+					const int bitWidth = blockHeader & ElevationV2Block_WidthMask;
+					if (bitWidth > ElevationV2MaxResidualWidth) return false;
+
+					const u32 blockMask = (blockLength == 32) ? 0xFFFFFFFF : ((1u << blockLength) - 1);
+					u32 invalidMask = 0;
+					if (blockHeader & ElevationV2Block_AllInvalid)
+					{
+						invalidMask = blockMask;
+					}
+					else if (blockHeader & ElevationV2Block_HasInvalidMask)
+					{
+						if (compressedEnd - compressed < 4) return false;
+						invalidMask = compressed[0] | ((u32)compressed[1] << 8) | ((u32)compressed[2] << 16) | ((u32)compressed[3] << 24);
+						invalidMask &= blockMask;
+						compressed += 4;
+					}
+
+					if (blockStart >= decodeWidth)
+					{
+						const size numBytes = ((size)(blockLength - CountBits(invalidMask)) * bitWidth + 7) / 8;
+						if ((size)(compressedEnd - compressed) < numBytes) return false;
+						compressed += numBytes;
+						continue;
+					}
+
+					rowInvalidMasks[block] = invalidMask;
+
+					if (!invalidMask)
+					{
+						compressed = UnpackResiduals(compressed, compressedEnd, blockLength, bitWidth, blockResiduals);
+						if (!compressed) return false;
+					}
+					else
+					{
+						rowHasInvalidPixels = true;
+						const int numResiduals = blockLength - CountBits(invalidMask);
+						compressed = UnpackResiduals(compressed, compressedEnd, numResiduals, bitWidth, blockResiduals);
+						if (!compressed) return false;
+
+						int r = numResiduals;
+						for (int x = blockLength - 1; x >= 0; x--)
+						{
+							blockResiduals[x] = (invalidMask & (1u << x)) ? 0 : blockResiduals[--r];
+						}
+					}
+
+					if (quantizationStep > 1 && !(blockHeader & ElevationV2Block_Lossless))
+					{
+						DequantizeResiduals(blockResiduals, blockLength, quantizationStep);
+					}
+				}
+
+				ReconstructRow(residuals.data(), rowAbove, row, decodeWidth);
+
+				// the previous row is not needed as context anymore
+				if (y > 0 && hasInvalidPixels[(y - 1) & 1])
+				{
+					ReplaceInvalidPixels(&elevation[(size)(y - 1) * pitch], decodeWidth, &invalidMasks[((y - 1) & 1) * numBlocksPerRow], header.invalidValue);
+				}
+				hasInvalidPixels[y & 1] = rowHasInvalidPixels;
+			}
+
+			if (numRows > 0 && hasInvalidPixels[(numRows - 1) & 1])
+			{
+				ReplaceInvalidPixels(&elevation[(size)(numRows - 1) * pitch], decodeWidth, &invalidMasks[((numRows - 1) & 1) * numBlocksPerRow], header.invalidValue);
+			}
+
+			return true;
+		}
+
+		static bool DecompressElevationV2(Image& img)
+		{
+			ElevationV2Header header;
+			if (!ReadElevationV2Header(img, header))
+			{
+				return false;
+			}
+
+			const int numBands = (int)((header.height + header.rowsPerBand - 1) / header.rowsPerBand);
+			const int numChunksPerBand = GetNumChunksPerBand(header);
+			const int numChunks = numBands * numChunksPerBand;
+			if (GetElevationV2HeaderSize(header) + (size)numChunks * sizeof(u32) > img.processedDataSize)
+			{
+				return false;
+			}
+
+			img.AllocateRawData(header.width, header.height, DT_S16);
+
+			const int chunkWidth = GetChunkWidth(header);
+			bool isCorrupt = false;
+
+			#pragma omp parallel
+			{
+				vector<u16> residuals;
+				vector<u32> invalidMasks;
+
+				#pragma omp for schedule(dynamic)
+				for (int c = 0; c < numChunks; c++)
+				{
+					const u8* compressed;
+					const u8* compressedEnd;
+					if (!FindCompressedElevationChunk(img, header, c, numChunks, compressed, compressedEnd))
+					{
+						isCorrupt = true;
+						continue;
+					}
+
+					const int startY = (c / numChunksPerBand) * header.rowsPerBand;
+					const int startX = (c % numChunksPerBand) * chunkWidth;
+					const int numRows = min((int)header.rowsPerBand, img.height - startY);
+					const int width = min(chunkWidth, img.width - startX);
+					s16* elevation = &((s16*)img.rawData)[(size)startY * img.width + startX];
+
+					if (!DecompressElevationChunk(compressed, compressedEnd, elevation, img.width, width, width, numRows, header, residuals, invalidMasks))
+					{
+						isCorrupt = true;
+					}
+				}
+			}
+
+			return !isCorrupt;
+		}
+
+		// Decodes the chunks overlapping the window into a scratch buffer of their thread and copies the window part of them. Rows below
+		// the window and columns right of it are no context of the pixels within, thus decoding stops at the bottom and right edge of the window.
+		static bool DecompressElevationV2Window(Image& img, int left, int top, int width, int height)
+		{
+			ElevationV2Header header;
+			if (!ReadElevationV2Header(img, header))
+			{
+				return false;
+			}
+
+			if (left < 0 || top < 0 || width <= 0 || height <= 0 || (u32)(left + width) > header.width || (u32)(top + height) > header.height)
+			{
+				return false;
+			}
+
+			const int numBands = (int)((header.height + header.rowsPerBand - 1) / header.rowsPerBand);
+			const int numChunksPerBand = GetNumChunksPerBand(header);
+			const int numChunks = numBands * numChunksPerBand;
+			if (GetElevationV2HeaderSize(header) + (size)numChunks * sizeof(u32) > img.processedDataSize)
+			{
+				return false;
+			}
+
+			const int chunkWidth = GetChunkWidth(header);
+			const int right = left + width;
+			const int bottom = top + height;
+			const int firstBand = top / header.rowsPerBand;
+			const int firstChunkX = left / chunkWidth;
+			const int numWindowChunksX = (right - 1) / chunkWidth - firstChunkX + 1;
+			const int numWindowChunks = ((bottom - 1) / header.rowsPerBand - firstBand + 1) * numWindowChunksX;
+
+			img.AllocateRawData(width, height, DT_S16);
+
+			bool isCorrupt = false;
+
+			#pragma omp parallel if(numWindowChunks > 1)
+			{
+				vector<s16> chunkElevation;
+				vector<u16> residuals;
+				vector<u32> invalidMasks;
+
+				#pragma omp for schedule(dynamic)
+				for (int w = 0; w < numWindowChunks; w++)
+				{
+					const int b = firstBand + w / numWindowChunksX;
+					const int cx = firstChunkX + w % numWindowChunksX;
+
+					const u8* compressed;
+					const u8* compressedEnd;
+					if (!FindCompressedElevationChunk(img, header, b * numChunksPerBand + cx, numChunks, compressed, compressedEnd))
+					{
+						isCorrupt = true;
+						continue;
+					}
+
+					const int startY = b * header.rowsPerBand;
+					const int startX = cx * chunkWidth;
+					const int chunkColumns = min(chunkWidth, (int)header.width - startX);
+					const int numRows = min(startY + (int)header.rowsPerBand, bottom) - startY;
+					const int decodeWidth = min(startX + chunkColumns, right) - startX;
+
+					chunkElevation.resize((size)chunkColumns * numRows);
+					if (!DecompressElevationChunk(compressed, compressedEnd, chunkElevation.data(), chunkColumns, chunkColumns, decodeWidth, numRows, header, residuals, invalidMasks))
+					{
+						isCorrupt = true;
+						continue;
+					}
+
+					const int copyLeft = max(left, startX);
+					const int copyWidth = startX + decodeWidth - copyLeft;
+					for (int y = max(top, startY); y < startY + numRows; y++)
+					{
+						memcpy(&((s16*)img.rawData)[(size)(y - top) * width + (copyLeft - left)], &chunkElevation[(size)(y - startY) * chunkColumns + (copyLeft - startX)], copyWidth * sizeof(s16));
+					}
+				}
+			}
+
+			return !isCorrupt;
+		}
+
+		size GetMaxCompressedElevationSize(int width, int height, const ElevationCompressionOptions& options)
+		{
+			if (width < 0 || height < 0 || !IsValidCompressedElevationSize(width, height))
+			{
+				return 0;
+			}
+
+			switch (options.version)
+			{
+			case CEM_Version1:
+				return (options.maxError == 0) ? MaxCompressedElevationV1Size(width, height) : 0;
+			case CEM_Version2:
+			{
+				ElevationV2Header header;
+				return InitElevationV2Header(width, height, Variant(), options, header) ? MaxCompressedElevationV2Size(header) : 0;
+			}
+			default:
+				return 0;
+			}
+		}
+
+		size CompressElevation(const Image& img, const Variant& invalidValue, u8* compressed, size compressedCapacity, const ElevationCompressionOptions& options)
+		{
+			const size maxCompressedSize = GetMaxCompressedElevationSize(img.width, img.height, options);
+			if (maxCompressedSize == 0 || compressedCapacity < maxCompressedSize)
+			{
+				return 0;
+			}
+
+			switch (options.version)
+			{
+			case CEM_Version1:
+				return CompressElevationV1(img, invalidValue, compressed);
+			case CEM_Version2:
+			{
+				ElevationV2Header header;
+				InitElevationV2Header(img.width, img.height, invalidValue, options, header);
+				return CompressElevationV2(img, header, compressed);
+			}
+			default:
+				return 0;
+			}
+		}
+
+		bool CompressElevation(Image& img, const Variant& invalidValue, const ElevationCompressionOptions& options)
+		{
+			const size maxCompressedSize = GetMaxCompressedElevationSize(img.width, img.height, options);
+			if (maxCompressedSize == 0)
+			{
+				return false;
+			}
+
+			// only the pages of the worst case buffer which receive compressed data get touched
+			unique_ptr<u8[]> compressed(new u8[maxCompressedSize]);
+			const size compressedSize = CompressElevation(img, invalidValue, compressed.get(), maxCompressedSize, options);
+			if (compressedSize == 0)
+			{
+				return false;
+			}
+
+			img.processedDataSize = compressedSize;
+			img.processedData = new u8[compressedSize];
+			memcpy(img.processedData, compressed.get(), compressedSize);
+			return true;
+		}
+
+		void ElevationStatistics::Merge(const ElevationStatistics& other)
+		{
+			if (other.numValidPixels == 0)
+			{
+				return;
+			}
+
+			minElevation = numValidPixels ? min(minElevation, other.minElevation) : other.minElevation;
+			maxElevation = numValidPixels ? max(maxElevation, other.maxElevation) : other.maxElevation;
+			numValidPixels += other.numValidPixels;
+			sumElevation += other.sumElevation;
+		}
+
+		ElevationStreamEncoder::ElevationStreamEncoder()
+			: width(0)
+			, height(0)
+			, compressed(NULL)
+			, compressedSize(0)
+			, numCompressedRows(0)
+			, numPendingRows(0)
+		{
+		}
+
+		bool ElevationStreamEncoder::Begin(int width, int height, const Variant& invalidValue, u8* compressed, size compressedCapacity, const ElevationCompressionOptions& options)
+		{
+			this->compressed = NULL;
+
+			ElevationV2Header header;
+			if (options.version != CEM_Version2 || !InitElevationV2Header(width, height, invalidValue, options, header) ||
+				compressedCapacity < GetMaxCompressedElevationSize(width, height, options))
+			{
+				return false;
+			}
+
+			this->width = width;
+			this->height = height;
+			this->invalidValue = invalidValue;
+			this->options = options;
+			this->compressed = compressed;
+			numCompressedRows = 0;
+			numPendingRows = 0;
+			statistics = ElevationStatistics();
+			pendingRows.resize((size)width * header.rowsPerBand);
+			context.resize((size)GetChunkWidth(header) * header.rowsPerBand);
+
+			// the chunk offset table is filled while the bands arrive, chunks follow each other in the order of the table
+			WriteElevationV2Header(compressed, header);
+			const int numBands = (height + header.rowsPerBand - 1) / header.rowsPerBand;
+			compressedSize = GetElevationV2HeaderSize(header) + (size)numBands * GetNumChunksPerBand(header) * sizeof(u32);
+
+			return true;
+		}
+
+		bool ElevationStreamEncoder::PushRows(const s16* elevation, int numRows)
+		{
+			if (!compressed || numRows < 0 || numCompressedRows + numPendingRows + numRows > height)
+			{
+				return false;
+			}
+
+			const int rowsPerBand = GetRowsPerBand();
+			while (numRows > 0)
+			{
+				const int numBandRows = min(rowsPerBand, height - numCompressedRows);
+
+				if (numPendingRows == 0 && numRows >= numBandRows)
+				{
+					CompressBand(elevation, numBandRows);
+					elevation += (size)numBandRows * width;
+					numRows -= numBandRows;
+					continue;
+				}
+
+				const int numCopiedRows = min(numRows, numBandRows - numPendingRows);
+				memcpy(&pendingRows[(size)numPendingRows * width], elevation, (size)numCopiedRows * width * sizeof(s16));
+				numPendingRows += numCopiedRows;
+				elevation += (size)numCopiedRows * width;
+				numRows -= numCopiedRows;
+
+				if (numPendingRows == numBandRows)
+				{
+					CompressBand(pendingRows.data(), numBandRows);
+					numPendingRows = 0;
+				}
+			}
+
+			return true;
+		}
+
+		size ElevationStreamEncoder::Finish()
+		{
+			if (!compressed || numCompressedRows != height)
+			{
+				return 0;
+			}
+
+			if (options.storeStatistics)
+			{
+				ElevationV2Header header;
+				InitElevationV2Header(width, height, invalidValue, options, header);
+				WriteElevationV2Statistics(compressed, header, statistics);
+			}
+
+			compressed = NULL;
+			return compressedSize;
+		}
+
+		int ElevationStreamEncoder::GetRowsPerBand() const
+		{
+			return ElevationV2RowsPerBand;
+		}
+
+		void ElevationStreamEncoder::CompressBand(const s16* elevation, int numRows)
+		{
+			ElevationV2Header header;
+			InitElevationV2Header(width, height, invalidValue, options, header);
+
+			const int numChunksPerBand = GetNumChunksPerBand(header);
+			const int chunkWidth = GetChunkWidth(header);
+			const int firstChunk = (numCompressedRows / header.rowsPerBand) * numChunksPerBand;
+			u8* compressedChunkOffsets = compressed + GetElevationV2HeaderSize(header);
+
+			// Begin has checked the capacity for the worst case of all chunks, thus every chunk fits behind the previous one
+			for (int c = 0; c < numChunksPerBand; c++)
+			{
+				const int startX = c * chunkWidth;
+				WriteBigEndianU32(compressedChunkOffsets + (firstChunk + c) * sizeof(u32), (u32)compressedSize);
+				u8* compressedChunkEnd = CompressElevationChunk(&elevation[startX], width, context.data(), min(chunkWidth, width - startX), numRows, header, compressed + compressedSize, statistics);
+				compressedSize = compressedChunkEnd - compressed;
+			}
+
+			numCompressedRows += numRows;
+		}
+
+		bool DecompressElevation(Image& img)
+		{
+			if (!img.processedData || img.processedDataSize < sizeof(ElevationHeader))
+			{
+				return false;
+			}
+
+			const u32 fourCC = ReadBigEndianU32(img.processedData);
+			if (fourCC == CompressedElevationModelFourCC.value)
+			{
+				return DecompressElevationV1(img);
+			}
+			if (fourCC == CompressedElevationModelV2FourCC.value)
+			{
+				return DecompressElevationV2(img);
+			}
+			return false;
+		}
+
+		bool ReadCompressedElevationSize(const Image& img, int& widthOut, int& heightOut)
+		{
+			if (!img.processedData || img.processedDataSize < sizeof(ElevationHeader))
+			{
+				return false;
+			}
+
+			const u32 fourCC = ReadBigEndianU32(img.processedData);
+			if (fourCC != CompressedElevationModelFourCC.value && fourCC != CompressedElevationModelV2FourCC.value)
+			{
+				return false;
+			}
+
+			// both versions start with fourCC, width and height
+			const u32 width = ReadBigEndianU32(img.processedData + 4);
+			const u32 height = ReadBigEndianU32(img.processedData + 8);
+			if (!IsValidCompressedElevationSize(width, height))
+			{
+				return false;
+			}
+
+			widthOut = (int)width;
+			heightOut = (int)height;
+			return true;
+		}
+
+		bool ReadCompressedElevationStatistics(const Image& img, ElevationStatistics& statisticsOut)
+		{
+			// only the header is needed, thus the first bytes of a file are enough
+			if (!img.processedData || img.processedDataSize < ElevationV2HeaderSize || ReadBigEndianU32(img.processedData) != CompressedElevationModelV2FourCC.value)
+			{
+				return false;
+			}
+
+			ElevationV2Header header;
+			header.flags = ReadBigEndianU16(img.processedData + 12);
+			if (!(header.flags & ElevationV2Flag_HasStatistics) || img.processedDataSize < GetElevationV2HeaderSize(header))
+			{
+				return false;
+			}
+
+			const u8* statisticsData = img.processedData + GetElevationV2HeaderSize(header) - ElevationV2StatisticsSize;
+			statisticsOut.minElevation = (s16)ReadBigEndianU16(statisticsData + 0);
+			statisticsOut.maxElevation = (s16)ReadBigEndianU16(statisticsData + 2);
+			statisticsOut.numValidPixels = ReadBigEndianU32(statisticsData + 4);
+			statisticsOut.sumElevation = (s64)(((u64)ReadBigEndianU32(statisticsData + 8) << 32) | ReadBigEndianU32(statisticsData + 12));
+			return true;
+		}
+
+		bool DecompressElevationWindow(Image& img, int left, int top, int width, int height)
+		{
+			if (!img.processedData || img.processedDataSize < sizeof(ElevationHeader))
+			{
+				return false;
+			}
+
+			const u32 fourCC = ReadBigEndianU32(img.processedData);
+			if (fourCC == CompressedElevationModelFourCC.value)
+			{
+				return DecompressElevationV1Window(img, left, top, width, height);
+			}
+			if (fourCC == CompressedElevationModelV2FourCC.value)
+			{
+				return DecompressElevationV2Window(img, left, top, width, height);
+			}
+			return false;
+		}
+
 		void ConvertBigEndianToLocalEndianness(Image& img)
 		{
 #if LITTLE_ENDIAN
@@ -3,6 +3,8 @@
 
 #include "ImageProcessor.h"
 
+#include <vector>
+
 namespace dw
 {
 	static const s16 InvalidValueASTER = -9999;
@@ -88,9 +90,100 @@ namespace dw
 			}
 		};
 
-		bool CompressElevation(Image& img, const Variant& invalidValue);
+		enum CompressedElevationVersion
+		{
+			CEM_Version1 = 1,	// RLE and relative bulk segments per row
+			CEM_Version2 = 2,	// planar prediction and bit packed zigzag residuals per band of rows
+		};
+
+		struct ElevationCompressionOptions
+		{
+			CompressedElevationVersion version;
+			int columnsPerChunk; // version 2 only: splits bands into independently decodable chunks of this many columns (a multiple of 32), 0 keeps whole rows
+			int maxError; // version 2 only: maximum absolute error of valid pixels (at most 4095), 0 is lossless, invalid pixels are always exact
+			bool storeStatistics; // version 2 only: stores the ElevationStatistics in the header
+
+			ElevationCompressionOptions() : version(CEM_Version2), columnsPerChunk(0), maxError(0), storeStatistics(true) {}
+		};
+
+		// Statistics of the valid pixels of a compressed image as they are decoded, i.e. including the error of lossy compression.
+		// They are computed while encoding and can be read from the header without decoding the image.
+		struct ElevationStatistics
+		{
+			s16 minElevation; // 0 if there are no valid pixels
+			s16 maxElevation;
+			u32 numValidPixels;
+			s64 sumElevation;
+
+			ElevationStatistics() : minElevation(0x7FFF), maxElevation(-0x8000), numValidPixels(0), sumElevation(0) {}
+
+			f64 GetMeanElevation() const { return numValidPixels ? (f64)sumElevation / numValidPixels : 0.0; }
+			void Merge(const ElevationStatistics& other);
+		};
+
+		// Compresses the raw DT_S16 elevation of img into its processed data.
+		bool CompressElevation(Image& img, const Variant& invalidValue, const ElevationCompressionOptions& options = ElevationCompressionOptions());
+
+		// Upper bound of the compressed size of a width x height image, 0 if the options are invalid or the image exceeds 2^28 pixels.
+		size GetMaxCompressedElevationSize(int width, int height, const ElevationCompressionOptions& options = ElevationCompressionOptions());
+
+		// Compresses the raw DT_S16 elevation of img into compressed, which has to hold at least GetMaxCompressedElevationSize bytes, and returns
+		// the compressed size or 0 on failure. Nothing is allocated except a band of context per thread for version 2, thus a buffer can be
+		// reused for any number of tiles. The whole buffer serves as scratch space, not only the returned size.
+		size CompressElevation(const Image& img, const Variant& invalidValue, u8* compressed, size compressedCapacity, const ElevationCompressionOptions& options = ElevationCompressionOptions());
+
+		// Compresses elevation which arrives row by row, e.g. from an HTTP response body, into the version 2 format. Every band of rows is
+		// compressed as soon as its last row has been pushed, thus compression overlaps with receiving the next rows and only a band of
+		// rows has to be held besides the output. The result is identical to CompressElevation with the same options.
+		class ElevationStreamEncoder
+		{
+		public:
+			ElevationStreamEncoder();
+			ElevationStreamEncoder(const ElevationStreamEncoder&) = delete;
+
+			// compressed has to hold GetMaxCompressedElevationSize bytes and is written until Finish, only version 2 can be streamed
+			bool Begin(int width, int height, const Variant& invalidValue, u8* compressed, size compressedCapacity, const ElevationCompressionOptions& options = ElevationCompressionOptions());
+
+			// Appends numRows rows of width pixels. Whole bands are compressed straight from elevation, remaining rows are copied.
+			bool PushRows(const s16* elevation, int numRows);
+
+			// returns the compressed size once all rows have been pushed, 0 otherwise
+			size Finish();
+
+			int GetRowsPerBand() const;
+
+		private:
+			void CompressBand(const s16* elevation, int numRows);
+
+			int width;
+			int height;
+			Variant invalidValue;
+			ElevationCompressionOptions options;
+			u8* compressed;
+			size compressedSize;
+			int numCompressedRows;
+			std::vector<s16> pendingRows; // rows of the current band which have been pushed already
+			int numPendingRows;
+			std::vector<s16> context;
+			ElevationStatistics statistics;
+		};
+
+		// Decodes any version. Compressed data is validated while decoding, corrupt or truncated data fails instead of being read out of bounds.
 		bool DecompressElevation(Image& img);
 
+		// reads the size of the compressed elevation of img without decoding it
+		bool ReadCompressedElevationSize(const Image& img, int& widthOut, int& heightOut);
+
+		// Reads the statistics from the header of the compressed elevation of img, fails for images compressed without statistics.
+		// The header is at most 40 bytes, img may hold just the beginning of the compressed data.
+		bool ReadCompressedElevationStatistics(const Image& img, ElevationStatistics& statisticsOut);
+
+		// Decodes only the window of width x height pixels at left, top of the compressed elevation of img (any version), which becomes
+		// a raw image of the window size. Version 1 decodes the rows of the window and skips the segments left of it, version 2 decodes
+		// the chunks overlapping the window, thus narrow windows are cheapest with tiles compressed using columnsPerChunk.
+		bool DecompressElevationWindow(Image& img, int left, int top, int width, int height);
+		bool DecompressElevationReference(Image& img); // plain scalar version 1 decoder, used to verify and benchmark DecompressElevation
+
 		void ConvertBigEndianToLocalEndianness(Image& img);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,265 @@
+
+#include "ElevationTileStore.h"
+#include "Elevation.h"
+
+using namespace std;
+
+namespace dw
+{
+	namespace utils
+	{
+		static const u32 ElevationTileStoreFourCC = BigEndianU32::MakeFourCC('D', 'W', 'T', 'S').value;
+		static const u32 ElevationTileStoreVersion = 1;
+		static const u64 ElevationTileStoreAlignment = 4096; // raw tiles start at page boundaries
+
+		ElevationTileStore::ElevationTileStore()
+			: index(NULL)
+		{
+			memset(&grid, 0, sizeof(grid));
+		}
+
+		bool ElevationTileStore::Open(const string& filename)
+		{
+			if (!file.Open(filename, MemoryMappedFile::Access_ReadOnly))
+			{
+				return false;
+			}
+
+			if (file.GetSize() < sizeof(ElevationTileStoreHeader))
+			{
+				return false;
+			}
+
+			const ElevationTileStoreHeader* header = (const ElevationTileStoreHeader*)file.GetData();
+			if (header->fourCC != ElevationTileStoreFourCC || header->version != ElevationTileStoreVersion)
+			{
+				return false;
+			}
+
+			const u64 indexSize = (u64)header->numTilesX * header->numTilesY * sizeof(ElevationTileStoreIndexEntry);
+			if (header->indexOffset + indexSize > file.GetSize())
+			{
+				return false;
+			}
+
+			grid.originLongitude = header->originLongitude;
+			grid.originLatitude = header->originLatitude;
+			grid.numTilesX = header->numTilesX;
+			grid.numTilesY = header->numTilesY;
+			index = (const ElevationTileStoreIndexEntry*)(file.GetData() + header->indexOffset);
+
+			return true;
+		}
+
+		const ElevationTileStoreIndexEntry* ElevationTileStore::FindTile(int longitude, int latitude) const
+		{
+			const int x = longitude - grid.originLongitude;
+			const int y = latitude - grid.originLatitude;
+
+			if (!index || x < 0 || y < 0 || x >= (int)grid.numTilesX || y >= (int)grid.numTilesY)
+			{
+				return NULL;
+			}
+
+			const ElevationTileStoreIndexEntry* entry = &index[y * grid.numTilesX + x];
+			if (entry->encoding == TileEncoding_Missing || entry->offset + entry->dataSize > file.GetSize())
+			{
+				return NULL;
+			}
+
+			return entry;
+		}
+
+		bool ElevationTileStore::HasTile(int longitude, int latitude) const
+		{
+			return FindTile(longitude, latitude) != NULL;
+		}
+
+		bool ElevationTileStore::LoadTile(int longitude, int latitude, shared_ptr<Image>& tileOut) const
+		{
+			const ElevationTileStoreIndexEntry* entry = FindTile(longitude, latitude);
+			if (!entry)
+			{
+				return false;
+			}
+
+			u8* tileData = file.GetData() + entry->offset;
+
+			switch (entry->encoding)
+			{
+			case TileEncoding_Raw_S16:
+			{
+				if (entry->dataSize != (u64)entry->width * entry->height * sizeof(s16)) return false;
+
+				tileOut.reset(new Image(entry->width, entry->height, DT_S16, tileData, false));
+				return true;
+			}
+			case TileEncoding_CEM:
+			{
+				shared_ptr<Image> tile(new Image(tileData, entry->dataSize, CT_Image_Elevation, false));
+				if (!ConvertContentTypeToRawImage(*tile.get())) return false;
+
+				tileOut = tile;
+				return true;
+			}
+			default:
+				return false;
+			}
+		}
+
+		bool ElevationTileStore::GetTileSize(int longitude, int latitude, int& widthOut, int& heightOut) const
+		{
+			const ElevationTileStoreIndexEntry* entry = FindTile(longitude, latitude);
+			if (!entry)
+			{
+				return false;
+			}
+
+			widthOut = entry->width;
+			heightOut = entry->height;
+			return true;
+		}
+
+		bool ElevationTileStore::LoadTileWindow(int longitude, int latitude, int left, int top, int width, int height, shared_ptr<Image>& windowOut) const
+		{
+			const ElevationTileStoreIndexEntry* entry = FindTile(longitude, latitude);
+			if (!entry)
+			{
+				return false;
+			}
+
+			if (left < 0 || top < 0 || width <= 0 || height <= 0 || (u32)(left + width) > entry->width || (u32)(top + height) > entry->height)
+			{
+				return false;
+			}
+
+			u8* tileData = file.GetData() + entry->offset;
+
+			switch (entry->encoding)
+			{
+			case TileEncoding_Raw_S16:
+			{
+				if (entry->dataSize != (u64)entry->width * entry->height * sizeof(s16)) return false;
+
+				shared_ptr<Image> window(new Image(width, height, DT_S16));
+				const s16* tileElevation = (const s16*)tileData;
+				for (int y = 0; y < height; y++)
+				{
+					memcpy(&((s16*)window->rawData)[y * width], &tileElevation[(size)(top + y) * entry->width + left], width * sizeof(s16));
+				}
+
+				windowOut = window;
+				return true;
+			}
+			case TileEncoding_CEM:
+			{
+				shared_ptr<Image> window(new Image(tileData, entry->dataSize, CT_Image_Elevation, false));
+				if (!DecompressElevationWindow(*window.get(), left, top, width, height)) return false;
+
+				windowOut = window;
+				return true;
+			}
+			default:
+				return false;
+			}
+		}
+
+		ElevationTileStoreWriter::ElevationTileStoreWriter()
+			: endOfData(0)
+		{
+			memset(&grid, 0, sizeof(grid));
+		}
+
+		ElevationTileStoreWriter::~ElevationTileStoreWriter()
+		{
+		}
+
+		bool ElevationTileStoreWriter::Create(const string& filename, const ElevationTileStore::Grid& grid)
+		{
+			this->grid = grid;
+
+			index.resize(grid.numTilesX * grid.numTilesY);
+			memset(index.data(), 0, index.size() * sizeof(ElevationTileStoreIndexEntry));
+
+			file.open(filename.c_str(), ios::out | ios::trunc | ios::binary);
+			if (!file.is_open())
+			{
+				return false;
+			}
+
+			// header and index are written by Finish, tile data starts behind them
+			const u64 indexEnd = sizeof(ElevationTileStoreHeader) + index.size() * sizeof(ElevationTileStoreIndexEntry);
+			endOfData = (indexEnd + ElevationTileStoreAlignment - 1) & ~(ElevationTileStoreAlignment - 1);
+
+			return true;
+		}
+
+		bool ElevationTileStoreWriter::WriteTile(int longitude, int latitude, Image& tile, ElevationTileStore::TileEncoding encoding)
+		{
+			assert(tile.rawDataType == DT_S16);
+
+			const int x = longitude - grid.originLongitude;
+			const int y = latitude - grid.originLatitude;
+			if (x < 0 || y < 0 || x >= (int)grid.numTilesX || y >= (int)grid.numTilesY)
+			{
+				return false;
+			}
+
+			const u8* tileData = tile.rawData;
+			size tileDataSize = tile.rawDataSize;
+
+			if (encoding == ElevationTileStore::TileEncoding_CEM)
+			{
+				ElevationCompressionOptions options;
+				options.columnsPerChunk = ColumnsPerChunk;
+
+				tile.processedContentType = CT_Image_Elevation;
+				tile.FreeProcessedData();
+				if (!CompressElevation(tile, Variant(InvalidValueASTER), options))
+				{
+					return false;
+				}
+				tileData = tile.processedData;
+				tileDataSize = tile.processedDataSize;
+			}
+
+			lock_guard<mutex> lock(fileMutex);
+
+			ElevationTileStoreIndexEntry& entry = index[y * grid.numTilesX + x];
+			entry.offset = endOfData;
+			entry.dataSize = (u32)tileDataSize;
+			entry.encoding = (u16)encoding;
+			entry.reserved = 0;
+			entry.width = tile.width;
+			entry.height = tile.height;
+
+			file.seekp(entry.offset);
+			file.write((const char*)tileData, tileDataSize);
+
+			endOfData = (entry.offset + tileDataSize + ElevationTileStoreAlignment - 1) & ~(ElevationTileStoreAlignment - 1);
+
+			return file.good();
+		}
+
+		bool ElevationTileStoreWriter::Finish()
+		{
+			lock_guard<mutex> lock(fileMutex);
+
+			ElevationTileStoreHeader header;
+			header.fourCC = ElevationTileStoreFourCC;
+			header.version = ElevationTileStoreVersion;
+			header.originLongitude = grid.originLongitude;
+			header.originLatitude = grid.originLatitude;
+			header.numTilesX = grid.numTilesX;
+			header.numTilesY = grid.numTilesY;
+			header.indexOffset = sizeof(ElevationTileStoreHeader);
+
+			file.seekp(0);
+			file.write((const char*)&header, sizeof(header));
+			file.write((const char*)index.data(), index.size() * sizeof(ElevationTileStoreIndexEntry));
+			file.close();
+
+			return !file.fail();
+		}
+	}
+}
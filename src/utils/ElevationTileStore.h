@@ -0,0 +1,112 @@
+#pragma once
+
+#include "ImageProcessor.h"
+#include "MemoryMappedFile.h"
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace dw
+{
+	namespace utils
+	{
+		// on-disk structures (little endian)
+		struct ElevationTileStoreHeader
+		{
+			u32 fourCC;
+			u32 version;
+			s32 originLongitude;
+			s32 originLatitude;
+			u32 numTilesX;
+			u32 numTilesY;
+			u64 indexOffset;
+		};
+
+		struct ElevationTileStoreIndexEntry
+		{
+			u64 offset;
+			u32 dataSize;
+			u16 encoding;
+			u16 reserved;
+			u32 width;
+			u32 height;
+		};
+
+		// Native single file storage of elevation tiles which are laid out on a regular grid of one degree tiles.
+		// The file consists of a header, a dense index (one entry per grid cell) and the page aligned tile data.
+		// The whole file is memory mapped, thus accessing a tile is an index lookup plus an optional decompression.
+		class ElevationTileStore
+		{
+		public:
+			enum TileEncoding
+			{
+				TileEncoding_Missing = 0,
+				TileEncoding_Raw_S16 = 1,
+				TileEncoding_CEM = 2,
+			};
+
+			struct Grid
+			{
+				s32 originLongitude; // south-west corner of the first tile
+				s32 originLatitude;
+				u32 numTilesX;
+				u32 numTilesY;
+			};
+
+			ElevationTileStore();
+			ElevationTileStore(const ElevationTileStore&) = delete;
+
+			bool Open(const string& filename);
+
+			const Grid& GetGrid() const { return grid; }
+
+			bool HasTile(int longitude, int latitude) const;
+
+			// Raw tiles are not copied, the returned image points into the mapped file and must not be modified.
+			// It stays valid as long as the store is alive. Compressed tiles are decoded into a new image.
+			bool LoadTile(int longitude, int latitude, std::shared_ptr<Image>& tileOut) const;
+
+			bool GetTileSize(int longitude, int latitude, int& widthOut, int& heightOut) const;
+
+			// Loads the window of width x height pixels at left, top of a tile into a new image. Raw tiles copy the rows of the window,
+			// compressed tiles decode only the parts of the tile overlapping it (see DecompressElevationWindow).
+			bool LoadTileWindow(int longitude, int latitude, int left, int top, int width, int height, std::shared_ptr<Image>& windowOut) const;
+
+		private:
+			const ElevationTileStoreIndexEntry* FindTile(int longitude, int latitude) const;
+
+			MemoryMappedFile file;
+			Grid grid;
+			const ElevationTileStoreIndexEntry* index;
+		};
+
+		// Creates an ElevationTileStore file. WriteTile may be called concurrently.
+		class ElevationTileStoreWriter
+		{
+		public:
+			// compressed tiles are split into chunks of this many columns, which lets windows of a tile decode only the chunks they overlap
+			static const int ColumnsPerChunk = 512;
+
+			ElevationTileStoreWriter();
+			ElevationTileStoreWriter(const ElevationTileStoreWriter&) = delete;
+			~ElevationTileStoreWriter();
+
+			bool Create(const string& filename, const ElevationTileStore::Grid& grid);
+
+			// tile must be a raw DT_S16 image, in case of TileEncoding_CEM the tile gets compressed in place
+			bool WriteTile(int longitude, int latitude, Image& tile, ElevationTileStore::TileEncoding encoding);
+
+			// writes the index, the store is unusable until this succeeded
+			bool Finish();
+
+		private:
+			std::ofstream file;
+			std::mutex fileMutex;
+			ElevationTileStore::Grid grid;
+			std::vector<ElevationTileStoreIndexEntry> index;
+			u64 endOfData;
+		};
+	}
+}
@@ -20,6 +20,19 @@ using namespace Concurrency::graphics;
 #include <ZFXMath.h>
 #include "../utils/Filesystem.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DW_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if DW_X86
+#include <immintrin.h>
+#endif
+
 
 
 using namespace std;
@@ -93,7 +106,7 @@ namespace dw
 
 	void Image::FreeRawData()
 	{
-		assert(rawData != processedData);
+		assert(!rawData || rawData != processedData);
 		if (ownsRawDataPointer)
 		{
 			delete[] rawData;
@@ -151,7 +164,7 @@ namespace dw
 			return false;
 		}
 		file.close();
-		return true;
+		return !file.fail();
 	}
 
 	bool Image::LoadContentFromFile(const string& filename, ContentType contentType, shared_ptr<Image>& imageOut)
@@ -188,11 +201,17 @@ namespace dw
 
 
 	void Image::CopyFromSubImage(const Image& src, int targetX, int targetY)
+	{
+		CopyFromSubImage(src, 0, 0, src.width, src.height, targetX, targetY);
+	}
+
+	void Image::CopyFromSubImage(const Image& src, int srcX, int srcY, int srcWidth, int srcHeight, int targetX, int targetY)
 	{
 		assert(src.rawDataType == rawDataType);
+		assert(srcX >= 0 && srcY >= 0 && srcX + srcWidth <= src.width && srcY + srcHeight <= src.height);
 
-		const int w = Min(width - targetX, src.width);
-		const int h = Min(height - targetY, src.height);
+		const int w = Min(width - targetX, srcWidth);
+		const int h = Min(height - targetY, srcHeight);
 
 		const size pixelSize = DataTypePixelSize[rawDataType];
 		const size srcPitch = src.width * pixelSize;
@@ -200,7 +219,7 @@ namespace dw
 
 		size rowSizeToCopy = w * pixelSize;
 
-		u8* srcRow = src.rawData;
+		u8* srcRow = &src.rawData[srcPitch * srcY + srcX * pixelSize];
 		u8* dstRow = &rawData[dstPitch * targetY + targetX * pixelSize];
 		for (int y = 0; y < h; y++)
 		{
@@ -762,6 +781,163 @@ namespace dw
 			return true;
 		}
 
+#if DW_X86
+		// Integer values are equal if all of their bytes are, the pattern repeats the invalid value. 128 bytes are compared
+		// between two early exits, which keeps the branch cheap compared to the loads.
+		DW_TARGET_AVX2 static bool IsMemoryFilledWithPatternAVX2(const u8* data, size numBytes, const u8* pattern)
+		{
+			const __m256i value = _mm256_loadu_si256((const __m256i*)pattern);
+			size i = 0;
+			for (; i + 128 <= numBytes; i += 128)
+			{
+				const __m256i equal0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)&data[i]), value);
+				const __m256i equal1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)&data[i + 32]), value);
+				const __m256i equal2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)&data[i + 64]), value);
+				const __m256i equal3 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)&data[i + 96]), value);
+				const __m256i equal = _mm256_and_si256(_mm256_and_si256(equal0, equal1), _mm256_and_si256(equal2, equal3));
+				if ((u32)_mm256_movemask_epi8(equal) != 0xFFFFFFFF) return false;
+			}
+			for (; i + 32 <= numBytes; i += 32)
+			{
+				const __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)&data[i]), value);
+				if ((u32)_mm256_movemask_epi8(equal) != 0xFFFFFFFF) return false;
+			}
+			for (; i < numBytes; i++)
+			{
+				if (data[i] != pattern[i & 31]) return false;
+			}
+			return true;
+		}
+
+		static bool IsMemoryFilledWithPatternSSE2(const u8* data, size numBytes, const u8* pattern)
+		{
+			const __m128i value = _mm_loadu_si128((const __m128i*)pattern);
+			size i = 0;
+			for (; i + 64 <= numBytes; i += 64)
+			{
+				const __m128i equal0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&data[i]), value);
+				const __m128i equal1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&data[i + 16]), value);
+				const __m128i equal2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&data[i + 32]), value);
+				const __m128i equal3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&data[i + 48]), value);
+				const __m128i equal = _mm_and_si128(_mm_and_si128(equal0, equal1), _mm_and_si128(equal2, equal3));
+				if (_mm_movemask_epi8(equal) != 0xFFFF) return false;
+			}
+			for (; i < numBytes; i++)
+			{
+				if (data[i] != pattern[i & 15]) return false;
+			}
+			return true;
+		}
+
+		// Floating point values are compared as such, like the scalar version: -0 equals 0 and NaN equals nothing
+		DW_TARGET_AVX2 static bool AreAllValuesEqualAVX2(const f32* values, size count, f32 value)
+		{
+			const __m256 needle = _mm256_set1_ps(value);
+			size i = 0;
+			for (; i + 32 <= count; i += 32)
+			{
+				const __m256 notEqual0 = _mm256_cmp_ps(_mm256_loadu_ps(&values[i]), needle, _CMP_NEQ_UQ);
+				const __m256 notEqual1 = _mm256_cmp_ps(_mm256_loadu_ps(&values[i + 8]), needle, _CMP_NEQ_UQ);
+				const __m256 notEqual2 = _mm256_cmp_ps(_mm256_loadu_ps(&values[i + 16]), needle, _CMP_NEQ_UQ);
+				const __m256 notEqual3 = _mm256_cmp_ps(_mm256_loadu_ps(&values[i + 24]), needle, _CMP_NEQ_UQ);
+				if (_mm256_movemask_ps(_mm256_or_ps(_mm256_or_ps(notEqual0, notEqual1), _mm256_or_ps(notEqual2, notEqual3)))) return false;
+			}
+			for (; i < count; i++)
+			{
+				if (values[i] != value) return false;
+			}
+			return true;
+		}
+
+		DW_TARGET_AVX2 static bool AreAllValuesEqualAVX2(const f64* values, size count, f64 value)
+		{
+			const __m256d needle = _mm256_set1_pd(value);
+			size i = 0;
+			for (; i + 16 <= count; i += 16)
+			{
+				const __m256d notEqual0 = _mm256_cmp_pd(_mm256_loadu_pd(&values[i]), needle, _CMP_NEQ_UQ);
+				const __m256d notEqual1 = _mm256_cmp_pd(_mm256_loadu_pd(&values[i + 4]), needle, _CMP_NEQ_UQ);
+				const __m256d notEqual2 = _mm256_cmp_pd(_mm256_loadu_pd(&values[i + 8]), needle, _CMP_NEQ_UQ);
+				const __m256d notEqual3 = _mm256_cmp_pd(_mm256_loadu_pd(&values[i + 12]), needle, _CMP_NEQ_UQ);
+				if (_mm256_movemask_pd(_mm256_or_pd(_mm256_or_pd(notEqual0, notEqual1), _mm256_or_pd(notEqual2, notEqual3)))) return false;
+			}
+			for (; i < count; i++)
+			{
+				if (values[i] != value) return false;
+			}
+			return true;
+		}
+
+		static bool AreAllValuesEqualSSE2(const f32* values, size count, f32 value)
+		{
+			const __m128 needle = _mm_set1_ps(value);
+			size i = 0;
+			for (; i + 16 <= count; i += 16)
+			{
+				const __m128 notEqual0 = _mm_cmpneq_ps(_mm_loadu_ps(&values[i]), needle);
+				const __m128 notEqual1 = _mm_cmpneq_ps(_mm_loadu_ps(&values[i + 4]), needle);
+				const __m128 notEqual2 = _mm_cmpneq_ps(_mm_loadu_ps(&values[i + 8]), needle);
+				const __m128 notEqual3 = _mm_cmpneq_ps(_mm_loadu_ps(&values[i + 12]), needle);
+				if (_mm_movemask_ps(_mm_or_ps(_mm_or_ps(notEqual0, notEqual1), _mm_or_ps(notEqual2, notEqual3)))) return false;
+			}
+			for (; i < count; i++)
+			{
+				if (values[i] != value) return false;
+			}
+			return true;
+		}
+
+		static bool AreAllValuesEqualSSE2(const f64* values, size count, f64 value)
+		{
+			const __m128d needle = _mm_set1_pd(value);
+			size i = 0;
+			for (; i + 8 <= count; i += 8)
+			{
+				const __m128d notEqual0 = _mm_cmpneq_pd(_mm_loadu_pd(&values[i]), needle);
+				const __m128d notEqual1 = _mm_cmpneq_pd(_mm_loadu_pd(&values[i + 2]), needle);
+				const __m128d notEqual2 = _mm_cmpneq_pd(_mm_loadu_pd(&values[i + 4]), needle);
+				const __m128d notEqual3 = _mm_cmpneq_pd(_mm_loadu_pd(&values[i + 6]), needle);
+				if (_mm_movemask_pd(_mm_or_pd(_mm_or_pd(notEqual0, notEqual1), _mm_or_pd(notEqual2, notEqual3)))) return false;
+			}
+			for (; i < count; i++)
+			{
+				if (values[i] != value) return false;
+			}
+			return true;
+		}
+
+		template<typename T>
+		static bool IsImageCompletelyInvalidInteger(const Image& img, const T invalidValue)
+		{
+			u8 pattern[32];
+			for (size i = 0; i < sizeof(pattern); i += sizeof(T))
+			{
+				memcpy(&pattern[i], &invalidValue, sizeof(T));
+			}
+			return IsAVX2Supported() ? IsMemoryFilledWithPatternAVX2(img.rawData, img.rawDataSize, pattern) : IsMemoryFilledWithPatternSSE2(img.rawData, img.rawDataSize, pattern);
+		}
+
+		template<typename T>
+		static bool IsImageCompletelyInvalidFloat(const Image& img, const T invalidValue)
+		{
+			const size count = img.rawDataSize / sizeof(T);
+			return IsAVX2Supported() ? AreAllValuesEqualAVX2((const T*)img.rawData, count, invalidValue) : AreAllValuesEqualSSE2((const T*)img.rawData, count, invalidValue);
+		}
+#else
+		// scalar fallback for other architectures
+		template<typename T>
+		static bool IsImageCompletelyInvalidInteger(const Image& img, const T invalidValue)
+		{
+			return IsImageCompletelyInvalid<T>(img, invalidValue);
+		}
+
+		template<typename T>
+		static bool IsImageCompletelyInvalidFloat(const Image& img, const T invalidValue)
+		{
+			return IsImageCompletelyInvalid<T>(img, invalidValue);
+		}
+#endif
+
 		bool IsImageCompletelyInvalid(const Image& img, const Variant& invalidValue)
 		{
 			assert(invalidValue.IsSet());
@@ -769,15 +945,15 @@ namespace dw
 			switch (img.rawDataType)
 			{
 			case DT_U8:
-				return IsImageCompletelyInvalid<u8>(img, invalidValue.GetValue().uint8[0]);
+				return IsImageCompletelyInvalidInteger<u8>(img, invalidValue.GetValue().uint8[0]);
 			case DT_S16:
-				return IsImageCompletelyInvalid<s16>(img, invalidValue.GetValue().sint16[0]);
+				return IsImageCompletelyInvalidInteger<s16>(img, invalidValue.GetValue().sint16[0]);
 			case DT_U32:
-				return IsImageCompletelyInvalid<u32>(img, invalidValue.GetValue().uint32[0]);
+				return IsImageCompletelyInvalidInteger<u32>(img, invalidValue.GetValue().uint32[0]);
 			case DT_F32:
-				return IsImageCompletelyInvalid<f32>(img, invalidValue.GetValue().float32[0]);
+				return IsImageCompletelyInvalidFloat<f32>(img, invalidValue.GetValue().float32[0]);
 			case DT_F64:
-				return IsImageCompletelyInvalid<f64>(img, invalidValue.GetValue().float64);
+				return IsImageCompletelyInvalidFloat<f64>(img, invalidValue.GetValue().float64);
 			default:
 				assert(false); // requested datatype not implemented yet, sorry
 				break;
@@ -785,5 +961,123 @@ namespace dw
 
 			return true;
 		}
+
+#if DW_SSE2
+		static inline int BitScanForward32(u32 mask)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return (int)index;
+#else
+			return __builtin_ctz(mask);
+#endif
+		}
+
+		static inline int BitScanReverse32(u32 mask)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanReverse(&index, mask);
+			return (int)index;
+#else
+			return 31 - __builtin_clz(mask);
+#endif
+		}
+#endif
+
+		size FindFirstValue(const s16* values, size count, s16 value)
+		{
+			size i = 0;
+#if DW_SSE2
+			const __m128i needle = _mm_set1_epi16(value);
+			for (; i + 8 <= count; i += 8)
+			{
+				const __m128i equal = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)&values[i]), needle);
+				const u32 mask = (u32)_mm_movemask_epi8(equal); // two bits per element
+				if (mask)
+				{
+					return i + BitScanForward32(mask) / 2;
+				}
+			}
+#endif
+			for (; i < count; i++)
+			{
+				if (values[i] == value) return i;
+			}
+			return count;
+		}
+
+		size FindLastValue(const s16* values, size count, s16 value)
+		{
+			size i = count;
+#if DW_SSE2
+			const __m128i needle = _mm_set1_epi16(value);
+			for (; i >= 8; i -= 8)
+			{
+				const __m128i equal = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)&values[i - 8]), needle);
+				const u32 mask = (u32)_mm_movemask_epi8(equal);
+				if (mask)
+				{
+					return i - 8 + BitScanReverse32(mask) / 2;
+				}
+			}
+#endif
+			while (i > 0)
+			{
+				i--;
+				if (values[i] == value) return i;
+			}
+			return count;
+		}
+
+		static s16 GetTileGridValue(const TileGrid& grid, int x, int y, s16 invalidValue)
+		{
+			const Image* tile = grid.tiles[(y / grid.tileSize) * grid.numTilesX + x / grid.tileSize];
+			return tile ? ((const s16*)tile->rawData)[(y % grid.tileSize) * grid.tileSize + x % grid.tileSize] : invalidValue;
+		}
+
+		bool SampleTileGrid(const TileGrid& grid, double x, double y, s16 invalidValue, s16& valueOut)
+		{
+			const int width = grid.numTilesX * grid.tileSize;
+			const int height = grid.numTilesY * grid.tileSize;
+			assert(width > 1 && height > 1);
+
+			x = Clamp(x, 0.0, (double)(width - 1));
+			y = Clamp(y, 0.0, (double)(height - 1));
+			const int x0 = min((int)x, width - 2);
+			const int y0 = min((int)y, height - 2);
+			const double fx = x - x0;
+			const double fy = y - y0;
+
+			const s16 v00 = GetTileGridValue(grid, x0, y0, invalidValue);
+			const s16 v10 = GetTileGridValue(grid, x0 + 1, y0, invalidValue);
+			const s16 v01 = GetTileGridValue(grid, x0, y0 + 1, invalidValue);
+			const s16 v11 = GetTileGridValue(grid, x0 + 1, y0 + 1, invalidValue);
+
+			if (v00 == invalidValue || v10 == invalidValue || v01 == invalidValue || v11 == invalidValue)
+			{
+				const s16 nearest = (fy < 0.5) ? ((fx < 0.5) ? v00 : v10) : ((fx < 0.5) ? v01 : v11);
+				if (nearest == invalidValue)
+				{
+					return false;
+				}
+
+				valueOut = nearest;
+				return true;
+			}
+
+			const double top = v00 + (v10 - v00) * fx;
+			const double bottom = v01 + (v11 - v01) * fx;
+			valueOut = (s16)floor(top + (bottom - top) * fy + 0.5);
+			return true;
+		}
+
+		bool SampleTileGridAt(const TileGrid& grid, double longitude, double latitude, s16 invalidValue, s16& valueOut)
+		{
+			const double x = (longitude - grid.originX) * grid.pixelsPerDegree;
+			const double y = (grid.originY - latitude) * grid.pixelsPerDegree;
+			return SampleTileGrid(grid, x, y, invalidValue, valueOut);
+		}
 	}
 }
\ No newline at end of file
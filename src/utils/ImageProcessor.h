@@ -35,6 +35,7 @@ namespace dw
 		bool SaveToPNG(const string& filename);
 
 		void CopyFromSubImage(const Image& src, int targetX, int targetY);
+		void CopyFromSubImage(const Image& src, int srcX, int srcY, int srcWidth, int srcHeight, int targetX, int targetY);
 
 		// srcType must be of same size as the DataType given in the ctor of this image
 		// dstType must be either one or four bytes wide (greyscale or rgba)
@@ -64,5 +65,31 @@ namespace dw
 		void SampleWithBoxFilter(const Image& src, Image& dst, const Variant& invalidValue = Variant());
 
 		bool IsImageCompletelyInvalid(const Image& img, const Variant& invalidValue);
+
+		// return the index of the first/last element which equals value or count if there is none (SSE2 accelerated)
+		size FindFirstValue(const s16* values, size count, s16 value);
+		size FindLastValue(const s16* values, size count, s16 value);
+
+		// Square s16 tiles of tileSize x tileSize pixels which are laid out in a grid of numTilesX x numTilesY (row major) and
+		// share no border pixels, e.g. CGIAR SRTMv4 tiles. Missing tiles are NULL.
+		struct TileGrid
+		{
+			const Image* const* tiles;
+			int numTilesX;
+			int numTilesY;
+			int tileSize;
+
+			double originX; // coordinates of the center of the first pixel of the first tile, rows go southwards
+			double originY;
+			double pixelsPerDegree;
+		};
+
+		// Bilinearly samples the grid at (x, y) in pixels of the whole grid, 0 is the center of the first pixel. Samples across
+		// a tile seam are taken from the neighboring tile, coordinates beyond the grid are clamped. If one of the four samples is
+		// invalid or missing the nearest one is used instead, returns false if that one is invalid or missing as well.
+		bool SampleTileGrid(const TileGrid& grid, double x, double y, s16 invalidValue, s16& valueOut);
+
+		// Same as above at the given coordinates in degrees, which are mapped to pixels by the origin of the grid
+		bool SampleTileGridAt(const TileGrid& grid, double longitude, double latitude, s16 invalidValue, s16& valueOut);
 	}
 }
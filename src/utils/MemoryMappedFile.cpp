@@ -0,0 +1,130 @@
+
+#include "MemoryMappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace dw
+{
+	namespace utils
+	{
+		MemoryMappedFile::MemoryMappedFile()
+			: data(NULL)
+			, dataSize(0)
+#ifdef _WIN32
+			, fileHandle(INVALID_HANDLE_VALUE)
+			, mappingHandle(NULL)
+#else
+			, fileDescriptor(-1)
+#endif
+		{
+		}
+
+		MemoryMappedFile::~MemoryMappedFile()
+		{
+			Close();
+		}
+
+#ifdef _WIN32
+		bool MemoryMappedFile::Open(const string& filename, Access access, size minSize)
+		{
+			Close();
+
+			const bool writable = (access == Access_ReadWrite);
+
+			fileHandle = CreateFileA(filename.c_str(),
+				writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+				FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+				writable ? OPEN_ALWAYS : OPEN_EXISTING,
+				FILE_ATTRIBUTE_NORMAL, NULL);
+			if (fileHandle == INVALID_HANDLE_VALUE) return false;
+
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(fileHandle, &fileSize)) { Close(); return false; }
+			dataSize = (size)fileSize.QuadPart;
+
+			if (writable && dataSize < minSize)
+			{
+				dataSize = minSize; // the mapping grows the file
+			}
+
+			if (dataSize == 0) { Close(); return false; }
+
+			mappingHandle = CreateFileMappingA(fileHandle, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, (DWORD)((u64)dataSize >> 32), (DWORD)(dataSize & 0xFFFFFFFF), NULL);
+			if (!mappingHandle) { Close(); return false; }
+
+			data = (u8*)MapViewOfFile(mappingHandle, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, dataSize);
+			if (!data) { Close(); return false; }
+
+			return true;
+		}
+
+		void MemoryMappedFile::Close()
+		{
+			if (data) UnmapViewOfFile(data);
+			if (mappingHandle) CloseHandle(mappingHandle);
+			if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+
+			data = NULL;
+			dataSize = 0;
+			mappingHandle = NULL;
+			fileHandle = INVALID_HANDLE_VALUE;
+		}
+
+		bool MemoryMappedFile::Flush()
+		{
+			return data && FlushViewOfFile(data, dataSize) && FlushFileBuffers(fileHandle);
+		}
+#else
+		bool MemoryMappedFile::Open(const string& filename, Access access, size minSize)
+		{
+			Close();
+
+			const bool writable = (access == Access_ReadWrite);
+
+			fileDescriptor = open(filename.c_str(), writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+			if (fileDescriptor < 0) return false;
+
+			struct stat fileStatus;
+			if (fstat(fileDescriptor, &fileStatus) != 0) { Close(); return false; }
+			dataSize = (size)fileStatus.st_size;
+
+			if (writable && dataSize < minSize)
+			{
+				if (ftruncate(fileDescriptor, (off_t)minSize) != 0) { Close(); return false; }
+				dataSize = minSize;
+			}
+
+			if (dataSize == 0) { Close(); return false; }
+
+			void* mapping = mmap(NULL, dataSize, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fileDescriptor, 0);
+			if (mapping == MAP_FAILED) { Close(); return false; }
+
+			data = (u8*)mapping;
+			return true;
+		}
+
+		void MemoryMappedFile::Close()
+		{
+			if (data) munmap(data, dataSize);
+			if (fileDescriptor >= 0) close(fileDescriptor);
+
+			data = NULL;
+			dataSize = 0;
+			fileDescriptor = -1;
+		}
+
+		bool MemoryMappedFile::Flush()
+		{
+			return data && msync(data, dataSize, MS_SYNC) == 0;
+		}
+#endif
+	}
+}
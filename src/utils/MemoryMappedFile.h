@@ -0,0 +1,47 @@
+#pragma once
+
+#include "../dwcore.h"
+
+namespace dw
+{
+	namespace utils
+	{
+		// Maps a whole file into the address space of the process.
+		class MemoryMappedFile
+		{
+		public:
+			enum Access
+			{
+				Access_ReadOnly,
+				Access_ReadWrite, // creates the file if necessary
+			};
+
+			MemoryMappedFile();
+			MemoryMappedFile(const MemoryMappedFile&) = delete;
+			~MemoryMappedFile();
+
+			// In read/write mode the file is grown to minSize bytes (zero filled) if it is smaller.
+			bool Open(const string& filename, Access access = Access_ReadOnly, size minSize = 0);
+			void Close();
+
+			// writes dirty pages back to disk (read/write mode only)
+			bool Flush();
+
+			bool IsOpen() const { return data != NULL; }
+
+			u8* GetData() const { return data; }
+			size GetSize() const { return dataSize; }
+
+		private:
+			u8* data;
+			size dataSize;
+
+#ifdef _WIN32
+			void* fileHandle;
+			void* mappingHandle;
+#else
+			int fileDescriptor;
+#endif
+		};
+	}
+}
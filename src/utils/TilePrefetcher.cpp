@@ -0,0 +1,178 @@
+
+#include "TilePrefetcher.h"
+
+#include <cmath>
+#include <unordered_set>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace dw
+{
+	namespace utils
+	{
+		static void LowerCurrentThreadPriority()
+		{
+#ifdef _WIN32
+			SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN); // lowers cpu, i/o and memory priority
+#elif defined(__linux__)
+			const pid_t threadId = (pid_t)syscall(SYS_gettid);
+			setpriority(PRIO_PROCESS, threadId, 19);
+
+			const int IOPRIO_WHO_PROCESS = 1;
+			const int IOPRIO_CLASS_IDLE = 3;
+			const int IOPRIO_CLASS_SHIFT = 13;
+			syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, threadId, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+		}
+
+		TilePrefetcher::TilePrefetcher(DecodedTileCache& cache, const EnumerateTiles& enumerateTiles, size budgetInBytes, u32 maxQueuedTiles)
+			: cache(cache)
+			, enumerateTiles(enumerateTiles)
+			, budgetInBytes(budgetInBytes)
+			, maxQueuedTiles(maxQueuedTiles)
+			, stop(false)
+		{
+			worker = thread(&TilePrefetcher::Run, this);
+		}
+
+		TilePrefetcher::~TilePrefetcher()
+		{
+			{
+				lock_guard<mutex> lock(queueMutex);
+				stop = true;
+				queue.clear();
+			}
+			queueChanged.notify_all();
+			worker.join();
+		}
+
+		void TilePrefetcher::OnRequest(const BBox& bbox)
+		{
+			if (!cache.IsEnabled() || budgetInBytes == 0)
+			{
+				return;
+			}
+
+			vector<BBox> predictedBBoxes;
+			{
+				lock_guard<mutex> lock(queueMutex);
+
+				history.push_back(bbox);
+				if (history.size() > MaxHistorySize)
+				{
+					history.pop_front();
+				}
+
+				PredictNextBBoxes(predictedBBoxes);
+			}
+
+			// enumerate outside of the lock, the worker should not wait for it
+			vector<Tile> tiles;
+			for (const auto& predictedBBox : predictedBBoxes)
+			{
+				enumerateTiles(predictedBBox, tiles);
+			}
+
+			deque<Tile> newQueue;
+			unordered_set<DecodedTileCache::Key> queuedKeys;
+			for (auto& tile : tiles)
+			{
+				if (newQueue.size() >= maxQueuedTiles)
+				{
+					break;
+				}
+				if (queuedKeys.insert(tile.key).second)
+				{
+					newQueue.push_back(move(tile));
+				}
+			}
+
+			{
+				lock_guard<mutex> lock(queueMutex);
+				queue.swap(newQueue); // tiles predicted by older requests are stale by now
+			}
+			queueChanged.notify_one();
+		}
+
+		void TilePrefetcher::PredictNextBBoxes(vector<BBox>& bboxesOut) const
+		{
+			const BBox& last = history.back();
+
+			// mean motion of the bbox centers over the recorded history
+			double motionX = 0.0;
+			double motionY = 0.0;
+			if (history.size() > 1)
+			{
+				const BBox& first = history.front();
+				const double numSteps = (double)(history.size() - 1);
+				motionX = ((last.minX + last.maxX) - (first.minX + first.maxX)) * 0.5 / numSteps;
+				motionY = ((last.minY + last.maxY) - (first.minY + first.maxY)) * 0.5 / numSteps;
+			}
+
+			// a motion of less than a tenth of the bbox is considered as zooming or jitter rather than panning
+			const bool isPanning = fabs(motionX) > last.GetWidth() * 0.1 || fabs(motionY) > last.GetHeight() * 0.1;
+			if (isPanning)
+			{
+				for (int step = 1; step <= 2; step++)
+				{
+					BBox predicted;
+					predicted.minX = last.minX + motionX * step;
+					predicted.minY = last.minY + motionY * step;
+					predicted.maxX = last.maxX + motionX * step;
+					predicted.maxY = last.maxY + motionY * step;
+					bboxesOut.push_back(predicted);
+				}
+			}
+			else // no preferred direction, the client may pan to any neighbor
+			{
+				BBox neighborhood;
+				neighborhood.minX = last.minX - last.GetWidth();
+				neighborhood.minY = last.minY - last.GetHeight();
+				neighborhood.maxX = last.maxX + last.GetWidth();
+				neighborhood.maxY = last.maxY + last.GetHeight();
+				bboxesOut.push_back(neighborhood);
+			}
+		}
+
+		void TilePrefetcher::Run()
+		{
+			LowerCurrentThreadPriority();
+
+			for (;;)
+			{
+				Tile tile;
+				{
+					unique_lock<mutex> lock(queueMutex);
+					queueChanged.wait(lock, [this] { return stop || !queue.empty(); });
+
+					if (stop)
+					{
+						return;
+					}
+
+					tile = move(queue.front());
+					queue.pop_front();
+				}
+
+				if (cache.GetStatistics().prefetchedBytes >= budgetInBytes)
+				{
+					// enough speculative tiles are waiting for a request, wait for the next request to predict again
+					lock_guard<mutex> lock(queueMutex);
+					queue.clear();
+					continue;
+				}
+
+				cache.Prefetch(tile.key, tile.load);
+			}
+		}
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "DecodedTileCache.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dw
+{
+	namespace utils
+	{
+		// Speculatively decodes source tiles into a DecodedTileCache ahead of the requests which will need them.
+		// The prefetcher watches the bounding boxes of recent requests, extrapolates the panning motion and
+		// prefetches the tiles around the predicted bounding box on a single low priority background thread.
+		// Requests carry no client identity, thus the request history is shared by all clients of a layer.
+		class TilePrefetcher
+		{
+		public:
+			struct Tile
+			{
+				DecodedTileCache::Key key;
+				DecodedTileCache::LoadTile load;
+			};
+
+			// appends all existing tiles overlapping the given bbox to tilesOut
+			typedef std::function<void(const BBox& bbox, std::vector<Tile>& tilesOut)> EnumerateTiles;
+
+			// Prefetching pauses as soon as budgetInBytes of prefetched tiles have not been acquired by a request yet.
+			TilePrefetcher(DecodedTileCache& cache, const EnumerateTiles& enumerateTiles, size budgetInBytes, u32 maxQueuedTiles);
+			TilePrefetcher(const TilePrefetcher&) = delete;
+			~TilePrefetcher();
+
+			// Records the bbox of a request and replaces all pending prefetches by the tiles around the predicted next bbox.
+			void OnRequest(const BBox& bbox);
+
+		private:
+			void PredictNextBBoxes(std::vector<BBox>& bboxesOut) const; // caller must hold mutex
+			void Run();
+
+			static const u32 MaxHistorySize = 4;
+
+			DecodedTileCache& cache;
+			const EnumerateTiles enumerateTiles;
+			const size budgetInBytes;
+			const u32 maxQueuedTiles;
+
+			std::mutex queueMutex;
+			std::condition_variable queueChanged;
+			std::deque<BBox> history; // most recent request last
+			std::deque<Tile> queue;
+			bool stop;
+
+			std::thread worker;
+		};
+	}
+}
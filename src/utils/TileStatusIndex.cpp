@@ -0,0 +1,169 @@
+
+#include "TileStatusIndex.h"
+#include "Elevation.h"
+#include "Filesystem.h"
+
+#include <atomic>
+#include <cassert>
+
+using namespace std;
+
+namespace dw
+{
+	namespace utils
+	{
+		static const u32 TileStatusIndexFourCC = BigEndianU32::MakeFourCC('D', 'W', 'T', 'I').value;
+		static const u32 TileStatusIndexVersion = 1;
+
+		static const int TilesPerByte = 4;
+		static const int BitsPerTile = 2;
+
+		// status bytes are updated with atomic read-modify-writes, four tiles share a byte
+		static_assert(sizeof(atomic<u8>) == 1, "atomic<u8> has to be a plain byte");
+
+		TileStatusIndex::TileStatusIndex()
+		{
+		}
+
+		TileStatusIndex::~TileStatusIndex()
+		{
+			Close();
+		}
+
+		size TileStatusIndex::GetLayout(const vector<u32>& numTilesPerLevel, vector<size>& levelOffsetsOut)
+		{
+			size offset = sizeof(TileStatusIndexHeader) + numTilesPerLevel.size() * sizeof(u32);
+
+			levelOffsetsOut.clear();
+			for (u32 numTiles : numTilesPerLevel)
+			{
+				offset = (offset + 7) & ~(size)7;
+				levelOffsetsOut.push_back(offset);
+				offset += (numTiles + TilesPerByte - 1) / TilesPerByte;
+			}
+
+			return offset;
+		}
+
+		bool TileStatusIndex::IsHeaderValid(u32 storageFourCC, const vector<u32>& numTilesPerLevel) const
+		{
+			const TileStatusIndexHeader* header = (const TileStatusIndexHeader*)file.GetData();
+			if (header->fourCC != TileStatusIndexFourCC || header->version != TileStatusIndexVersion ||
+				header->storageFourCC != storageFourCC || header->numLevels != (u32)numTilesPerLevel.size())
+			{
+				return false;
+			}
+
+			const u32* numTiles = (const u32*)(header + 1);
+			for (size l = 0; l < numTilesPerLevel.size(); l++)
+			{
+				if (numTiles[l] != numTilesPerLevel[l]) return false;
+			}
+
+			return true;
+		}
+
+		bool TileStatusIndex::Open(const string& filename, u32 storageFourCC, const vector<u32>& numTilesPerLevel)
+		{
+			Close();
+
+			// opening for writing would create the file
+			if (!exists(filename))
+			{
+				return false;
+			}
+
+			const size indexSize = GetLayout(numTilesPerLevel, levelOffsets);
+			if (!file.Open(filename, MemoryMappedFile::Access_ReadWrite) || file.GetSize() != indexSize || !IsHeaderValid(storageFourCC, numTilesPerLevel))
+			{
+				file.Close();
+				return false;
+			}
+
+			this->filename = filename;
+			return true;
+		}
+
+		bool TileStatusIndex::Create(const string& filename, u32 storageFourCC, const vector<u32>& numTilesPerLevel)
+		{
+			Close();
+
+			// a leftover of an interrupted creation would not be zero filled
+			const string tempFilename = filename + ".tmp";
+			error_code err;
+			remove(tempFilename, err);
+
+			const size indexSize = GetLayout(numTilesPerLevel, levelOffsets);
+			if (!file.Open(tempFilename, MemoryMappedFile::Access_ReadWrite, indexSize))
+			{
+				return false;
+			}
+
+			TileStatusIndexHeader* header = (TileStatusIndexHeader*)file.GetData();
+			header->fourCC = TileStatusIndexFourCC;
+			header->version = TileStatusIndexVersion;
+			header->storageFourCC = storageFourCC;
+			header->numLevels = (u32)numTilesPerLevel.size();
+			memcpy(header + 1, numTilesPerLevel.data(), numTilesPerLevel.size() * sizeof(u32));
+
+			this->filename = filename;
+			this->tempFilename = tempFilename;
+			return true;
+		}
+
+		bool TileStatusIndex::Commit()
+		{
+			if (tempFilename.empty() || !file.Flush())
+			{
+				return false;
+			}
+
+			// a mapped file cannot be renamed on Windows
+			const size indexSize = file.GetSize();
+			file.Close();
+
+			error_code err;
+			rename(tempFilename, filename, err);
+			tempFilename.clear();
+			if (err)
+			{
+				return false;
+			}
+
+			return file.Open(filename, MemoryMappedFile::Access_ReadWrite) && file.GetSize() == indexSize;
+		}
+
+		void TileStatusIndex::Close()
+		{
+			file.Close();
+			levelOffsets.clear();
+			filename.clear();
+			tempFilename.clear();
+		}
+
+		bool TileStatusIndex::Flush()
+		{
+			return file.Flush();
+		}
+
+		u8 TileStatusIndex::GetStatus(int level, u32 tileIndex) const
+		{
+			const atomic<u8>& statusByte = *(const atomic<u8>*)(file.GetData() + levelOffsets[level] + tileIndex / TilesPerByte);
+			const int shift = (tileIndex % TilesPerByte) * BitsPerTile;
+			return (statusByte.load(memory_order_relaxed) >> shift) & 3;
+		}
+
+		void TileStatusIndex::SetStatus(int level, u32 tileIndex, u8 status)
+		{
+			assert(status < 4);
+
+			atomic<u8>& statusByte = *(atomic<u8>*)(file.GetData() + levelOffsets[level] + tileIndex / TilesPerByte);
+			const int shift = (tileIndex % TilesPerByte) * BitsPerTile;
+
+			u8 oldByte = statusByte.load(memory_order_relaxed);
+			while (!statusByte.compare_exchange_weak(oldByte, (u8)((oldByte & ~(3 << shift)) | (status << shift)), memory_order_relaxed))
+			{
+			}
+		}
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "../dwcore.h"
+#include "MemoryMappedFile.h"
+
+#include <vector>
+
+namespace dw
+{
+	namespace utils
+	{
+		// on-disk structure (little endian), followed by the number of tiles of every level (u32) and the status bitmaps of the levels
+		struct TileStatusIndexHeader
+		{
+			u32 fourCC;
+			u32 version;
+			u32 storageFourCC; // the index is only valid for the storage which holds the tiles
+			u32 numLevels;
+		};
+
+		// Status of every tile of a tile cache (2 bits per tile), which is memory mapped as a whole. Thus a tile cache starts
+		// without enumerating its tiles and a status change is persisted by writing to memory. The status of a tile is set after
+		// the tile has been stored completely, thus a crash leaves at most a stored tile which is still flagged missing.
+		class TileStatusIndex
+		{
+		public:
+			TileStatusIndex();
+			TileStatusIndex(const TileStatusIndex&) = delete;
+			~TileStatusIndex();
+
+			// fails if the index does not exist or was created for other levels or another storage
+			bool Open(const string& filename, u32 storageFourCC, const std::vector<u32>& numTilesPerLevel);
+
+			// Creates an index with all tiles set to 0, which replaces the index at filename on Commit. Until then the index
+			// is usable but not persisted, a crash leaves the previous index behind.
+			bool Create(const string& filename, u32 storageFourCC, const std::vector<u32>& numTilesPerLevel);
+			bool Commit();
+
+			void Close();
+
+			// writes the changed status back to disk, which happens anyway once the index is closed or the process ends
+			bool Flush();
+
+			bool IsOpen() const { return file.IsOpen(); }
+
+			// thread safe, status has to be smaller than 4
+			u8 GetStatus(int level, u32 tileIndex) const;
+			void SetStatus(int level, u32 tileIndex, u8 status);
+
+		private:
+			static size GetLayout(const std::vector<u32>& numTilesPerLevel, std::vector<size>& levelOffsetsOut);
+			bool IsHeaderValid(u32 storageFourCC, const std::vector<u32>& numTilesPerLevel) const;
+
+			MemoryMappedFile file;
+			string filename;
+			string tempFilename; // set between Create and Commit
+			std::vector<size> levelOffsets;
+		};
+	}
+}
@@ -0,0 +1,679 @@
+
+#include "TileStorage.h"
+#include "Elevation.h"
+#include "Filesystem.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace dw
+{
+	namespace utils
+	{
+		static const u32 FileTileStorageFourCC = BigEndianU32::MakeFourCC('D', 'W', 'T', 'F').value;
+		static const u32 TileBundleFourCC = BigEndianU32::MakeFourCC('D', 'W', 'T', 'B').value;
+		static const u32 TileBundleVersion = 1;
+
+		string CreateZeroPaddedString(int number, u32 numberOfDigits)
+		{
+			string str = "";
+			string strEnd = to_string(number);
+			for (size d = strEnd.length(); d < numberOfDigits; d++)
+			{
+				str.push_back('0');
+			}
+			str += strEnd;
+			return str;
+		}
+
+		class FileTileStorage : public ITileStorage
+		{
+		public:
+			FileTileStorage(const string& storagePath, const string& fileExtension, u32 numLevelDigits, u32 numXDigits, u32 numYDigits)
+				: storagePath(storagePath)
+				, fileExtension(fileExtension)
+				, numLevelDigits(numLevelDigits)
+				, numXDigits(numXDigits)
+				, numYDigits(numYDigits)
+			{
+			}
+
+			virtual u32 GetFourCC() const override
+			{
+				return FileTileStorageFourCC;
+			}
+
+			virtual bool StoreTile(int x, int y, int level, const u8* data, size dataSize) override
+			{
+				path tilePath = GetTilePath(x, y, level);
+
+				error_code err;
+				create_directories(tilePath.parent_path(), err);
+
+				if (err)
+				{
+					cout << "Tile Storage Error: Creating Directory Failed: " << tilePath.parent_path() << " (" << err.message() << ")" << endl;
+					return false;
+				}
+
+				// the tile replaces its file at once, a crash never leaves a truncated tile behind
+				const string tempFilename = tilePath.string() + ".tmp";
+				{
+					ofstream file(tempFilename.c_str(), ios::out | ios::trunc | ios::binary);
+					file.write((const char*)data, dataSize);
+					file.close();
+
+					if (file.fail())
+					{
+						cout << "Tile Storage Error: writing to file failed: " << tempFilename << endl;
+						return false;
+					}
+				}
+
+				rename(tempFilename, tilePath, err);
+				if (err)
+				{
+					cout << "Tile Storage Error: renaming file failed: " << tilePath << " (" << err.message() << ")" << endl;
+					return false;
+				}
+
+				return true;
+			}
+
+			virtual bool LoadTile(int x, int y, int level, vector<u8>& dataOut, size maxDataSize) override
+			{
+				const path tilePath = GetTilePath(x, y, level);
+
+				error_code err;
+				const auto fileSize = file_size(tilePath, err);
+				if (err)
+				{
+					return false;
+				}
+
+				dataOut.resize(min((size)fileSize, maxDataSize));
+
+				ifstream file(tilePath.string(), ios::in | ios::binary);
+				file.read((char*)dataOut.data(), dataOut.size());
+				return (size)file.gcount() == dataOut.size();
+			}
+
+			virtual bool EnumerateTiles(int level, vector<StoredTile>& tilesOut) override
+			{
+				path levelPath = storagePath;
+				levelPath /= CreateZeroPaddedString(level, numLevelDigits);
+
+				if (!exists(levelPath))
+				{
+					return true;
+				}
+
+				for (directory_iterator di(levelPath); di != end(di); di++)
+				{
+					const auto& entity = *di;
+					if (!is_directory(entity.status())) continue;
+
+					int y = atoi(entity.path().filename().generic_string().c_str());
+
+					for (directory_iterator fi(entity.path()); fi != end(fi); fi++)
+					{
+						const auto& fileEntity = *fi;
+						const auto extension = fileEntity.path().extension();
+						if (is_regular_file(fileEntity.status()) && extension == fileExtension)
+						{
+							int x = atoi(fileEntity.path().filename().generic_string().c_str());
+
+							auto fileSize = file_size(fileEntity.path());
+
+							tilesOut.push_back({ x, y, (size)fileSize });
+						}
+					}
+				}
+
+				return true;
+			}
+
+		private:
+			path GetTilePath(int x, int y, int level) const
+			{
+				path tilePath = storagePath;
+				tilePath /= CreateZeroPaddedString(level, numLevelDigits);
+				tilePath /= CreateZeroPaddedString(y, numYDigits);
+				tilePath /= CreateZeroPaddedString(x, numXDigits) + fileExtension;
+				return tilePath;
+			}
+
+			const string storagePath;
+			const string fileExtension;
+			const u32 numLevelDigits;
+			const u32 numXDigits;
+			const u32 numYDigits;
+		};
+
+		// a file which is read and written at explicit offsets, thus threads share it without seeking
+		class RandomAccessFile
+		{
+		public:
+			RandomAccessFile();
+			RandomAccessFile(const RandomAccessFile&) = delete;
+			~RandomAccessFile();
+
+			bool Open(const string& filename); // opens an existing file for reading and writing
+			void Close();
+
+			bool IsOpen() const;
+
+			bool Read(u64 offset, void* data, size dataSize) const;
+			bool Write(u64 offset, const void* data, size dataSize);
+
+			u64 GetSize() const;
+
+		private:
+#ifdef _WIN32
+			void* fileHandle;
+#else
+			int fileDescriptor;
+#endif
+		};
+
+#ifdef _WIN32
+		RandomAccessFile::RandomAccessFile()
+			: fileHandle(INVALID_HANDLE_VALUE)
+		{
+		}
+
+		bool RandomAccessFile::Open(const string& filename)
+		{
+			Close();
+
+			// a compacted bundle replaces its file while it is still read
+			fileHandle = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+				OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			return fileHandle != INVALID_HANDLE_VALUE;
+		}
+
+		void RandomAccessFile::Close()
+		{
+			if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+			fileHandle = INVALID_HANDLE_VALUE;
+		}
+
+		bool RandomAccessFile::Read(u64 offset, void* data, size dataSize) const
+		{
+			OVERLAPPED overlapped = {};
+			overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+			overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+			DWORD numBytesRead = 0;
+			return ReadFile(fileHandle, data, (DWORD)dataSize, &numBytesRead, &overlapped) && numBytesRead == dataSize;
+		}
+
+		bool RandomAccessFile::Write(u64 offset, const void* data, size dataSize)
+		{
+			OVERLAPPED overlapped = {};
+			overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+			overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+			DWORD numBytesWritten = 0;
+			return WriteFile(fileHandle, data, (DWORD)dataSize, &numBytesWritten, &overlapped) && numBytesWritten == dataSize;
+		}
+
+		bool RandomAccessFile::IsOpen() const
+		{
+			return fileHandle != INVALID_HANDLE_VALUE;
+		}
+
+		u64 RandomAccessFile::GetSize() const
+		{
+			LARGE_INTEGER fileSize;
+			return GetFileSizeEx(fileHandle, &fileSize) ? (u64)fileSize.QuadPart : 0;
+		}
+#else
+		RandomAccessFile::RandomAccessFile()
+			: fileDescriptor(-1)
+		{
+		}
+
+		bool RandomAccessFile::Open(const string& filename)
+		{
+			Close();
+
+			fileDescriptor = open(filename.c_str(), O_RDWR);
+			return fileDescriptor >= 0;
+		}
+
+		void RandomAccessFile::Close()
+		{
+			if (fileDescriptor >= 0) close(fileDescriptor);
+			fileDescriptor = -1;
+		}
+
+		bool RandomAccessFile::Read(u64 offset, void* data, size dataSize) const
+		{
+			u8* dst = (u8*)data;
+			while (dataSize > 0)
+			{
+				const ssize_t numBytesRead = pread(fileDescriptor, dst, dataSize, (off_t)offset);
+				if (numBytesRead <= 0) return false;
+
+				dst += numBytesRead;
+				offset += numBytesRead;
+				dataSize -= numBytesRead;
+			}
+			return true;
+		}
+
+		bool RandomAccessFile::Write(u64 offset, const void* data, size dataSize)
+		{
+			const u8* src = (const u8*)data;
+			while (dataSize > 0)
+			{
+				const ssize_t numBytesWritten = pwrite(fileDescriptor, src, dataSize, (off_t)offset);
+				if (numBytesWritten <= 0) return false;
+
+				src += numBytesWritten;
+				offset += numBytesWritten;
+				dataSize -= numBytesWritten;
+			}
+			return true;
+		}
+
+		bool RandomAccessFile::IsOpen() const
+		{
+			return fileDescriptor >= 0;
+		}
+
+		u64 RandomAccessFile::GetSize() const
+		{
+			struct stat fileStatus;
+			return (fstat(fileDescriptor, &fileStatus) == 0) ? (u64)fileStatus.st_size : 0;
+		}
+#endif
+
+		RandomAccessFile::~RandomAccessFile()
+		{
+			Close();
+		}
+
+		class BundleTileStorage : public ITileStorage
+		{
+		public:
+			BundleTileStorage(const string& storagePath, u32 numLevelDigits)
+				: storagePath(storagePath)
+				, numLevelDigits(numLevelDigits)
+			{
+			}
+
+			virtual u32 GetFourCC() const override
+			{
+				return TileBundleFourCC;
+			}
+
+			virtual bool StoreTile(int x, int y, int level, const u8* data, size dataSize) override
+			{
+				Bundle* bundle = GetBundle(x, y, level, true);
+				if (!bundle)
+				{
+					return false;
+				}
+
+				lock_guard<mutex> lock(bundle->bundleMutex);
+
+				// the data is complete before the index entry refers to it, a crash in between leaves unreferenced data only
+				const u64 offset = bundle->endOfData;
+				if (!bundle->file->Write(offset, data, dataSize))
+				{
+					cout << "Tile Storage Error: writing to bundle failed: " << bundle->filename << endl;
+					return false;
+				}
+				bundle->endOfData += dataSize;
+				bundle->numUnreferencedBytes += dataSize; // until the entry refers to it
+
+				const int entryIndex = GetEntryIndex(x, y);
+				TileBundleIndexEntry& entry = bundle->index[entryIndex];
+				const TileBundleIndexEntry replacedEntry = entry;
+				entry.offset = offset;
+				entry.dataSize = (u32)dataSize;
+				entry.check = GetCheck(entry);
+
+				if (!bundle->file->Write(sizeof(TileBundleHeader) + entryIndex * sizeof(TileBundleIndexEntry), &entry, sizeof(entry)))
+				{
+					cout << "Tile Storage Error: writing to bundle failed: " << bundle->filename << endl;
+					entry.offset = 0;
+					return false;
+				}
+
+				bundle->numUnreferencedBytes -= dataSize;
+				if (IsValidEntry(replacedEntry))
+				{
+					bundle->numUnreferencedBytes += replacedEntry.dataSize;
+				}
+
+				// the tiles are copied once for at least as many bytes which have been replaced, thus a tile is copied a few times at most
+				const u64 numReferencedBytes = bundle->endOfData - GetDataOffset() - bundle->numUnreferencedBytes;
+				if (bundle->numUnreferencedBytes >= MinUnreferencedBytesToCompact && bundle->numUnreferencedBytes > numReferencedBytes)
+				{
+					CompactBundle(*bundle);
+				}
+
+				return true;
+			}
+
+			virtual bool LoadTile(int x, int y, int level, vector<u8>& dataOut, size maxDataSize) override
+			{
+				Bundle* bundle = GetBundle(x, y, level, false);
+				if (!bundle)
+				{
+					return false;
+				}
+
+				// the entry refers to the file it was read with, a compaction may replace the file of the bundle meanwhile
+				TileBundleIndexEntry entry;
+				shared_ptr<RandomAccessFile> file;
+				{
+					lock_guard<mutex> lock(bundle->bundleMutex);
+					entry = bundle->index[GetEntryIndex(x, y)];
+					file = bundle->file;
+				}
+
+				if (!IsValidEntry(entry))
+				{
+					return false;
+				}
+
+				dataOut.resize(min((size)entry.dataSize, maxDataSize));
+				return file->Read(entry.offset, dataOut.data(), dataOut.size());
+			}
+
+			virtual bool EnumerateTiles(int level, vector<StoredTile>& tilesOut) override
+			{
+				path levelPath = storagePath;
+				levelPath /= CreateZeroPaddedString(level, numLevelDigits);
+
+				if (!exists(levelPath))
+				{
+					return true;
+				}
+
+				for (directory_iterator fi(levelPath); fi != end(fi); fi++)
+				{
+					const auto& fileEntity = *fi;
+					const string filename = fileEntity.path().filename().generic_string();
+
+					int bundleRow, bundleColumn;
+					if (!is_regular_file(fileEntity.status()) || fileEntity.path().extension() != ".bundle" || sscanf(filename.c_str(), "R%dC%d", &bundleRow, &bundleColumn) != 2)
+					{
+						continue;
+					}
+
+					const int originX = bundleColumn * TileBundleSize;
+					const int originY = bundleRow * TileBundleSize;
+					Bundle* bundle = GetBundle(originX, originY, level, false);
+					if (!bundle)
+					{
+						continue;
+					}
+
+					lock_guard<mutex> lock(bundle->bundleMutex);
+					for (int e = 0; e < TileBundleSize * TileBundleSize; e++)
+					{
+						if (IsValidEntry(bundle->index[e]))
+						{
+							tilesOut.push_back({ originX + e % TileBundleSize, originY + e / TileBundleSize, bundle->index[e].dataSize });
+						}
+					}
+				}
+
+				return true;
+			}
+
+		private:
+			struct Bundle
+			{
+				string filename;
+				mutex bundleMutex;
+				shared_ptr<RandomAccessFile> file; // replaced by a compaction, held by the loads in flight
+				vector<TileBundleIndexEntry> index;
+				u64 endOfData;
+				u64 numUnreferencedBytes; // replaced tiles and data of tiles whose entry was not written
+			};
+
+			// a bundle is not rewritten for a few replaced tiles
+			static const u64 MinUnreferencedBytesToCompact = 1 << 20;
+
+			static int GetEntryIndex(int x, int y)
+			{
+				return (y % TileBundleSize) * TileBundleSize + (x % TileBundleSize);
+			}
+
+			// the tile data follows the header and the index
+			static u64 GetDataOffset()
+			{
+				return sizeof(TileBundleHeader) + (u64)TileBundleSize * TileBundleSize * sizeof(TileBundleIndexEntry);
+			}
+
+			static u32 GetCheck(const TileBundleIndexEntry& entry)
+			{
+				return (u32)(entry.offset ^ (entry.offset >> 32) ^ (entry.dataSize * 0x9E3779B1u) ^ 0x5A17C3E1u);
+			}
+
+			static bool IsValidEntry(const TileBundleIndexEntry& entry)
+			{
+				return entry.offset != 0 && entry.check == GetCheck(entry);
+			}
+
+			// opens the bundle containing the tile on its first use, returns NULL if it does not exist and create is false
+			Bundle* GetBundle(int x, int y, int level, bool create)
+			{
+				if (x < 0 || y < 0)
+				{
+					return NULL;
+				}
+
+				const int bundleColumn = x / TileBundleSize;
+				const int bundleRow = y / TileBundleSize;
+				const u64 key = ((u64)level << 48) | ((u64)bundleRow << 24) | (u64)bundleColumn;
+
+				lock_guard<mutex> lock(bundlesMutex);
+
+				auto existingBundle = bundles.find(key);
+				if (existingBundle != bundles.end())
+				{
+					return existingBundle->second.get();
+				}
+
+				path levelPath = storagePath;
+				levelPath /= CreateZeroPaddedString(level, numLevelDigits);
+
+				path bundlePath = levelPath;
+				bundlePath /= "R" + CreateZeroPaddedString(bundleRow, 4) + "C" + CreateZeroPaddedString(bundleColumn, 4) + ".bundle";
+
+				unique_ptr<Bundle> bundle(new Bundle());
+				bundle->filename = bundlePath.string();
+				bundle->index.resize(TileBundleSize * TileBundleSize);
+
+				const size indexSize = bundle->index.size() * sizeof(TileBundleIndexEntry);
+
+				if (!exists(bundlePath))
+				{
+					if (!create || !CreateBundle(levelPath, bundlePath, indexSize))
+					{
+						return NULL;
+					}
+				}
+
+				// the header and the whole index are read at once
+				vector<u8> headerAndIndex(sizeof(TileBundleHeader) + indexSize);
+				const TileBundleHeader* header = (const TileBundleHeader*)headerAndIndex.data();
+				bundle->file.reset(new RandomAccessFile());
+				if (!bundle->file->Open(bundle->filename) || !bundle->file->Read(0, headerAndIndex.data(), headerAndIndex.size()) ||
+					header->fourCC != TileBundleFourCC || header->version != TileBundleVersion || header->bundleSize != TileBundleSize)
+				{
+					cout << "Tile Storage Error: reading bundle failed: " << bundlePath << endl;
+					return NULL;
+				}
+				memcpy(bundle->index.data(), &headerAndIndex[sizeof(TileBundleHeader)], indexSize);
+				bundle->endOfData = bundle->file->GetSize();
+
+				u64 numReferencedBytes = 0;
+				for (const TileBundleIndexEntry& entry : bundle->index)
+				{
+					numReferencedBytes += IsValidEntry(entry) ? entry.dataSize : 0;
+				}
+				bundle->numUnreferencedBytes = bundle->endOfData - GetDataOffset() - numReferencedBytes;
+
+				Bundle* openedBundle = bundle.get();
+				bundles[key] = move(bundle);
+				return openedBundle;
+			}
+
+			// writes the header and an empty index, the bundle appears at once
+			static bool CreateBundle(const path& levelPath, const path& bundlePath, size indexSize)
+			{
+				error_code err;
+				create_directories(levelPath, err);
+
+				const string tempFilename = bundlePath.string() + ".tmp";
+				{
+					TileBundleHeader header;
+					header.fourCC = TileBundleFourCC;
+					header.version = TileBundleVersion;
+					header.bundleSize = TileBundleSize;
+					header.reserved = 0;
+
+					const vector<u8> index(indexSize, 0);
+
+					ofstream file(tempFilename.c_str(), ios::out | ios::trunc | ios::binary);
+					file.write((const char*)&header, sizeof(header));
+					file.write((const char*)index.data(), index.size());
+					file.close();
+
+					if (err || file.fail())
+					{
+						cout << "Tile Storage Error: creating bundle failed: " << bundlePath << endl;
+						return false;
+					}
+				}
+
+				rename(tempFilename, bundlePath, err);
+				if (err)
+				{
+					cout << "Tile Storage Error: creating bundle failed: " << bundlePath << " (" << err.message() << ")" << endl;
+					return false;
+				}
+
+				return true;
+			}
+
+			// Copies the current tiles of the bundle into a new file, which replaces the bundle at once. A crash leaves the previous
+			// bundle behind. The caller holds the mutex of the bundle, the bundle is kept as it is if the compaction fails.
+			bool CompactBundle(Bundle& bundle)
+			{
+				vector<TileBundleIndexEntry> index(bundle.index.size());
+				u64 offset = GetDataOffset();
+				for (size e = 0; e < index.size(); e++)
+				{
+					if (IsValidEntry(bundle.index[e]))
+					{
+						index[e].offset = offset;
+						index[e].dataSize = bundle.index[e].dataSize;
+						index[e].check = GetCheck(index[e]);
+						offset += index[e].dataSize;
+					}
+				}
+
+				const string tempFilename = bundle.filename + ".tmp";
+				{
+					TileBundleHeader header;
+					header.fourCC = TileBundleFourCC;
+					header.version = TileBundleVersion;
+					header.bundleSize = TileBundleSize;
+					header.reserved = 0;
+
+					ofstream file(tempFilename.c_str(), ios::out | ios::trunc | ios::binary);
+					file.write((const char*)&header, sizeof(header));
+					file.write((const char*)index.data(), index.size() * sizeof(TileBundleIndexEntry));
+
+					vector<u8> tile;
+					for (size e = 0; e < index.size() && file; e++)
+					{
+						if (!IsValidEntry(index[e]))
+						{
+							continue;
+						}
+
+						tile.resize(index[e].dataSize);
+						if (!bundle.file->Read(bundle.index[e].offset, tile.data(), tile.size()))
+						{
+							file.setstate(ios::failbit);
+							break;
+						}
+						file.write((const char*)tile.data(), tile.size());
+					}
+					file.close();
+
+					if (file.fail())
+					{
+						cout << "Tile Storage Error: compacting bundle failed: " << bundle.filename << endl;
+						error_code err;
+						remove(tempFilename, err);
+						return false;
+					}
+				}
+
+				// the new file is opened before it replaces the bundle, it stays open once it has been renamed
+				shared_ptr<RandomAccessFile> file(new RandomAccessFile());
+				error_code err;
+				if (file->Open(tempFilename))
+				{
+					rename(tempFilename, bundle.filename, err);
+				}
+
+				if (!file->IsOpen() || err)
+				{
+					cout << "Tile Storage Error: compacting bundle failed: " << bundle.filename << endl;
+					file.reset();
+					remove(tempFilename, err);
+					return false;
+				}
+
+				bundle.file = file;
+				bundle.index = index;
+				bundle.endOfData = offset;
+				bundle.numUnreferencedBytes = 0;
+				return true;
+			}
+
+			const string storagePath;
+			const u32 numLevelDigits;
+
+			mutex bundlesMutex;
+			map<u64, unique_ptr<Bundle>> bundles; // all bundles which have been used, they stay open
+		};
+
+		ITileStorage* ITileStorage::CreateFileStorage(const string& storagePath, const string& fileExtension, u32 numLevelDigits, u32 numXDigits, u32 numYDigits)
+		{
+			return new FileTileStorage(storagePath, fileExtension, numLevelDigits, numXDigits, numYDigits);
+		}
+
+		ITileStorage* ITileStorage::CreateBundleStorage(const string& storagePath, u32 numLevelDigits)
+		{
+			return new BundleTileStorage(storagePath, numLevelDigits);
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "../dwcore.h"
+
+#include <vector>
+
+namespace dw
+{
+	namespace utils
+	{
+		// on-disk structures of a tile bundle (little endian)
+		struct TileBundleHeader
+		{
+			u32 fourCC;
+			u32 version;
+			u32 bundleSize; // number of tiles along both axes
+			u32 reserved;
+		};
+
+		struct TileBundleIndexEntry
+		{
+			u64 offset; // 0 if the tile is missing
+			u32 dataSize;
+			u32 check; // detects an entry which was torn by a crash
+		};
+
+		// Persists the compressed tiles of the levels of a tile cache, tiles are addressed by their column x and row y within a level.
+		// Implementations are thread safe.
+		class ITileStorage
+		{
+		public:
+			struct StoredTile
+			{
+				int x;
+				int y;
+				size dataSize;
+			};
+
+			virtual ~ITileStorage() {};
+
+			// identifies the layout, e.g. to detect a tile index which was written for another storage
+			virtual u32 GetFourCC() const = 0;
+
+			// Stores the tile, an earlier version of it is replaced at once. A crash never leaves a partially stored tile behind.
+			virtual bool StoreTile(int x, int y, int level, const u8* data, size dataSize) = 0;
+
+			// loads at most maxDataSize bytes of the tile into dataOut, e.g. just the header of a compressed image
+			virtual bool LoadTile(int x, int y, int level, std::vector<u8>& dataOut, size maxDataSize = (size)-1) = 0;
+
+			// appends all stored tiles of a level to tilesOut
+			virtual bool EnumerateTiles(int level, std::vector<StoredTile>& tilesOut) = 0;
+
+			// one file per tile at storagePath/level/y/x.fileExtension
+			static ITileStorage* CreateFileStorage(const string& storagePath, const string& fileExtension, u32 numLevelDigits, u32 numXDigits, u32 numYDigits);
+
+			// Packs the tiles of a level into bundle files of TileBundleSize x TileBundleSize tiles at storagePath/level/RrrrrCcccc.bundle.
+			// A bundle starts with a dense index of all its tiles, which is read once, followed by the tile data. Thus a tile is read
+			// with a single read and a level consists of a few large files rather than thousands of small ones. Tiles are appended and
+			// their index entry is updated afterwards. A bundle is rewritten without its replaced tiles once they take up more space
+			// than its current tiles.
+			static ITileStorage* CreateBundleStorage(const string& storagePath, u32 numLevelDigits);
+
+			static const int TileBundleSize = 128;
+		};
+
+		// numbers with more digits are not truncated
+		string CreateZeroPaddedString(int number, u32 numberOfDigits);
+	}
+}
@@ -6,6 +6,7 @@
 #include <chrono>
 #include <iostream>
 #include <iomanip>
+#include <vector>
 
 using namespace dw;
 using namespace dw::utils;
@@ -15,6 +16,235 @@ using namespace std::chrono;
 
 #define TestTag "TestElevationCompression - "
 
+// decodes compressedImg NumIterations times, verifies the result against sourceImg and reports the throughput
+static bool TestDecompression(const char* decoderName, const Image& sourceImg, const Image& compressedImg, bool (*decompress)(Image&))
+{
+	const int NumIterations = 10;
+
+	Image decompressedElevationImg(compressedImg.processedData, compressedImg.processedDataSize, CT_Image_Elevation, false);
+
+	high_resolution_clock::time_point t1 = high_resolution_clock::now();
+
+	for (int i = 0; i < NumIterations; i++)
+	{
+		if (!decompress(decompressedElevationImg))
+		{
+			printf(TestTag "Unable to decompress elevation data with the %s\n", decoderName);
+			return false;
+		}
+	}
+
+	high_resolution_clock::time_point t2 = high_resolution_clock::now();
+	duration<double> time_span = duration_cast<duration<double>>(t2 - t1) / NumIterations;
+
+	std::cout << decoderName << ": " << compressedImg.processedDataSize << " bytes (" << std::setprecision(3) << compressedImg.processedDataSize * 8.0 / (sourceImg.width * sourceImg.height)
+		<< " bits per sample), decompressed within " << std::setprecision(5) << time_span.count() * 1000.0 << " ms (" << sourceImg.rawDataSize / time_span.count() / 1e9 << " GB/s)" << endl;
+
+	if (decompressedElevationImg.rawDataSize != sourceImg.rawDataSize ||
+		decompressedElevationImg.width != sourceImg.width ||
+		decompressedElevationImg.height != sourceImg.height)
+	{
+		printf(TestTag "Elevation buffer size decompressed by the %s does not match source buffer size.\n", decoderName);
+		return false;
+	}
+
+	if (memcmp(decompressedElevationImg.rawData, sourceImg.rawData, sourceImg.rawDataSize) != 0)
+	{
+		printf(TestTag "Elevation data decompressed by the %s does not match source data.\n", decoderName);
+		return false;
+	}
+
+	return true;
+}
+
+// decodes several windows of compressedImg and verifies them against the same pixels of sourceImg
+static bool TestWindowDecompression(const char* decoderName, const Image& sourceImg, const Image& compressedImg)
+{
+	struct Window { int left, top, width, height; };
+	const Window windows[] =
+	{
+		{ 0, 0, sourceImg.width, sourceImg.height },
+		{ 0, 0, 1, 1 },
+		{ sourceImg.width - 1, sourceImg.height - 1, 1, 1 },
+		{ 1000, 700, 256, 256 },
+		{ 250, 990, 200, 130 }, // around the lake
+		{ 17, 5, 31, sourceImg.height - 5 },
+		{ 255, 15, 2, 2 }, // corners of four chunks
+	};
+
+	int width, height;
+	if (!ReadCompressedElevationSize(compressedImg, width, height) || width != sourceImg.width || height != sourceImg.height)
+	{
+		printf(TestTag "Size read by the %s does not match the source size.\n", decoderName);
+		return false;
+	}
+
+	for (const Window& window : windows)
+	{
+		Image windowImg(compressedImg.processedData, compressedImg.processedDataSize, CT_Image_Elevation, false);
+
+		high_resolution_clock::time_point t1 = high_resolution_clock::now();
+
+		if (!DecompressElevationWindow(windowImg, window.left, window.top, window.width, window.height) ||
+			windowImg.width != window.width || windowImg.height != window.height)
+		{
+			printf(TestTag "Unable to decompress a %ix%i window with the %s\n", window.width, window.height, decoderName);
+			return false;
+		}
+
+		high_resolution_clock::time_point t2 = high_resolution_clock::now();
+		if (window.width == 256)
+		{
+			std::cout << decoderName << ": 256x256 window decompressed within " << std::setprecision(5) << duration_cast<duration<double>>(t2 - t1).count() * 1000.0 << " ms" << endl;
+		}
+
+		for (int y = 0; y < window.height; y++)
+		{
+			const s16* sourceRow = &((const s16*)sourceImg.rawData)[(window.top + y) * sourceImg.width + window.left];
+			if (memcmp(&((const s16*)windowImg.rawData)[y * window.width], sourceRow, window.width * sizeof(s16)) != 0)
+			{
+				printf(TestTag "Window at %i,%i decompressed by the %s does not match source data.\n", window.left, window.top, decoderName);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+// the statistics stored in the header have to describe the valid pixels as they are decoded
+static bool TestStatistics(const char* decoderName, const Image& compressedImg)
+{
+	ElevationStatistics statistics;
+	Image decompressedElevationImg(compressedImg.processedData, compressedImg.processedDataSize, CT_Image_Elevation, false);
+	if (!ReadCompressedElevationStatistics(compressedImg, statistics) || !DecompressElevation(decompressedElevationImg))
+	{
+		printf(TestTag "Unable to read the statistics of the %s\n", decoderName);
+		return false;
+	}
+
+	ElevationStatistics expected;
+	const s16* decompressed = (const s16*)decompressedElevationImg.rawData;
+	for (int i = 0; i < decompressedElevationImg.width * decompressedElevationImg.height; i++)
+	{
+		if (decompressed[i] != InvalidValueASTER)
+		{
+			expected.minElevation = Min(expected.minElevation, decompressed[i]);
+			expected.maxElevation = Max(expected.maxElevation, decompressed[i]);
+			expected.numValidPixels++;
+			expected.sumElevation += decompressed[i];
+		}
+	}
+
+	if (statistics.minElevation != expected.minElevation || statistics.maxElevation != expected.maxElevation ||
+		statistics.numValidPixels != expected.numValidPixels || statistics.sumElevation != expected.sumElevation)
+	{
+		printf(TestTag "Statistics of the %s do not match the decompressed elevation.\n", decoderName);
+		return false;
+	}
+
+	return true;
+}
+
+// compresses sourceImg with the given max error and verifies the error bound, invalid pixels have to stay exact
+static bool TestLossyCompression(const Image& sourceImg, int maxError)
+{
+	ElevationCompressionOptions options;
+	options.maxError = maxError;
+	Image compressedImg(sourceImg.width, sourceImg.height, DT_S16, sourceImg.rawData, false);
+	if (!CompressElevation(compressedImg, Variant(InvalidValueASTER), options))
+	{
+		printf(TestTag "Unable to compress elevation data with max error %i\n", maxError);
+		return false;
+	}
+
+	Image decompressedElevationImg(compressedImg.processedData, compressedImg.processedDataSize, CT_Image_Elevation, false);
+	if (!DecompressElevation(decompressedElevationImg) || decompressedElevationImg.rawDataSize != sourceImg.rawDataSize)
+	{
+		printf(TestTag "Unable to decompress elevation data with max error %i\n", maxError);
+		return false;
+	}
+
+	if (!TestStatistics("lossy CEM v2 decoder", compressedImg))
+	{
+		return false;
+	}
+
+	std::cout << "CEM v2 max error " << maxError << ": " << compressedImg.processedDataSize << " bytes (" << std::setprecision(3) << compressedImg.processedDataSize * 8.0 / (sourceImg.width * sourceImg.height) << " bits per sample)" << endl;
+
+	const s16* source = (const s16*)sourceImg.rawData;
+	const s16* decompressed = (const s16*)decompressedElevationImg.rawData;
+	for (int i = 0; i < sourceImg.width * sourceImg.height; i++)
+	{
+		const bool isInvalid = source[i] == InvalidValueASTER;
+		if (isInvalid != (decompressed[i] == InvalidValueASTER) || Abs(decompressed[i] - source[i]) > maxError)
+		{
+			printf(TestTag "Elevation data decompressed with max error %i exceeds the error bound.\n", maxError);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// pushes the rows of sourceImg in uneven portions, the stream has to match compressedImg, which was compressed at once with the same options
+static bool TestStreamCompression(const Image& sourceImg, const Image& compressedImg, const ElevationCompressionOptions& options)
+{
+	vector<u8> compressed(GetMaxCompressedElevationSize(sourceImg.width, sourceImg.height, options));
+
+	ElevationStreamEncoder encoder;
+	if (!encoder.Begin(sourceImg.width, sourceImg.height, Variant(InvalidValueASTER), compressed.data(), compressed.size(), options))
+	{
+		printf(TestTag "Unable to begin streaming compression\n");
+		return false;
+	}
+
+	const s16* source = (const s16*)sourceImg.rawData;
+	for (int y = 0, numRows = 1; y < sourceImg.height; y += numRows, numRows = numRows * 3 % 41)
+	{
+		numRows = Min(numRows, sourceImg.height - y);
+		if (!encoder.PushRows(&source[y * sourceImg.width], numRows))
+		{
+			printf(TestTag "Unable to push rows to the stream encoder\n");
+			return false;
+		}
+	}
+
+	const size compressedSize = encoder.Finish();
+	if (compressedSize != compressedImg.processedDataSize || memcmp(compressed.data(), compressedImg.processedData, compressedSize) != 0)
+	{
+		printf(TestTag "Streamed elevation data does not match elevation data compressed at once.\n");
+		return false;
+	}
+
+	return true;
+}
+
+// truncated and forged compressed data has to be rejected by the decoders instead of being read out of bounds
+static bool TestCorruptDecompression(const char* decoderName, const Image& compressedImg)
+{
+	vector<u8> corrupt(compressedImg.processedData, compressedImg.processedData + compressedImg.processedDataSize);
+
+	Image truncatedImg(corrupt.data(), corrupt.size() / 2, CT_Image_Elevation, false);
+	Image truncatedWindowImg(corrupt.data(), corrupt.size() / 2, CT_Image_Elevation, false);
+	if (DecompressElevation(truncatedImg) || DecompressElevationWindow(truncatedWindowImg, 0, 0, 1, compressedImg.height))
+	{
+		printf(TestTag "Truncated elevation data was accepted by the %s\n", decoderName);
+		return false;
+	}
+
+	// a height of 2^30 rows would allocate gigabytes if it was trusted
+	corrupt[8] = 0x40;
+	Image forgedImg(corrupt.data(), corrupt.size(), CT_Image_Elevation, false);
+	if (DecompressElevation(forgedImg))
+	{
+		printf(TestTag "Elevation data with a forged size was accepted by the %s\n", decoderName);
+		return false;
+	}
+
+	return true;
+}
+
 bool TestElevationCompression()
 {
 	const int ImageSize = 2048;
@@ -30,6 +260,13 @@ bool TestElevationCompression()
 			double noise = InterpolatedNoise(x * 0.2, y * 0.2);
 			*data = (s16)(noise * 500.0 + 500.0);
 			*dataVisual = (u8)(noise * 127.5 + 127.5);
+
+			const bool isVoid = (x > 300 && x < 420 && y > 1000 && y < 1100) || (x * 7 + y * 13) % 997 == 0; // a lake and scattered voids
+			if (isVoid)
+			{
+				*data = InvalidValueASTER;
+			}
+
 			data++;
 			dataVisual++;
 		}
@@ -44,34 +281,36 @@ bool TestElevationCompression()
 	//elevationImgVisual.SaveToPNG("C:/Dev/temp/noise.png");
 	//elevationImg.SaveProcessedDataToFile("C:/Dev/temp/noise.cem");
 
-	Image decompressedElevationImg(elevationImg.processedData, elevationImg.processedDataSize, elevationImg.processedContentType, false);
-
-	high_resolution_clock::time_point t1 = high_resolution_clock::now();
-
-	if (!ConvertContentTypeToRawImage(decompressedElevationImg))
+	ElevationCompressionOptions optionsV1;
+	optionsV1.version = CEM_Version1;
+	Image elevationImgV1(ImageSize, ImageSize, DT_S16, elevationImg.rawData, false);
+	if (!CompressElevation(elevationImgV1, Variant(InvalidValueASTER), optionsV1))
 	{
-		printf(TestTag "Unable to decompress elevation data\n");
+		printf(TestTag "Unable to compress elevation data with version 1\n");
 		return false;
 	}
 
-	high_resolution_clock::time_point t2 = high_resolution_clock::now();
-	duration<double> time_span = duration_cast<duration<double>>(t2 - t1) * 1000.0;
-
-	std::cout << "Elevation Decompression was done within " << std::setprecision(5) << time_span.count() << " ms" << endl;
-
-	if (decompressedElevationImg.rawDataSize != elevationImg.rawDataSize ||
-		decompressedElevationImg.width != elevationImg.width ||
-		decompressedElevationImg.height != elevationImg.height)
-	{
-		printf(TestTag "Decompressed elevation buffer size does not match source buffer size.\n");
-		return false;
-	}
-
-	if (memcmp(decompressedElevationImg.rawData, elevationImg.rawData, elevationImg.rawDataSize) != 0)
+	ElevationCompressionOptions optionsChunked;
+	optionsChunked.columnsPerChunk = 256;
+	Image elevationImgChunked(ImageSize, ImageSize, DT_S16, elevationImg.rawData, false);
+	if (!CompressElevation(elevationImgChunked, Variant(InvalidValueASTER), optionsChunked))
 	{
-		printf(TestTag "Decompressed elevation data does not match source data.\n");
+		printf(TestTag "Unable to compress elevation data with column chunks\n");
 		return false;
 	}
 
-	return true;
+	return TestDecompression("CEM v1 reference decoder", elevationImg, elevationImgV1, DecompressElevationReference) &&
+		TestDecompression("CEM v1 decoder", elevationImg, elevationImgV1, DecompressElevation) &&
+		TestDecompression("CEM v2 decoder", elevationImg, elevationImg, DecompressElevation) &&
+		TestDecompression("CEM v2 chunked decoder", elevationImg, elevationImgChunked, DecompressElevation) &&
+		TestWindowDecompression("CEM v1 window decoder", elevationImg, elevationImgV1) &&
+		TestWindowDecompression("CEM v2 window decoder", elevationImg, elevationImg) &&
+		TestWindowDecompression("CEM v2 chunked window decoder", elevationImg, elevationImgChunked) &&
+		TestStreamCompression(elevationImg, elevationImgChunked, optionsChunked) &&
+		TestStatistics("CEM v2 decoder", elevationImg) &&
+		TestStatistics("CEM v2 chunked decoder", elevationImgChunked) &&
+		TestCorruptDecompression("CEM v1 decoder", elevationImgV1) &&
+		TestCorruptDecompression("CEM v2 decoder", elevationImg) &&
+		TestLossyCompression(elevationImg, 1) &&
+		TestLossyCompression(elevationImg, 2);
 }
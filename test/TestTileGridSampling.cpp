@@ -0,0 +1,94 @@
+
+#include "../src/utils/ImageProcessor.h"
+
+#include <cstring>
+#include <cmath>
+#include <iostream>
+
+using namespace dw;
+using namespace dw::utils;
+using namespace std;
+
+#define TestTag "TestTileGridSampling - "
+
+// the layout of CGIAR SRTMv4 tiles (5 degrees at 1200 pixels per degree), neighboring tiles share no pixels
+static const int SRTMTileSize = 6000;
+static const int SRTMPixelsPerDegree = 1200;
+static const s16 InvalidValueSRTM = -32768;
+static const double AsterDegreesPerPixel = 1.0 / 3600.0;
+
+// linear across the whole grid, thus bilinear samples are exact
+static s16 GetGridValue(int x, int y)
+{
+	return (s16)(x + 2 * y);
+}
+
+static bool TestSample(const char* name, const TileGrid& grid, double x, double y, bool isValidExpected, s16 expectedValue)
+{
+	s16 value = 0;
+	const bool isValid = SampleTileGrid(grid, x, y, InvalidValueSRTM, value);
+	if (isValid != isValidExpected || (isValid && value != expectedValue))
+	{
+		printf(TestTag "%s: sampling (%g, %g) returned %d (valid: %d) instead of %d (valid: %d)\n", name, x, y, value, isValid, expectedValue, isValidExpected);
+		return false;
+	}
+	return true;
+}
+
+static bool TestSampleAt(const char* name, const TileGrid& grid, double longitude, double latitude, s16 expectedValue)
+{
+	s16 value = 0;
+	if (!SampleTileGridAt(grid, longitude, latitude, InvalidValueSRTM, value) || value != expectedValue)
+	{
+		printf(TestTag "%s: sampling %.6f;%.6f returned %d instead of %d\n", name, longitude, latitude, value, expectedValue);
+		return false;
+	}
+	return true;
+}
+
+bool TestTileGridSampling()
+{
+	// two tiles side by side, the one below the left tile is missing
+	Image left(SRTMTileSize, SRTMTileSize, DT_S16);
+	Image right(SRTMTileSize, SRTMTileSize, DT_S16);
+	for (int y = 0; y < SRTMTileSize; y++)
+	{
+		for (int x = 0; x < SRTMTileSize; x++)
+		{
+			((s16*)left.rawData)[y * SRTMTileSize + x] = GetGridValue(x, y);
+			((s16*)right.rawData)[y * SRTMTileSize + x] = GetGridValue(x + SRTMTileSize, y);
+		}
+	}
+	((s16*)right.rawData)[100 * SRTMTileSize + 100] = InvalidValueSRTM;
+
+	const Image* tiles[] = { &left, &right, NULL, NULL };
+	TileGrid grid;
+	grid.tiles = tiles;
+	grid.numTilesX = 2;
+	grid.numTilesY = 2;
+	grid.tileSize = SRTMTileSize;
+	grid.originX = -180.0; // srtm_01_01 and srtm_02_01
+	grid.originY = 60.0;
+	grid.pixelsPerDegree = SRTMPixelsPerDegree;
+
+	const int lastPixel = SRTMTileSize - 1;
+
+	return TestSample("pixel center", grid, 1234.0, 567.0, true, GetGridValue(1234, 567)) &&
+		TestSample("interpolation", grid, 1234.5, 567.25, true, (s16)floor(1234.5 + 2 * 567.25 + 0.5)) &&
+		TestSample("last pixel of a tile", grid, lastPixel, 10.0, true, GetGridValue(lastPixel, 10)) &&
+		TestSample("across the seam", grid, lastPixel + 0.5, 10.0, true, GetGridValue(lastPixel, 10) + 1) &&
+		TestSample("across the seam", grid, lastPixel + 0.75, 10.5, true, (s16)floor(lastPixel + 0.75 + 2 * 10.5 + 0.5)) &&
+		TestSample("first pixel of the next tile", grid, SRTMTileSize, 10.0, true, GetGridValue(SRTMTileSize, 10)) &&
+		TestSample("beyond the grid", grid, -3.0, -3.0, true, GetGridValue(0, 0)) &&
+		TestSample("beyond the grid", grid, 2 * SRTMTileSize + 3.0, 3.0, true, GetGridValue(2 * SRTMTileSize - 1, 3)) &&
+		TestSample("next to a void", grid, SRTMTileSize + 100.25, 100.75, true, GetGridValue(SRTMTileSize + 100, 101)) &&
+		TestSample("in a void", grid, SRTMTileSize + 100.25, 99.75, false, 0) &&
+		TestSample("next to a missing tile", grid, 10.25, lastPixel + 0.25, true, GetGridValue(10, lastPixel)) &&
+		TestSample("in a missing tile", grid, 10.25, lastPixel + 0.75, false, 0) &&
+		// ASTER pixels are centered on integer degrees like the first pixel of each SRTM tile, every third one hits an SRTM pixel
+		TestSampleAt("first ASTER pixel of a tile", grid, -180.0, 60.0, GetGridValue(0, 0)) &&
+		TestSampleAt("ASTER pixel on a tile border", grid, -175.0, 60.0, GetGridValue(SRTMTileSize, 0)) &&
+		TestSampleAt("ASTER pixel on a tile border", grid, -175.0, 59.0, GetGridValue(SRTMTileSize, SRTMPixelsPerDegree)) &&
+		TestSampleAt("ASTER pixel next to a tile border", grid, -175.0 - 3 * AsterDegreesPerPixel, 59.0 - 6 * AsterDegreesPerPixel,
+			GetGridValue(lastPixel, SRTMPixelsPerDegree + 2));
+}
@@ -0,0 +1,281 @@
+
+#include "../src/utils/TileStorage.h"
+#include "../src/utils/TileStatusIndex.h"
+#include "../src/utils/Filesystem.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace dw;
+using namespace dw::utils;
+using namespace std;
+
+#define TestTag "TestTileStorage - "
+
+static vector<u8> CreateTileData(size dataSize, u32 seed)
+{
+	vector<u8> data(dataSize);
+	for (size i = 0; i < dataSize; i++)
+	{
+		data[i] = (u8)((i * 31 + seed * 17) ^ (i >> 8));
+	}
+	return data;
+}
+
+static bool TestLoadTile(ITileStorage& storage, const char* name, int x, int y, int level, const vector<u8>& expectedData)
+{
+	vector<u8> data;
+	if (!storage.LoadTile(x, y, level, data) || data != expectedData)
+	{
+		printf(TestTag "%s: tile (%d,%d) of level %d was not loaded as it was stored\n", name, x, y, level);
+		return false;
+	}
+	return true;
+}
+
+static bool TestEnumerateTiles(ITileStorage& storage, const char* name, int level, vector<ITileStorage::StoredTile> expectedTiles)
+{
+	vector<ITileStorage::StoredTile> tiles;
+	if (!storage.EnumerateTiles(level, tiles))
+	{
+		printf(TestTag "%s: enumerating the tiles of level %d failed\n", name, level);
+		return false;
+	}
+
+	auto isBefore = [](const ITileStorage::StoredTile& a, const ITileStorage::StoredTile& b) { return a.y != b.y ? a.y < b.y : a.x < b.x; };
+	sort(tiles.begin(), tiles.end(), isBefore);
+	sort(expectedTiles.begin(), expectedTiles.end(), isBefore);
+
+	bool isEqual = tiles.size() == expectedTiles.size();
+	for (size t = 0; t < tiles.size() && isEqual; t++)
+	{
+		isEqual = tiles[t].x == expectedTiles[t].x && tiles[t].y == expectedTiles[t].y && tiles[t].dataSize == expectedTiles[t].dataSize;
+	}
+
+	if (!isEqual)
+	{
+		printf(TestTag "%s: enumerated %d tiles of level %d instead of %d\n", name, (int)tiles.size(), level, (int)expectedTiles.size());
+		return false;
+	}
+	return true;
+}
+
+// stores tiles of two bundles and two levels including an empty one, then reads them back with the storage which wrote them and a new one
+static bool TestStoredTiles(const string& storagePath, bool isBundleStorage)
+{
+	const char* name = isBundleStorage ? "bundles" : "files";
+
+	auto createStorage = [&]()
+	{
+		return unique_ptr<ITileStorage>(isBundleStorage ? ITileStorage::CreateBundleStorage(storagePath, 1) :
+			ITileStorage::CreateFileStorage(storagePath, ".cem", 1, 3, 3));
+	};
+
+	const vector<u8> tileA = CreateTileData(1000, 1);
+	const vector<u8> tileB = CreateTileData(3000, 2);
+	const vector<u8> tileC = CreateTileData(10, 3);
+	const vector<u8> emptyTile;
+
+	{
+		unique_ptr<ITileStorage> storage = createStorage();
+		if (!storage->StoreTile(0, 0, 0, tileB.data(), tileB.size()) || !storage->StoreTile(0, 0, 0, tileA.data(), tileA.size()) ||
+			!storage->StoreTile(5, 130, 0, tileB.data(), tileB.size()) || !storage->StoreTile(1, 0, 0, emptyTile.data(), emptyTile.size()) ||
+			!storage->StoreTile(3, 3, 1, tileC.data(), tileC.size()))
+		{
+			printf(TestTag "%s: storing tiles failed\n", name);
+			return false;
+		}
+
+		if (!TestLoadTile(*storage.get(), name, 0, 0, 0, tileA) || !TestLoadTile(*storage.get(), name, 5, 130, 0, tileB) ||
+			!TestLoadTile(*storage.get(), name, 1, 0, 0, emptyTile) || !TestLoadTile(*storage.get(), name, 3, 3, 1, tileC))
+		{
+			return false;
+		}
+	}
+
+	unique_ptr<ITileStorage> storage = createStorage();
+	if (!TestLoadTile(*storage.get(), name, 0, 0, 0, tileA) || !TestLoadTile(*storage.get(), name, 5, 130, 0, tileB) ||
+		!TestLoadTile(*storage.get(), name, 1, 0, 0, emptyTile) || !TestLoadTile(*storage.get(), name, 3, 3, 1, tileC))
+	{
+		return false;
+	}
+
+	vector<u8> header;
+	if (!storage->LoadTile(5, 130, 0, header, 16) || header.size() != 16 || memcmp(header.data(), tileB.data(), 16) != 0)
+	{
+		printf(TestTag "%s: loading the beginning of a tile failed\n", name);
+		return false;
+	}
+
+	vector<u8> missingTile;
+	if (storage->LoadTile(2, 2, 0, missingTile) || storage->LoadTile(3, 3, 2, missingTile))
+	{
+		printf(TestTag "%s: a missing tile was loaded\n", name);
+		return false;
+	}
+
+	return TestEnumerateTiles(*storage.get(), name, 0, { { 0, 0, tileA.size() }, { 1, 0, 0 }, { 5, 130, tileB.size() } }) &&
+		TestEnumerateTiles(*storage.get(), name, 1, { { 3, 3, tileC.size() } }) &&
+		TestEnumerateTiles(*storage.get(), name, 2, {});
+}
+
+// replacing a tile over and over again grows its bundle by the replaced tiles until the bundle is rewritten without them
+static bool TestBundleCompaction(const string& storagePath)
+{
+	const size TileDataSize = 256 * 1024;
+	const int NumReplacements = 20;
+
+	path bundlePath = storagePath;
+	bundlePath /= "0";
+	bundlePath /= "R0000C0000.bundle";
+
+	const u64 dataOffset = sizeof(TileBundleHeader) + (u64)ITileStorage::TileBundleSize * ITileStorage::TileBundleSize * sizeof(TileBundleIndexEntry);
+	const vector<u8> otherTile = CreateTileData(TileDataSize, 1000);
+	vector<u8> lastTile;
+	{
+		unique_ptr<ITileStorage> storage(ITileStorage::CreateBundleStorage(storagePath, 1));
+		if (!storage->StoreTile(1, 0, 0, otherTile.data(), otherTile.size()))
+		{
+			printf(TestTag "compaction: storing a tile failed\n");
+			return false;
+		}
+
+		u64 maxBundleSize = 0;
+		for (int r = 0; r < NumReplacements; r++)
+		{
+			lastTile = CreateTileData(TileDataSize, r);
+			if (!storage->StoreTile(0, 0, 0, lastTile.data(), lastTile.size()))
+			{
+				printf(TestTag "compaction: replacing a tile failed\n");
+				return false;
+			}
+			maxBundleSize = max(maxBundleSize, (u64)file_size(bundlePath));
+		}
+
+		// without compaction the bundle would hold all replaced tiles
+		if (maxBundleSize > dataOffset + 2 * 1024 * 1024)
+		{
+			printf(TestTag "compaction: the bundle grew to %llu bytes\n", (unsigned long long)maxBundleSize);
+			return false;
+		}
+
+		if (!TestLoadTile(*storage.get(), "compaction", 0, 0, 0, lastTile) || !TestLoadTile(*storage.get(), "compaction", 1, 0, 0, otherTile))
+		{
+			return false;
+		}
+	}
+
+	unique_ptr<ITileStorage> storage(ITileStorage::CreateBundleStorage(storagePath, 1));
+	return TestLoadTile(*storage.get(), "compaction", 0, 0, 0, lastTile) && TestLoadTile(*storage.get(), "compaction", 1, 0, 0, otherTile) &&
+		TestEnumerateTiles(*storage.get(), "compaction", 0, { { 0, 0, TileDataSize }, { 1, 0, TileDataSize } });
+}
+
+// the status survives reopening the index, an index of other levels or another storage is not opened
+static bool TestStatusIndex(const string& storagePath)
+{
+	path indexPath = storagePath;
+	indexPath /= "tiles.dwi";
+	const string filename = indexPath.string();
+
+	const u32 storageFourCC = 1234;
+	const vector<u32> numTilesPerLevel = { 2, 8, 32 };
+
+	{
+		TileStatusIndex index;
+		if (index.Open(filename, storageFourCC, numTilesPerLevel))
+		{
+			printf(TestTag "status index: an index which does not exist was opened\n");
+			return false;
+		}
+
+		if (!index.Create(filename, storageFourCC, numTilesPerLevel))
+		{
+			printf(TestTag "status index: creating the index failed\n");
+			return false;
+		}
+		index.SetStatus(0, 1, 2);
+		index.SetStatus(1, 5, 1);
+		index.SetStatus(2, 31, 3);
+		index.SetStatus(2, 30, 2);
+		index.SetStatus(2, 30, 0);
+
+		if (!index.Commit())
+		{
+			printf(TestTag "status index: committing the index failed\n");
+			return false;
+		}
+	}
+
+	TileStatusIndex index;
+	if (!index.Open(filename, storageFourCC, numTilesPerLevel))
+	{
+		printf(TestTag "status index: opening the index failed\n");
+		return false;
+	}
+
+	for (u32 level = 0; level < numTilesPerLevel.size(); level++)
+	{
+		for (u32 t = 0; t < numTilesPerLevel[level]; t++)
+		{
+			const u8 expectedStatus = (level == 0 && t == 1) ? 2 : (level == 1 && t == 5) ? 1 : (level == 2 && t == 31) ? 3 : 0;
+			if (index.GetStatus(level, t) != expectedStatus)
+			{
+				printf(TestTag "status index: tile %u of level %u has the status %d instead of %d\n", t, level, index.GetStatus(level, t), expectedStatus);
+				return false;
+			}
+		}
+	}
+	index.Close();
+
+	if (index.Open(filename, storageFourCC + 1, numTilesPerLevel) || index.Open(filename, storageFourCC, { 2, 8, 16 }) ||
+		index.Open(filename, storageFourCC, { 2, 8 }))
+	{
+		printf(TestTag "status index: an index of another storage or other levels was opened\n");
+		return false;
+	}
+
+	return true;
+}
+
+// numbers are padded to the number of digits but never truncated, which happens for a single tile or level with no digits
+static bool TestZeroPaddedStrings()
+{
+	if (CreateZeroPaddedString(7, 3) != "007" || CreateZeroPaddedString(0, 1) != "0" || CreateZeroPaddedString(0, 0) != "0" ||
+		CreateZeroPaddedString(12345, 3) != "12345")
+	{
+		printf(TestTag "zero padded strings: a number was not padded to its number of digits\n");
+		return false;
+	}
+	return true;
+}
+
+bool TestTileStorage()
+{
+	path root = temp_directory_path();
+	root /= "dw_test_tile_storage";
+
+	auto createEmptyDirectory = [&](const char* name)
+	{
+		path directory = root;
+		directory /= name;
+
+		error_code err;
+		remove_all(directory, err);
+		create_directories(directory, err);
+		return directory.string();
+	};
+
+	const bool isPassed = TestZeroPaddedStrings() &&
+		TestStoredTiles(createEmptyDirectory("bundles"), true) &&
+		TestStoredTiles(createEmptyDirectory("files"), false) &&
+		TestBundleCompaction(createEmptyDirectory("compaction")) &&
+		TestStatusIndex(createEmptyDirectory("index"));
+
+	error_code err;
+	remove_all(root, err);
+
+	return isPassed;
+}
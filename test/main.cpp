@@ -2,13 +2,17 @@
 
 bool TestElevationCompression();
 bool TestSDFRasterizer();
+bool TestTileGridSampling();
+bool TestTileStorage();
 
 int main(int argc, const char* argv[])
 {
 	int numFailedTests = 0;
 
-	//if (!TestElevationCompression()) numFailedTests++;
+	if (!TestElevationCompression()) numFailedTests++;
 	if (!TestSDFRasterizer()) numFailedTests++;
+	if (!TestTileGridSampling()) numFailedTests++;
+	if (!TestTileStorage()) numFailedTests++;
 
 	return numFailedTests;
 }
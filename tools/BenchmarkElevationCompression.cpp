@@ -0,0 +1,239 @@
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <fstream>
+#include <vector>
+
+#include <ZFXMath.h>
+
+#include "../src/utils/ImageProcessor.h"
+#include "../src/utils/Elevation.h"
+#include "../src/utils/ElevationTileStore.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace dw;
+using namespace dw::utils;
+using namespace ZFXMath;
+
+// Measures compression ratio and encode/decode throughput of every CEM configuration on synthetic terrain classes
+// and on recorded tiles, which are either single CEM files or all tiles of an ElevationTileStore (up to 64 of them).
+//
+// usage: druckwelle_benchmark_cem [tile store or CEM file]...
+
+struct TestTile
+{
+	string name;
+	shared_ptr<Image> elevation;
+};
+
+struct Configuration
+{
+	const char* name;
+	ElevationCompressionOptions options;
+};
+
+static const int SyntheticTileSize = 3601; // an ASTER tile
+static const int NumIterations = 5;
+static const int MaxTilesPerStore = 64;
+
+// sums a few octaves of noise, amplitude and roughness define the terrain class
+static double FractalNoise(double x, double y, int numOctaves, double roughness)
+{
+	double sum = 0.0;
+	double amplitude = 1.0;
+	double frequency = 1.0;
+	for (int o = 0; o < numOctaves; o++)
+	{
+		sum += InterpolatedNoise(x * frequency, y * frequency) * amplitude;
+		amplitude *= roughness;
+		frequency *= 2.0;
+	}
+	return sum;
+}
+
+static shared_ptr<Image> CreateSyntheticTile(int terrainClass)
+{
+	shared_ptr<Image> tile(new Image(SyntheticTileSize, SyntheticTileSize, DT_S16));
+	s16* elevation = (s16*)tile->rawData;
+
+	for (int y = 0; y < SyntheticTileSize; y++)
+	{
+		for (int x = 0; x < SyntheticTileSize; x++)
+		{
+			double value = 0.0;
+			switch (terrainClass)
+			{
+			case 0: // flat ocean, a coast in the corner
+				value = Max(0.0, FractalNoise(x * 0.002, y * 0.002, 4, 0.5) * 300.0 - 250.0);
+				break;
+			case 1: // rolling hills
+				value = 400.0 + FractalNoise(x * 0.004, y * 0.004, 5, 0.45) * 150.0;
+				break;
+			case 2: // rugged mountains
+				value = 2500.0 + FractalNoise(x * 0.01, y * 0.01, 8, 0.6) * 1200.0;
+				break;
+			default: // mountains with voids, as ASTER has them below clouds and steep slopes
+				value = 2500.0 + FractalNoise(x * 0.01, y * 0.01, 8, 0.6) * 1200.0;
+				if (FractalNoise(x * 0.02 + 100.0, y * 0.02, 3, 0.5) > 0.4)
+				{
+					value = InvalidValueASTER;
+				}
+				break;
+			}
+			*elevation++ = (s16)value;
+		}
+	}
+
+	return tile;
+}
+
+static void LoadRecordedTiles(const string& filename, vector<TestTile>& tilesOut)
+{
+	ElevationTileStore store;
+	if (store.Open(filename))
+	{
+		const ElevationTileStore::Grid& grid = store.GetGrid();
+		int numTiles = 0;
+		for (int y = 0; y < (int)grid.numTilesY && numTiles < MaxTilesPerStore; y++)
+		{
+			for (int x = 0; x < (int)grid.numTilesX && numTiles < MaxTilesPerStore; x++)
+			{
+				shared_ptr<Image> storedTile;
+				if (store.LoadTile(grid.originLongitude + x, grid.originLatitude + y, storedTile))
+				{
+					// raw tiles point into the mapping of the store, which is closed after this function
+					TestTile tile;
+					tile.elevation.reset(new Image(storedTile->width, storedTile->height, DT_S16));
+					memcpy(tile.elevation->rawData, storedTile->rawData, tile.elevation->rawDataSize);
+					tile.name = filename + " " + to_string(grid.originLongitude + x) + "," + to_string(grid.originLatitude + y);
+					tilesOut.push_back(tile);
+					numTiles++;
+				}
+			}
+		}
+		return;
+	}
+
+	ifstream file(filename.c_str(), ios::binary);
+	vector<u8> compressed((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+	TestTile tile;
+	tile.name = filename;
+	tile.elevation.reset(new Image(compressed.data(), compressed.size(), CT_Image_Elevation, false));
+	if (compressed.empty() || !DecompressElevation(*tile.elevation.get()))
+	{
+		cout << "unable to load " << filename << endl;
+		return;
+	}
+	tile.elevation->processedData = NULL; // the file buffer is gone after this function
+	tile.elevation->processedDataSize = 0;
+	tilesOut.push_back(tile);
+}
+
+// encodes and decodes the tile NumIterations times and reports ratio and throughput, returns false if the round trip fails
+static bool BenchmarkTile(const TestTile& tile, const Configuration& configuration)
+{
+	const Image& src = *tile.elevation.get();
+	const size rawSize = (size)src.width * src.height * sizeof(s16);
+
+	vector<u8> compressed(GetMaxCompressedElevationSize(src.width, src.height, configuration.options));
+	size compressedSize = 0;
+
+	high_resolution_clock::time_point t1 = high_resolution_clock::now();
+	for (int i = 0; i < NumIterations; i++)
+	{
+		compressedSize = CompressElevation(src, Variant(InvalidValueASTER), compressed.data(), compressed.size(), configuration.options);
+	}
+	high_resolution_clock::time_point t2 = high_resolution_clock::now();
+
+	if (!compressedSize)
+	{
+		cout << tile.name << ": unable to compress with " << configuration.name << endl;
+		return false;
+	}
+
+	Image decompressed(compressed.data(), compressedSize, CT_Image_Elevation, false);
+	bool decoded = true;
+
+	high_resolution_clock::time_point t3 = high_resolution_clock::now();
+	for (int i = 0; i < NumIterations; i++)
+	{
+		decoded &= DecompressElevation(decompressed);
+	}
+	high_resolution_clock::time_point t4 = high_resolution_clock::now();
+
+	if (!decoded || decompressed.width != src.width || decompressed.height != src.height)
+	{
+		cout << tile.name << ": unable to decompress with " << configuration.name << endl;
+		return false;
+	}
+
+	const s16* source = (const s16*)src.rawData;
+	const s16* result = (const s16*)decompressed.rawData;
+	for (size i = 0; i < (size)src.width * src.height; i++)
+	{
+		if ((source[i] == InvalidValueASTER) != (result[i] == InvalidValueASTER) || Abs(result[i] - source[i]) > configuration.options.maxError)
+		{
+			cout << tile.name << ": decompressed elevation exceeds the error bound of " << configuration.name << endl;
+			return false;
+		}
+	}
+
+	const double encodeTime = duration_cast<duration<double>>(t2 - t1).count() / NumIterations;
+	const double decodeTime = duration_cast<duration<double>>(t4 - t3).count() / NumIterations;
+
+	cout << left << setw(28) << tile.name << setw(20) << configuration.name << right << fixed << setprecision(2)
+		<< setw(8) << compressedSize * 8.0 / ((size)src.width * src.height) << " bits/sample"
+		<< setw(8) << (double)rawSize / compressedSize << ":1"
+		<< setw(10) << rawSize / encodeTime / 1e6 << " MB/s encode"
+		<< setw(10) << rawSize / decodeTime / 1e6 << " MB/s decode" << endl;
+	cout.unsetf(ios::fixed);
+
+	return true;
+}
+
+int main(int argc, const char* argv[])
+{
+	vector<TestTile> tiles;
+
+	const char* terrainClassNames[] = { "flat ocean", "rolling hills", "rugged mountains", "void-heavy mountains" };
+	for (int c = 0; c < 4; c++)
+	{
+		TestTile tile;
+		tile.name = terrainClassNames[c];
+		tile.elevation = CreateSyntheticTile(c);
+		tiles.push_back(tile);
+	}
+
+	for (int a = 1; a < argc; a++)
+	{
+		LoadRecordedTiles(argv[a], tiles);
+	}
+
+	vector<Configuration> configurations(5);
+	configurations[0].name = "v1";
+	configurations[0].options.version = CEM_Version1;
+	configurations[1].name = "v2";
+	configurations[2].name = "v2 chunked";
+	configurations[2].options.columnsPerChunk = ElevationTileStoreWriter::ColumnsPerChunk;
+	configurations[3].name = "v2 max error 1";
+	configurations[3].options.maxError = 1;
+	configurations[4].name = "v2 max error 2";
+	configurations[4].options.maxError = 2;
+
+	int numFailed = 0;
+	for (const TestTile& tile : tiles)
+	{
+		for (const Configuration& configuration : configurations)
+		{
+			if (!BenchmarkTile(tile, configuration))
+			{
+				numFailed++;
+			}
+		}
+	}
+
+	return numFailed > 0 ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include "../src/utils/ImageProcessor.h"
+#include "../src/utils/Elevation.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace dw;
+using namespace dw::utils;
+
+// Measures SetTypedMemory and IsImageCompletelyInvalid for every data type against plain scalar loops, on a buffer which fits
+// into the caches and on one as large as the ASTER mosaic of QualityElevation, which is filled with non-temporal stores.
+//
+// usage: druckwelle_benchmark_memory
+
+static const int NumIterations = 10;
+
+template<typename T>
+static void FillScalar(T* dest, T value, size count)
+{
+	for (size i = 0; i < count; i++)
+	{
+		dest[i] = value;
+	}
+}
+
+template<typename T>
+static bool IsCompletelyInvalidScalar(const T* values, size count, T invalidValue)
+{
+	for (size i = 0; i < count; i++)
+	{
+		if (values[i] != invalidValue) return false;
+	}
+	return true;
+}
+
+template<typename F>
+static double MeasureGBPerSecond(size numBytes, F run)
+{
+	run(); // the first run touches the pages
+
+	high_resolution_clock::time_point t1 = high_resolution_clock::now();
+	for (int i = 0; i < NumIterations; i++)
+	{
+		run();
+	}
+	high_resolution_clock::time_point t2 = high_resolution_clock::now();
+
+	return numBytes * (double)NumIterations / duration_cast<duration<double>>(t2 - t1).count() / 1e9;
+}
+
+// returns false if a kernel disagrees with its scalar loop
+template<typename T>
+static bool BenchmarkDataType(const char* name, DataType dataType, T invalidValue, size numBytes)
+{
+	Image img((int)(numBytes / sizeof(T) / 1024), 1024, dataType);
+	T* values = (T*)img.rawData;
+	const size count = img.rawDataSize / sizeof(T);
+	const Variant invalid(invalidValue);
+
+	const double fillScalar = MeasureGBPerSecond(img.rawDataSize, [&] { FillScalar(values, invalidValue, count); });
+	const double fill = MeasureGBPerSecond(img.rawDataSize, [&] { SetTypedMemory(values, invalidValue, count); });
+
+	bool isInvalidScalar = false;
+	bool isInvalid = false;
+	const double scanScalar = MeasureGBPerSecond(img.rawDataSize, [&] { isInvalidScalar = IsCompletelyInvalidScalar(values, count, invalidValue); });
+	const double scan = MeasureGBPerSecond(img.rawDataSize, [&] { isInvalid = IsImageCompletelyInvalid(img, invalid); });
+
+	cout << left << setw(5) << name << right << setw(8) << (img.rawDataSize >> 20) << " MB" << fixed << setprecision(2)
+		<< "  fill " << setw(7) << fillScalar << " -> " << setw(7) << fill << " GB/s"
+		<< "  scan " << setw(7) << scanScalar << " -> " << setw(7) << scan << " GB/s" << endl;
+	cout.unsetf(ios::fixed);
+
+	// a single valid pixel at the end has to be found by the kernel as well
+	values[count - 1] = (T)(invalidValue + 1);
+	if (!isInvalidScalar || !isInvalid || IsImageCompletelyInvalid(img, invalid))
+	{
+		cout << name << ": IsImageCompletelyInvalid does not match the scalar loop" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, const char* argv[])
+{
+	cout << "AVX2 " << (IsAVX2Supported() ? "supported" : "not supported") << ", scalar loop -> kernel" << endl;
+
+	const size sizes[] = { 1 << 20, 400 << 20 };
+
+	int numFailed = 0;
+	for (size numBytes : sizes)
+	{
+		numFailed += BenchmarkDataType<u8>("u8", DT_U8, (u8)0xFF, numBytes) ? 0 : 1;
+		numFailed += BenchmarkDataType<s16>("s16", DT_S16, InvalidValueASTER, numBytes) ? 0 : 1;
+		numFailed += BenchmarkDataType<u32>("u32", DT_U32, (u32)0xFFFFFFFF, numBytes) ? 0 : 1;
+		numFailed += BenchmarkDataType<f32>("f32", DT_F32, -9999.0f, numBytes) ? 0 : 1;
+		numFailed += BenchmarkDataType<f64>("f64", DT_F64, -9999.0, numBytes) ? 0 : 1;
+	}
+
+	return numFailed > 0 ? 1 : 0;
+}
@@ -0,0 +1,187 @@
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <atomic>
+#include <vector>
+
+#pragma warning (push)
+#pragma warning (disable:4251)
+#include <gdal_priv.h>
+#pragma warning (pop)
+
+#include <omp.h>
+
+#include "../src/utils/ImageProcessor.h"
+#include "../src/utils/Elevation.h"
+#include "../src/utils/ElevationTileStore.h"
+#include "../src/utils/Filesystem.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace dw;
+using namespace dw::utils;
+
+// One-time conversion of the ASTER GDEM archive (zipped GeoTIFFs) into a single ElevationTileStore file,
+// which can be used by the QualityElevation layer via its TileStorePath setting.
+//
+// usage: druckwelle_convert_aster <ASTER directory> <tile store file> [cem|raw]
+
+struct ASTERSourceTile
+{
+	int longitude;
+	int latitude;
+	string filename_dem;
+};
+
+static bool ParseASTERFilename(const string& filepath, int& longitude, int& latitude)
+{
+	int latitudeSign = 1;
+	int longitudeSign = 1;
+
+	size_t coordinateStart = filepath.find_last_of('_');
+	size_t latOffset = filepath.find_last_of('N');
+	if (latOffset == std::string::npos || latOffset < coordinateStart)
+	{
+		latOffset = filepath.find_last_of('S');
+		latitudeSign = -1;
+	}
+	size_t lonOffset = filepath.find_last_of('E');
+	if (lonOffset == std::string::npos || lonOffset < coordinateStart)
+	{
+		lonOffset = filepath.find_last_of('W');
+		longitudeSign = -1;
+	}
+	if (latOffset == std::string::npos || lonOffset == std::string::npos)
+	{
+		return false;
+	}
+
+	latitude = atoi(filepath.c_str() + latOffset + 1) * latitudeSign;
+	longitude = atoi(filepath.c_str() + lonOffset + 1) * longitudeSign;
+	return true;
+}
+
+static bool LoadASTERSourceTile(const ASTERSourceTile& tile, shared_ptr<Image>& tileOut)
+{
+	GDALDataset* demDS = (GDALDataset*)GDALOpen(tile.filename_dem.c_str(), GA_ReadOnly);
+	if (!demDS)
+	{
+		return false;
+	}
+
+	bool success = false;
+	GDALRasterBand* demRasterBand = demDS->GetRasterBand(1);
+	if (demRasterBand && demRasterBand->GetRasterDataType() == GDT_Int16)
+	{
+		const int width = demRasterBand->GetXSize();
+		const int height = demRasterBand->GetYSize();
+
+		tileOut.reset(new Image(width, height, DT_S16));
+		success = demRasterBand->RasterIO(GF_Read, 0, 0, width, height, tileOut->rawData, width, height, GDT_Int16, 0, 0) == CE_None;
+	}
+
+	GDALClose(demDS);
+	return success;
+}
+
+int main(int argc, const char* argv[])
+{
+	if (argc < 3)
+	{
+		cout << "usage: " << argv[0] << " <ASTER directory> <tile store file> [cem|raw]" << endl;
+		return -1;
+	}
+
+	const path ASTERSourceDir(argv[1]);
+	const string tileStoreFilename = argv[2];
+	const string encodingName = (argc > 3) ? argv[3] : "cem";
+
+	ElevationTileStore::TileEncoding encoding;
+	if (encodingName == "cem") encoding = ElevationTileStore::TileEncoding_CEM;
+	else if (encodingName == "raw") encoding = ElevationTileStore::TileEncoding_Raw_S16;
+	else
+	{
+		cout << "unknown tile encoding: " << encodingName << endl;
+		return -1;
+	}
+
+	GDALRegister_GTiff();
+
+	vector<ASTERSourceTile> tiles;
+	for (directory_iterator di(ASTERSourceDir); di != end(di); di++)
+	{
+		const auto& entity = *di;
+		const auto extension = entity.path().extension();
+		if (!is_regular_file(entity.status()) || extension.generic_string() != ".zip")
+		{
+			continue;
+		}
+
+		ASTERSourceTile tile;
+		if (!ParseASTERFilename(entity.path().string(), tile.longitude, tile.latitude))
+		{
+			continue;
+		}
+
+		const string name = entity.path().stem().string(); // e.g. ASTGTM2_N47E011
+		tile.filename_dem = "/vsizip/" + entity.path().string() + "/" + name + "_dem.tif";
+		tiles.push_back(tile);
+	}
+
+	if (tiles.empty())
+	{
+		cout << "ASTER data not found in " << ASTERSourceDir << endl;
+		return -1;
+	}
+
+	ElevationTileStore::Grid grid;
+	grid.originLongitude = -180;
+	grid.originLatitude = -90;
+	grid.numTilesX = 360;
+	grid.numTilesY = 180;
+
+	ElevationTileStoreWriter writer;
+	if (!writer.Create(tileStoreFilename, grid))
+	{
+		cout << "unable to create tile store: " << tileStoreFilename << endl;
+		return -1;
+	}
+
+	high_resolution_clock::time_point t1 = high_resolution_clock::now();
+
+	atomic<int> numConvertedTiles(0);
+	atomic<int> numFailedTiles(0);
+	const int numTiles = (int)tiles.size();
+	#pragma omp parallel for schedule(dynamic)
+	for (int t = 0; t < numTiles; t++)
+	{
+		const auto& tile = tiles[t];
+
+		shared_ptr<Image> tileImg;
+		if (!LoadASTERSourceTile(tile, tileImg) || !writer.WriteTile(tile.longitude, tile.latitude, *tileImg.get(), encoding))
+		{
+			cout << "failed to convert " << tile.filename_dem << endl;
+			numFailedTiles++;
+			continue;
+		}
+
+		int numConverted = ++numConvertedTiles;
+		if (numConverted % 100 == 0)
+		{
+			cout << "converted " << numConverted << "/" << numTiles << " tiles" << '\r';
+		}
+	}
+
+	if (!writer.Finish())
+	{
+		cout << "unable to finish tile store: " << tileStoreFilename << endl;
+		return -1;
+	}
+
+	high_resolution_clock::time_point t2 = high_resolution_clock::now();
+	duration<double> time_span = duration_cast<duration<double>>(t2 - t1);
+	cout << "converted " << (int)numConvertedTiles << " tiles (" << (int)numFailedTiles << " failed) within " << std::setprecision(5) << time_span.count() << " s" << endl;
+
+	return numFailedTiles > 0 ? 1 : 0;
+}
@@ -0,0 +1,122 @@
+
+#include <cstdlib>
+#include <vector>
+
+#include "../src/utils/ImageProcessor.h"
+#include "../src/utils/Elevation.h"
+
+using namespace std;
+using namespace dw;
+using namespace dw::utils;
+
+// libFuzzer harness for the CEM codec, built with -DDW_BUILD_FUZZERS=ON and clang.
+// The first input byte selects the harness:
+// - even: the remaining bytes are fed to the decoders as a compressed image, which must be rejected or decoded without touching memory out of bounds
+// - odd: the remaining bytes describe an elevation image and compression options, which must survive a round trip within the requested error bound
+//
+// usage: druckwelle_fuzz_elevation [libFuzzer options] [corpus directory]
+
+static const int MaxFuzzedWidth = 1024;
+
+static void FuzzDecoder(const u8* data, size_t dataSize)
+{
+	// the decoders only read processedData, hence the input is borrowed instead of copied
+	Image img((u8*)data, dataSize, CT_Image_Elevation, false);
+
+	int width, height;
+	const bool hasSize = ReadCompressedElevationSize(img, width, height);
+
+	if (DecompressElevation(img))
+	{
+		if (!hasSize || img.width != width || img.height != height || img.rawDataType != DT_S16) abort();
+	}
+
+	if (hasSize && width > 0 && height > 0)
+	{
+		// a window touching the bottom right corner covers the last chunks and rows
+		Image window((u8*)data, dataSize, CT_Image_Elevation, false);
+		const int windowWidth = (width + 1) / 2;
+		const int windowHeight = (height + 1) / 2;
+		if (DecompressElevationWindow(window, width - windowWidth, height - windowHeight, windowWidth, windowHeight))
+		{
+			if (window.width != windowWidth || window.height != windowHeight) abort();
+		}
+	}
+}
+
+static void FuzzRoundTrip(const u8* data, size_t dataSize)
+{
+	if (dataSize < 4)
+	{
+		return;
+	}
+
+	ElevationCompressionOptions options;
+	options.version = (data[0] & 1) ? CEM_Version1 : CEM_Version2;
+	options.maxError = (options.version == CEM_Version2) ? (data[0] >> 1) & 7 : 0;
+	options.columnsPerChunk = (data[1] & 7) * 32;
+	const bool hasInvalidValue = (data[1] & 8) != 0;
+	const int width = 1 + (((data[2] << 8) | data[3]) % MaxFuzzedWidth);
+	data += 4;
+	dataSize -= 4;
+
+	// every input byte pair is a small delta to the previous pixel, an absolute value or an invalid pixel,
+	// this keeps most images compressible and still reaches the whole value range
+	const int numPixels = (int)(dataSize / 2);
+	const int height = numPixels / width;
+	if (height == 0)
+	{
+		return;
+	}
+
+	Image src(width, height, DT_S16);
+	s16* elevation = (s16*)src.rawData;
+	s16 value = 0;
+	for (int i = 0; i < width * height; i++)
+	{
+		const u8 a = data[i * 2];
+		const u8 b = data[i * 2 + 1];
+		if (b == 0xFF && hasInvalidValue)
+		{
+			elevation[i] = InvalidValueASTER;
+			continue;
+		}
+
+		value = (b >= 0x80) ? (s16)((a << 8) | b) : (s16)(value + (s8)a);
+		elevation[i] = value;
+	}
+
+	const Variant invalidValue = hasInvalidValue ? Variant(InvalidValueASTER) : Variant();
+
+	// the caller buffer API has to write into exactly the reported worst case size
+	const size maxCompressedSize = GetMaxCompressedElevationSize(width, height, options);
+	if (!maxCompressedSize) abort();
+
+	u8* compressed = new u8[maxCompressedSize];
+	const size compressedSize = CompressElevation(src, invalidValue, compressed, maxCompressedSize, options);
+	if (!compressedSize || compressedSize > maxCompressedSize) abort();
+
+	Image decoded(compressed, compressedSize, CT_Image_Elevation, true);
+	if (!DecompressElevation(decoded) || decoded.width != width || decoded.height != height) abort();
+
+	const s16* decodedElevation = (const s16*)decoded.rawData;
+	for (int i = 0; i < width * height; i++)
+	{
+		const bool isInvalid = hasInvalidValue && elevation[i] == InvalidValueASTER;
+		if (isInvalid != (hasInvalidValue && decodedElevation[i] == InvalidValueASTER)) abort();
+		if (!isInvalid && abs(decodedElevation[i] - elevation[i]) > options.maxError) abort();
+	}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const u8* data, size_t dataSize)
+{
+	if (dataSize == 0)
+	{
+		return 0;
+	}
+
+	if (data[0] & 1) FuzzRoundTrip(data + 1, dataSize - 1);
+	else FuzzDecoder(data + 1, dataSize - 1);
+
+	return 0;
+}